@@ -1,5 +1,6 @@
 #include "core.h"
 
+#include <cstdlib>
 #include <iostream>
 #include <stdexcept>
 #include <string>
@@ -115,6 +116,16 @@ Core::Core()
     }
     pluginNamesImGui_.push_back('\0');
 
+    // The first plugin can be chosen by name, e.g. for unattended benchmark runs.
+    if (const char* startPlugin = std::getenv("OGL4CORE2_PLUGIN")) {
+        const auto& plugins = PluginRegister::getAll();
+        for (std::size_t i = 0; i < plugins.size(); i++) {
+            if (plugins[i]->name() == startPlugin) {
+                pluginSelectionIdx_ = static_cast<int>(i);
+            }
+        }
+    }
+
     // Plugins will be initialized on the fly in render method. No need to duplicate initialization here.
 }
 
@@ -217,6 +228,10 @@ void Core::setWindowSize(int width, int height) const {
     glfwSetWindowSize(window_, width, height);
 }
 
+void Core::requestClose() const {
+    glfwSetWindowShouldClose(window_, GLFW_TRUE);
+}
+
 void Core::registerCamera(const std::shared_ptr<AbstractCamera>& camera) const {
     camera_ = camera;
 }
@@ -32,6 +32,7 @@ namespace OGL4Core2::Core {
         void getMousePos(double& xpos, double& ypos) const;
 
         void setWindowSize(int width, int height) const;
+        void requestClose() const;
 
         void registerCamera(const std::shared_ptr<AbstractCamera>& camera) const;
         void removeCamera() const;
@@ -0,0 +1,99 @@
+#include "DepthSorter.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "JobSystem.h"
+
+using namespace OGL4Core2::Plugins::PCVC::SnowGlobe;
+
+/**
+ * Unsigned key with the order of a float. Negative floats are inverted, positive ones get the sign bit.
+ */
+static inline std::uint32_t sortableKey(float value) {
+    std::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return (bits & 0x80000000u) != 0 ? ~bits : bits | 0x80000000u;
+}
+
+/**
+ * @brief Sort particles back to front. The view looks along -z, so the farthest particle has the smallest z
+ * in view space and comes first.
+ * @param particles    Particles as (x, y, z, life)
+ * @param count        Number of particles
+ * @param viewRowZ     Third row of the view matrix, gives the view space z of a position
+ * @param jobs         Threads running the chunks
+ */
+void DepthSorter::sort(const glm::vec4* particles, std::size_t count, const glm::vec4& viewRowZ, JobSystem& jobs) {
+    const std::size_t numChunks = (count + chunkSize - 1) / chunkSize;
+    keys.resize(count);
+    keysTmp.resize(count);
+    order.resize(count);
+    orderTmp.resize(count);
+    chunkHistograms.resize(numChunks);
+
+    jobs.parallelFor(numChunks, [&](std::size_t c) {
+        const std::size_t end = std::min(count, (c + 1) * chunkSize);
+        for (std::size_t i = c * chunkSize; i < end; i++) {
+            const glm::vec4& p = particles[i];
+            keys[i] = sortableKey(viewRowZ.x * p.x + viewRowZ.y * p.y + viewRowZ.z * p.z + viewRowZ.w);
+            order[i] = static_cast<std::uint32_t>(i);
+        }
+    });
+
+    for (int shift = 0; shift < 32; shift += 8) {
+        jobs.parallelFor(numChunks, [&](std::size_t c) {
+            auto& histogram = chunkHistograms[c];
+            histogram.fill(0);
+            const std::size_t end = std::min(count, (c + 1) * chunkSize);
+            for (std::size_t i = c * chunkSize; i < end; i++) {
+                histogram[(keys[i] >> shift) & 0xFF]++;
+            }
+        });
+
+        // Exclusive prefix sum, digit major, so every chunk writes behind the previous chunks of the same digit
+        std::size_t offset = 0;
+        bool sorted = false;
+        for (std::size_t digit = 0; digit < 256; digit++) {
+            const std::size_t first = offset;
+            for (auto& histogram : chunkHistograms) {
+                const std::size_t n = histogram[digit];
+                histogram[digit] = offset;
+                offset += n;
+            }
+            sorted = sorted || offset - first == count;
+        }
+        if (sorted) {
+            continue; // All keys share the digit, the pass would not move anything
+        }
+
+        jobs.parallelFor(numChunks, [&](std::size_t c) {
+            auto& histogram = chunkHistograms[c];
+            const std::size_t end = std::min(count, (c + 1) * chunkSize);
+            for (std::size_t i = c * chunkSize; i < end; i++) {
+                const std::size_t target = histogram[(keys[i] >> shift) & 0xFF]++;
+                keysTmp[target] = keys[i];
+                orderTmp[target] = order[i];
+            }
+        });
+        keys.swap(keysTmp);
+        order.swap(orderTmp);
+    }
+}
+
+/**
+ * @brief Write particles in the order of the last sort.
+ * @param particles    The particles of the last sort, their attributes may have changed since
+ * @param out          Sorted particles, must hold size() particles
+ * @param jobs         Threads running the chunks
+ */
+void DepthSorter::gather(const glm::vec4* particles, glm::vec4* out, JobSystem& jobs) const {
+    const std::size_t count = order.size();
+    const std::size_t numChunks = (count + chunkSize - 1) / chunkSize;
+    jobs.parallelFor(numChunks, [&](std::size_t c) {
+        const std::size_t end = std::min(count, (c + 1) * chunkSize);
+        for (std::size_t i = c * chunkSize; i < end; i++) {
+            out[i] = particles[order[i]];
+        }
+    });
+}
@@ -0,0 +1,41 @@
+#ifndef OGL4CORE2_PLUGINS_PCVC_SNOWGLOBE_DEPTHSORTER_H
+#define OGL4CORE2_PLUGINS_PCVC_SNOWGLOBE_DEPTHSORTER_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+namespace OGL4Core2::Plugins::PCVC::SnowGlobe {
+    class JobSystem;
+
+    /**
+     * Sorts particles back to front by a parallel LSD radix sort of their view depth. The depth is mapped to an
+     * unsigned key with the same order, so four passes of eight bits sort it. Every pass counts the digits per
+     * chunk, the prefix sum over the digits and chunks gives every chunk its own output range per digit, so the
+     * chunks scatter in parallel and the sort stays stable. Passes in which all keys share the digit are skipped.
+     *
+     * The sorted order is kept, so particles which did not change their order, e.g. because they were only
+     * interpolated, are reordered by gather() without sorting again.
+     */
+    class DepthSorter {
+    public:
+        static constexpr std::size_t chunkSize = 65536; //!< particles per job
+
+        void sort(const glm::vec4* particles, std::size_t count, const glm::vec4& viewRowZ, JobSystem& jobs);
+        void gather(const glm::vec4* particles, glm::vec4* out, JobSystem& jobs) const;
+
+        [[nodiscard]] std::size_t size() const { return order.size(); }
+
+    private:
+        std::vector<std::uint32_t> keys;                           //!< sortable depth per particle
+        std::vector<std::uint32_t> keysTmp;                        //!< target of a pass
+        std::vector<std::uint32_t> order;                          //!< input index per sorted particle
+        std::vector<std::uint32_t> orderTmp;                       //!< target of a pass
+        std::vector<std::array<std::size_t, 256>> chunkHistograms; //!< digit counts, then offsets per chunk
+    };
+} // namespace OGL4Core2::Plugins::PCVC::SnowGlobe
+
+#endif // OGL4CORE2_PLUGINS_PCVC_SNOWGLOBE_DEPTHSORTER_H
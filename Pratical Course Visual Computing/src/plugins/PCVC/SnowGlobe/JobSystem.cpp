@@ -0,0 +1,108 @@
+#include "JobSystem.h"
+
+#include <algorithm>
+
+using namespace OGL4Core2::Plugins::PCVC::SnowGlobe;
+
+// Pool and queue of the calling thread, if it is a worker.
+static thread_local const JobSystem* currentPool = nullptr;
+static thread_local std::size_t currentQueue = 0;
+
+/**
+ * @brief JobSystem constructor, starts the workers.
+ * @param numThreads   Number of workers, 0 uses all cores but the one of the render thread
+ */
+JobSystem::JobSystem(unsigned int numThreads) : numQueued(0), stop(false) {
+    if (numThreads == 0) {
+        numThreads = std::max(2u, std::thread::hardware_concurrency()) - 1;
+    }
+    for (unsigned int i = 0; i <= numThreads; i++) {
+        queues.push_back(std::make_unique<Queue>());
+    }
+    for (unsigned int i = 0; i < numThreads; i++) {
+        threads.emplace_back(&JobSystem::workerLoop, this, i);
+    }
+}
+
+/**
+ * @brief JobSystem destructor, stops the workers. Jobs which did not start yet are dropped.
+ */
+JobSystem::~JobSystem() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stop = true;
+    }
+    wake.notify_all();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+/**
+ * @brief Queue of the calling thread, the shared queue for threads outside of the pool.
+ */
+std::size_t JobSystem::queueIndex() const {
+    return currentPool == this ? currentQueue : queues.size() - 1;
+}
+
+/**
+ * @brief Add a job to the queue of the calling thread and wake a worker.
+ */
+void JobSystem::push(std::function<void()> job) {
+    Queue& queue = *queues[queueIndex()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.jobs.push_back(std::move(job));
+    }
+    numQueued.fetch_add(1);
+    {
+        // Pairs with the predicate check of sleeping workers, so the notification cannot get lost.
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    wake.notify_one();
+}
+
+/**
+ * @brief Run the newest job of the own queue, or steal the oldest job of another one.
+ * @return false if all queues were empty
+ */
+bool JobSystem::runOne() {
+    const std::size_t self = queueIndex();
+    std::function<void()> job;
+    {
+        std::lock_guard<std::mutex> lock(queues[self]->mutex);
+        if (!queues[self]->jobs.empty()) {
+            job = std::move(queues[self]->jobs.back());
+            queues[self]->jobs.pop_back();
+        }
+    }
+    for (std::size_t i = 1; !job && i < queues.size(); i++) {
+        Queue& victim = *queues[(self + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.jobs.empty()) {
+            job = std::move(victim.jobs.front());
+            victim.jobs.pop_front();
+        }
+    }
+    if (!job) {
+        return false;
+    }
+    numQueued.fetch_sub(1);
+    job();
+    return true;
+}
+
+/**
+ * @brief Run jobs until the pool is destroyed, sleep while there are none.
+ * @param index        Queue of the worker
+ */
+void JobSystem::workerLoop(std::size_t index) {
+    currentPool = this;
+    currentQueue = index;
+    while (!stop) {
+        if (!runOne()) {
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wake.wait(lock, [this]() { return stop || numQueued > 0; });
+        }
+    }
+}
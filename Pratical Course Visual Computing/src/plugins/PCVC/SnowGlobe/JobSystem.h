@@ -0,0 +1,93 @@
+#ifndef OGL4CORE2_PLUGINS_PCVC_SNOWGLOBE_JOBSYSTEM_H
+#define OGL4CORE2_PLUGINS_PCVC_SNOWGLOBE_JOBSYSTEM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace OGL4Core2::Plugins::PCVC::SnowGlobe {
+
+    /**
+     * Thread pool with a job queue per worker. Workers run the newest job of their own queue and steal the
+     * oldest job of another queue when theirs is empty, so the jobs a running job spawns stay on its thread
+     * while idle threads pick up the remaining work. Threads outside of the pool push to a shared queue.
+     * parallelFor() lets the calling thread work on its own jobs until all are done, so it may be nested in
+     * jobs without blocking a worker.
+     */
+    class JobSystem {
+    public:
+        explicit JobSystem(unsigned int numThreads = 0);
+        ~JobSystem();
+
+        JobSystem(const JobSystem&) = delete;
+        JobSystem& operator=(const JobSystem&) = delete;
+
+        [[nodiscard]] unsigned int numThreads() const { return static_cast<unsigned int>(threads.size()); }
+
+        /**
+         * Run func in the pool.
+         * @param func         The job
+         * @return the future result of func
+         */
+        template<typename F>
+        auto submit(F&& func) -> std::future<std::invoke_result_t<F>> {
+            auto task = std::make_shared<std::packaged_task<std::invoke_result_t<F>()>>(std::forward<F>(func));
+            auto result = task->get_future();
+            push([task]() { (*task)(); });
+            return result;
+        }
+
+        /**
+         * Run func(index) for all indices of [0, count) in the pool and wait for them. The calling thread runs
+         * jobs while it waits.
+         * @param count        Number of indices
+         * @param func         The kernel
+         */
+        template<typename F>
+        void parallelFor(std::size_t count, F&& func) {
+            std::atomic<std::size_t> remaining(count);
+            for (std::size_t i = 0; i < count; i++) {
+                push([&func, &remaining, i]() {
+                    func(i);
+                    remaining.fetch_sub(1, std::memory_order_release);
+                });
+            }
+            while (remaining.load(std::memory_order_acquire) > 0) {
+                if (!runOne()) {
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+    private:
+        /**
+         * Jobs of one worker, the owner works on the back and thieves take from the front.
+         */
+        struct Queue {
+            std::mutex mutex;
+            std::deque<std::function<void()>> jobs;
+        };
+
+        void push(std::function<void()> job);
+        bool runOne();
+        void workerLoop(std::size_t index);
+        [[nodiscard]] std::size_t queueIndex() const;
+
+        std::vector<std::unique_ptr<Queue>> queues; //!< one queue per worker and the shared one last
+        std::vector<std::thread> threads;           //!< the workers
+        std::atomic<std::size_t> numQueued;         //!< jobs in all queues
+        std::atomic<bool> stop;                     //!< the workers shall exit
+        std::mutex sleepMutex;                      //!< guards sleeping on wake
+        std::condition_variable wake;               //!< signals new jobs to sleeping workers
+    };
+} // namespace OGL4Core2::Plugins::PCVC::SnowGlobe
+
+#endif // OGL4CORE2_PLUGINS_PCVC_SNOWGLOBE_JOBSYSTEM_H
@@ -44,6 +44,7 @@ unsigned int Object::colorToId(const unsigned char col[3]) {
 
 Object::Object(SnowGlobe& basePlugin, int id, std::shared_ptr<glowl::Texture2D> tex, std::string filepath)
     : modelMx(glm::mat4(1.0f)),
+      collider(true),
       basePlugin(basePlugin),
       id(id),
       idCol(glm::vec3(0.0f)),
@@ -165,6 +166,7 @@ void Object::draw(const glm::mat4& projMx, const glm::mat4& viewMx) {
     glm::mat3 normalMx = glm::mat3(transpose(inverse(modelMx)));
     shaderProgram->setUniform("normalMx", normalMx);
     shaderProgram->setUniform("pickIdCol", idCol);
+    basePlugin.setSnowUniforms(*shaderProgram);
 
     // Set texture as uniform
     if (tex != nullptr) {
@@ -183,39 +185,34 @@ Base::Base(SnowGlobe& basePlugin, int id, std::shared_ptr<glowl::Texture2D> tex,
     : Object(basePlugin, id, std::move(tex), filepath) {
     initShaders();
 
-    const std::vector<float> baseVertices{
-        // clang-format off
-        -0.5f, -0.5f, 0.0f,
-         0.5f, -0.5f, 0.0f,
-        -0.5f,  0.5f, 0.0f,
-         0.5f,  0.5f, 0.0f,
-        // clang-format on
-    };
-
-    const std::vector<float> baseNormals{
-        // clang-format off
-        0.0f, 0.0f, 1.0f,
-        0.0f, 0.0f, 1.0f,
-        0.0f, 0.0f, 1.0f,
-        0.0f, 0.0f, 1.0f,
-        // clang-format on
-    };
-
-    const std::vector<float> baseTexCoords{
-        // clang-format off
-        0.0f, 0.0f,
-        1.0f, 0.0f,
-        0.0f, 1.0f,
-        1.0f, 1.0f,
-        // clang-format on
-    };
-
-    const std::vector<GLuint> baseIndices{0, 1, 2, 3};
+    // A grid instead of a single quad, so the snow layer can displace the board
+    const int gridRes = 128;
+    std::vector<float> baseVertices;
+    std::vector<float> baseNormals;
+    std::vector<float> baseTexCoords;
+    std::vector<GLuint> baseIndices;
+
+    for (int j = 0; j <= gridRes; j++) {
+        for (int i = 0; i <= gridRes; i++) {
+            float u = static_cast<float>(i) / gridRes;
+            float v = static_cast<float>(j) / gridRes;
+            baseVertices.insert(baseVertices.end(), {u - 0.5f, v - 0.5f, 0.0f});
+            baseNormals.insert(baseNormals.end(), {0.0f, 0.0f, 1.0f});
+            baseTexCoords.insert(baseTexCoords.end(), {u, v});
+        }
+    }
+    for (int j = 0; j < gridRes; j++) {
+        for (int i = 0; i < gridRes; i++) {
+            GLuint corner = j * (gridRes + 1) + i;
+            GLuint above = corner + gridRes + 1;
+            baseIndices.insert(baseIndices.end(), {corner, corner + 1, above, above, corner + 1, above + 1});
+        }
+    }
 
     glowl::VertexLayout baseLayout{
         {0}, {{3, GL_FLOAT, GL_FALSE, 0}, {3, GL_FLOAT, GL_FALSE, 0}, {2, GL_FLOAT, GL_FALSE, 0}}};
     va = std::make_unique<glowl::Mesh>(std::vector<std::vector<float>>{baseVertices, baseNormals, baseTexCoords},
-                                       baseIndices, baseLayout, GL_UNSIGNED_INT, GL_STATIC_DRAW, GL_TRIANGLE_STRIP);
+                                       baseIndices, baseLayout, GL_UNSIGNED_INT, GL_STATIC_DRAW, GL_TRIANGLES);
 }
 
 /**
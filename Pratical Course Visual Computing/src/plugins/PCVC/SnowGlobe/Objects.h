@@ -29,6 +29,7 @@ namespace OGL4Core2::Plugins::PCVC::SnowGlobe {
         virtual void reloadShaders() = 0;
 
         glm::mat4 modelMx;
+        bool collider; //!< snow lands on the object
 
     protected:
         SnowGlobe& basePlugin;
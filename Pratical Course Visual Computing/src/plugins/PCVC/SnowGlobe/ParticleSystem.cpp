@@ -0,0 +1,637 @@
+#include "ParticleSystem.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <utility>
+
+#include "JobSystem.h"
+
+#if defined(__AVX2__)
+#define SNOWGLOBE_PARTICLES_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SNOWGLOBE_PARTICLES_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace OGL4Core2::Plugins::PCVC::SnowGlobe;
+
+// Random streams, each attribute draws its own numbers.
+static constexpr std::uint32_t streamJitterX = 0;
+static constexpr std::uint32_t streamJitterY = 1;
+static constexpr std::uint32_t streamSpawnX = 2;
+static constexpr std::uint32_t streamSpawnY = 3;
+static constexpr std::uint32_t streamSpawnSpeed = 4;
+
+static constexpr float hashToUnit = 1.0f / 16777216.0f; // 24 bit hash to [0, 1)
+
+/**
+ * Integer hash with a good avalanche behaviour (lowbias32).
+ */
+static inline std::uint32_t hash(std::uint32_t v) {
+    v ^= v >> 16;
+    v *= 0x7feb352du;
+    v ^= v >> 15;
+    v *= 0x846ca68bu;
+    v ^= v >> 16;
+    return v;
+}
+
+/**
+ * Seed of a random stream in a frame.
+ */
+static inline std::uint32_t streamSeed(std::uint32_t frame, std::uint32_t stream) {
+    return hash(frame * 8u + stream);
+}
+
+/**
+ * Random number of a particle in [0, 1).
+ */
+static inline float randomUnit(std::uint32_t index, std::uint32_t seed) {
+    return static_cast<float>(hash(index ^ seed) >> 8) * hashToUnit;
+}
+
+/**
+ * Random number of a particle in [-1, 1).
+ */
+static inline float randomSigned(std::uint32_t index, std::uint32_t seed) {
+    return randomUnit(index, seed) * 2.0f - 1.0f;
+}
+
+#if defined(SNOWGLOBE_PARTICLES_AVX2) || defined(SNOWGLOBE_PARTICLES_SSE2)
+// Number of set bits of a four lane movemask.
+static constexpr std::size_t bitCount4[16] = {0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4};
+
+/**
+ * Transpose four particles from SoA to (x, y, z, life) and append the visible ones. Every particle is stored,
+ * but the output position only advances for the visible ones, so there is no branch. out needs room for all
+ * four particles.
+ * @param x, y, z, life    Attributes of four particles
+ * @param mask             Visibility bit per particle
+ * @param out              Output particles
+ * @param n                Number of output particles so far
+ * @return the new number of output particles
+ */
+static inline std::size_t storeVisible(__m128 x, __m128 y, __m128 z, __m128 life, int mask, glm::vec4* out,
+                                       std::size_t n) {
+    _MM_TRANSPOSE4_PS(x, y, z, life);
+    _mm_storeu_ps(reinterpret_cast<float*>(out + n), x);
+    n += mask & 1;
+    _mm_storeu_ps(reinterpret_cast<float*>(out + n), y);
+    n += (mask >> 1) & 1;
+    _mm_storeu_ps(reinterpret_cast<float*>(out + n), z);
+    n += (mask >> 2) & 1;
+    _mm_storeu_ps(reinterpret_cast<float*>(out + n), life);
+    n += (mask >> 3) & 1;
+    return n;
+}
+
+/**
+ * Collect the surface cells of the particles of a SIMD block which landed.
+ * @param mask         Bit per particle of the block
+ * @param cells        Surface cell per particle of the block
+ * @param deposits     Receives the cells
+ */
+static inline void deposit(int mask, const std::int32_t* cells, std::vector<std::uint32_t>& deposits) {
+    for (int lane = 0; mask != 0; mask >>= 1, lane++) {
+        if ((mask & 1) != 0) {
+            deposits.push_back(static_cast<std::uint32_t>(cells[lane]));
+        }
+    }
+}
+
+/**
+ * Collect the particles of a SIMD block which died.
+ * @param mask         Bit per particle of the block
+ * @param first        Index of the first particle of the block
+ * @param retired      Receives the indices
+ */
+static inline void retire(int mask, std::size_t first, std::vector<std::uint32_t>& retired) {
+    for (; mask != 0; mask >>= 1, first++) {
+        if ((mask & 1) != 0) {
+            retired.push_back(static_cast<std::uint32_t>(first));
+        }
+    }
+}
+#endif
+
+#if defined(SNOWGLOBE_PARTICLES_AVX2)
+/**
+ * hash() on eight lanes.
+ */
+static inline __m256i hash8(__m256i v) {
+    v = _mm256_xor_si256(v, _mm256_srli_epi32(v, 16));
+    v = _mm256_mullo_epi32(v, _mm256_set1_epi32(0x7feb352d));
+    v = _mm256_xor_si256(v, _mm256_srli_epi32(v, 15));
+    v = _mm256_mullo_epi32(v, _mm256_set1_epi32(static_cast<int>(0x846ca68bu)));
+    v = _mm256_xor_si256(v, _mm256_srli_epi32(v, 16));
+    return v;
+}
+
+/**
+ * randomSigned() on eight lanes.
+ */
+static inline __m256 randomSigned8(__m256i index, std::uint32_t seed) {
+    __m256i h = hash8(_mm256_xor_si256(index, _mm256_set1_epi32(static_cast<int>(seed))));
+    __m256 u = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(h, 8)), _mm256_set1_ps(hashToUnit));
+    return _mm256_sub_ps(_mm256_add_ps(u, u), _mm256_set1_ps(1.0f));
+}
+#elif defined(SNOWGLOBE_PARTICLES_SSE2)
+/**
+ * 32 bit multiplication on four lanes, SSE2 only multiplies the even lanes to 64 bit.
+ */
+static inline __m128i mullo4(__m128i a, __m128i b) {
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+/**
+ * hash() on four lanes.
+ */
+static inline __m128i hash4(__m128i v) {
+    v = _mm_xor_si128(v, _mm_srli_epi32(v, 16));
+    v = mullo4(v, _mm_set1_epi32(0x7feb352d));
+    v = _mm_xor_si128(v, _mm_srli_epi32(v, 15));
+    v = mullo4(v, _mm_set1_epi32(static_cast<int>(0x846ca68bu)));
+    v = _mm_xor_si128(v, _mm_srli_epi32(v, 16));
+    return v;
+}
+
+/**
+ * randomSigned() on four lanes.
+ */
+static inline __m128 randomSigned4(__m128i index, std::uint32_t seed) {
+    __m128i h = hash4(_mm_xor_si128(index, _mm_set1_epi32(static_cast<int>(seed))));
+    __m128 u = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(h, 8)), _mm_set1_ps(hashToUnit));
+    return _mm_sub_ps(_mm_add_ps(u, u), _mm_set1_ps(1.0f));
+}
+#endif
+
+/**
+ * Number of array elements for the given number of particles, a multiple of the SIMD width.
+ */
+static std::size_t paddedSize(std::size_t numParticles) {
+    return (numParticles + ParticleSystem::simdWidth - 1) / ParticleSystem::simdWidth * ParticleSystem::simdWidth;
+}
+
+/**
+ * @brief ParticleSystem constructor, all particles start dead.
+ * @param numParticles     Maximum number of particles
+ */
+ParticleSystem::ParticleSystem(std::size_t numParticles)
+    : heightfield(1, 0.0f),
+      snow(1, 0),
+      surface(1, groundHeight),
+      surfaceResolution(1),
+      surfaceExtent(domeRadius),
+      deposited(0),
+      numParticles(0),
+      emitRemainder(0.0f),
+      frame(0),
+      countsValid(false) {
+    resize(numParticles);
+}
+
+/**
+ * @brief Change the maximum number of particles and keep the existing ones. New particles start dead, the
+ * particles beyond a smaller size are dropped.
+ * @param numParticles     Maximum number of particles
+ */
+void ParticleSystem::resize(std::size_t numParticles) {
+    if (numParticles < this->numParticles) {
+        // The dropped particles become padding, which must stay dead.
+        std::fill(life.begin() + static_cast<std::ptrdiff_t>(numParticles), life.end(), 0.0f);
+        freeList.erase(std::remove_if(freeList.begin(), freeList.end(),
+                                      [numParticles](std::uint32_t i) { return i >= numParticles; }),
+                       freeList.end());
+    }
+
+    const std::size_t padded = paddedSize(numParticles);
+    x.resize(padded, 0.0f);
+    y.resize(padded, 0.0f);
+    z.resize(padded, 0.0f);
+    life.resize(padded, 0.0f);
+    speed.resize(padded, 0.0f);
+    prevX.resize(padded, 0.0f);
+    prevY.resize(padded, 0.0f);
+    prevZ.resize(padded, 0.0f);
+
+    // Push in reverse, so the lowest indices are used first.
+    for (std::size_t i = numParticles; i > this->numParticles; i--) {
+        freeList.push_back(static_cast<std::uint32_t>(i - 1));
+    }
+    this->numParticles = numParticles;
+    countsValid = false;
+}
+
+/**
+ * @brief Replace the heightfield the particles come to rest on. Heights below groundHeight are raised to it. The
+ * snow layer is kept if the resolution stays the same and cleared otherwise.
+ * @param heights          Height per cell, resolution * resolution values, row major in y
+ * @param resolution       Cells per side
+ * @param extent           Half size of the square around the origin the heightfield covers
+ */
+void ParticleSystem::setHeightfield(std::vector<float> heights, std::size_t resolution, float extent) {
+    heightfield = std::move(heights);
+    if (resolution != surfaceResolution) {
+        snow.assign(resolution * resolution, 0);
+        deposited = 0;
+    }
+    surfaceResolution = resolution;
+    surfaceExtent = extent;
+    surface.resize(heightfield.size());
+    for (std::size_t cell = 0; cell < surface.size(); cell++) {
+        updateSurface(cell);
+    }
+}
+
+/**
+ * @brief Replace the snow layer, e.g. by the one the GPU particles deposited.
+ * @param flakes           Flakes per cell, one value per heightfield cell
+ */
+void ParticleSystem::setSnow(std::vector<std::uint32_t> flakes) {
+    snow = std::move(flakes);
+    snow.resize(surface.size(), 0);
+    deposited = 0;
+    for (std::size_t cell = 0; cell < surface.size(); cell++) {
+        updateSurface(cell);
+        deposited += snow[cell];
+    }
+}
+
+/**
+ * @brief Height of a cell of the snow layer, growing with its flakes up to maxSnowDepth.
+ */
+float ParticleSystem::snowDepth(std::uint32_t flakes) {
+    return std::min(static_cast<float>(flakes) * flakeDepth, maxSnowDepth);
+}
+
+/**
+ * @brief Recompute the height of a cell the particles land on from the heightfield and the snow layer.
+ */
+void ParticleSystem::updateSurface(std::size_t cell) {
+    surface[cell] = std::max(heightfield[cell], groundHeight) + snowDepth(snow[cell]);
+}
+
+/**
+ * @brief Respawn dead particles at the top of the dome.
+ * @param count        Number of new particles
+ * @return the number of spawned particles, less than count if too few particles are dead
+ */
+std::size_t ParticleSystem::spawn(std::size_t count) {
+    count = std::min(count, freeList.size());
+    const std::uint32_t seedX = streamSeed(frame, streamSpawnX);
+    const std::uint32_t seedY = streamSeed(frame, streamSpawnY);
+    const std::uint32_t seedSpeed = streamSeed(frame, streamSpawnSpeed);
+
+    for (std::size_t s = 0; s < count; s++) {
+        const std::uint32_t i = freeList.back();
+        freeList.pop_back();
+        x[i] = randomSigned(i, seedX) * spawnExtent;
+        y[i] = randomSigned(i, seedY) * spawnExtent;
+        z[i] = spawnHeight;
+        prevX[i] = x[i];
+        prevY[i] = y[i];
+        prevZ[i] = z[i];
+        speed[i] = std::floor(randomUnit(i, seedSpeed) * 3.0f) + 1.0f;
+        life[i] = 1.0f;
+    }
+    if (count > 0) {
+        countsValid = false;
+    }
+    return count;
+}
+
+/**
+ * @brief Spawn particles at a constant rate. Fractions of a particle are carried over to the next call.
+ * @param rate         New particles per time unit
+ * @param dt           Time step
+ */
+void ParticleSystem::emit(float rate, float dt) {
+    emitRemainder += std::max(rate, 0.0f) * dt;
+    const auto count = static_cast<std::size_t>(emitRemainder);
+    emitRemainder -= static_cast<float>(count);
+    spawn(count);
+}
+
+/**
+ * @brief Advance all particles by one step. Alive particles above the surface fall with their speed and drift
+ * randomly in x and y. When they reach it, they die and add to the snow layer. The positions before the step
+ * are kept for write().
+ * @param dt           Time step, also the life every particle loses
+ * @param jobs         Threads running the chunks
+ */
+void ParticleSystem::step(float dt, JobSystem& jobs) {
+    const std::uint32_t seedX = streamSeed(frame, streamJitterX);
+    const std::uint32_t seedY = streamSeed(frame, streamJitterY);
+    frame++;
+
+    const std::size_t count = capacity();
+    const std::size_t numChunks = (count + chunkSize - 1) / chunkSize;
+    chunkCounts.resize(numChunks);
+    chunkRetired.resize(numChunks);
+    chunkDeposits.resize(numChunks);
+
+    jobs.parallelFor(numChunks, [&](std::size_t c) {
+        chunkRetired[c].clear();
+        chunkDeposits[c].clear();
+        chunkCounts[c] = simulate(c * chunkSize, std::min(count, (c + 1) * chunkSize), dt, seedX, seedY,
+                                  chunkRetired[c], chunkDeposits[c]);
+    });
+
+    for (const auto& retired : chunkRetired) {
+        freeList.insert(freeList.end(), retired.begin(), retired.end());
+    }
+
+    // The snow grows after the step, so all particles of a step land on the same surface
+    for (const auto& cells : chunkDeposits) {
+        for (std::uint32_t cell : cells) {
+            snow[cell]++;
+            updateSurface(cell);
+        }
+        deposited += cells.size();
+    }
+    countsValid = true;
+}
+
+/**
+ * @brief Write the alive particles inside the dome to out. Their positions are interpolated between the last
+ * two steps, so the motion stays smooth if the frames do not line up with the steps.
+ * @param alpha        Interpolation weight, 0 is the position before the last step and 1 the current one
+ * @param out          Output particles as (x, y, z, life), must hold size() particles
+ * @param jobs         Threads running the chunks
+ * @return the number of output particles
+ */
+std::size_t ParticleSystem::write(float alpha, glm::vec4* out, JobSystem& jobs) {
+    const std::size_t count = capacity();
+    const std::size_t numChunks = (count + chunkSize - 1) / chunkSize;
+
+    // step() counts the visible particles on the fly, a frame without a step after spawning counts them here.
+    if (!countsValid || chunkCounts.size() != numChunks) {
+        chunkCounts.resize(numChunks);
+        jobs.parallelFor(numChunks, [&](std::size_t c) {
+            chunkCounts[c] = countVisible(c * chunkSize, std::min(count, (c + 1) * chunkSize));
+        });
+        countsValid = true;
+    }
+
+    chunkOffsets.resize(numChunks + 1);
+    chunkOffsets[0] = 0;
+    for (std::size_t c = 0; c < numChunks; c++) {
+        chunkOffsets[c + 1] = chunkOffsets[c] + chunkCounts[c];
+    }
+
+    jobs.parallelFor(numChunks, [&](std::size_t c) {
+        writeVisible(c * chunkSize, std::min(count, (c + 1) * chunkSize), alpha, out + chunkOffsets[c]);
+    });
+    return chunkOffsets[numChunks];
+}
+
+/**
+ * @brief Moves a range of particles by one step and remembers their previous positions. Particles which reach
+ * the surface die and are deposited into the snow layer.
+ * @param begin, end   The range, multiples of simdWidth
+ * @param dt           Time step
+ * @param seedX, seedY Seeds of the drift in this frame
+ * @param retired      Receives the particles which die in this step
+ * @param deposits     Receives the surface cells of the particles which land in this step
+ * @return the number of alive particles inside the dome
+ */
+std::size_t ParticleSystem::simulate(std::size_t begin, std::size_t end, float dt, std::uint32_t seedX,
+                                     std::uint32_t seedY, std::vector<std::uint32_t>& retired,
+                                     std::vector<std::uint32_t>& deposits) {
+    const float radius2 = domeRadius * domeRadius;
+    const float cellScale = static_cast<float>(surfaceResolution) / (2.0f * surfaceExtent);
+    std::size_t n = 0;
+
+#if defined(SNOWGLOBE_PARTICLES_AVX2)
+    const __m256 vDt = _mm256_set1_ps(dt);
+    const __m256 vZero = _mm256_setzero_ps();
+    const __m256 vRadius2 = _mm256_set1_ps(radius2);
+    const __m256i laneIndex = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256 vExtent = _mm256_set1_ps(surfaceExtent);
+    const __m256 vCellScale = _mm256_set1_ps(cellScale);
+    const __m256 vMaxCell = _mm256_set1_ps(static_cast<float>(surfaceResolution - 1));
+    const __m256i vResolution = _mm256_set1_epi32(static_cast<int>(surfaceResolution));
+    alignas(32) std::int32_t cells[8];
+
+    for (std::size_t i = begin; i < end; i += 8) {
+        __m256 px = _mm256_load_ps(&x[i]);
+        __m256 py = _mm256_load_ps(&y[i]);
+        __m256 pz = _mm256_load_ps(&z[i]);
+        __m256 previous = _mm256_load_ps(&life[i]);
+        __m256 pl = _mm256_sub_ps(previous, vDt);
+        __m256 ps = _mm256_load_ps(&speed[i]);
+        _mm256_store_ps(&prevX[i], px);
+        _mm256_store_ps(&prevY[i], py);
+        _mm256_store_ps(&prevZ[i], pz);
+
+        __m256i cx = _mm256_cvttps_epi32(
+            _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_add_ps(px, vExtent), vCellScale), vZero), vMaxCell));
+        __m256i cy = _mm256_cvttps_epi32(
+            _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_add_ps(py, vExtent), vCellScale), vZero), vMaxCell));
+        __m256i cell = _mm256_add_epi32(_mm256_mullo_epi32(cy, vResolution), cx);
+        __m256 ground = _mm256_i32gather_ps(surface.data(), cell, 4);
+
+        __m256 alive = _mm256_cmp_ps(pl, vZero, _CMP_GT_OQ);
+        __m256 falling = _mm256_and_ps(alive, _mm256_cmp_ps(pz, ground, _CMP_GT_OQ));
+        __m256i index = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(i)), laneIndex);
+        px = _mm256_add_ps(px, _mm256_and_ps(falling, _mm256_mul_ps(randomSigned8(index, seedX), vDt)));
+        py = _mm256_add_ps(py, _mm256_and_ps(falling, _mm256_mul_ps(randomSigned8(index, seedY), vDt)));
+        pz = _mm256_blendv_ps(pz, _mm256_max_ps(_mm256_sub_ps(pz, _mm256_mul_ps(ps, vDt)), ground), falling);
+
+        __m256 landed = _mm256_and_ps(alive, _mm256_cmp_ps(pz, ground, _CMP_LE_OQ));
+        int landedMask = _mm256_movemask_ps(landed);
+        if (landedMask != 0) {
+            _mm256_store_si256(reinterpret_cast<__m256i*>(cells), cell);
+            deposit(landedMask, cells, deposits);
+            alive = _mm256_andnot_ps(landed, alive);
+            pl = _mm256_and_ps(alive, pl);
+        }
+        int died = _mm256_movemask_ps(_mm256_andnot_ps(alive, _mm256_cmp_ps(previous, vZero, _CMP_GT_OQ)));
+        retire(died, i, retired);
+
+        _mm256_store_ps(&x[i], px);
+        _mm256_store_ps(&y[i], py);
+        _mm256_store_ps(&z[i], pz);
+        _mm256_store_ps(&life[i], pl);
+
+        __m256 dist2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px, px), _mm256_mul_ps(py, py)),
+                                     _mm256_mul_ps(pz, pz));
+        int mask = _mm256_movemask_ps(_mm256_and_ps(alive, _mm256_cmp_ps(dist2, vRadius2, _CMP_LT_OQ)));
+        n += bitCount4[mask & 0xF] + bitCount4[mask >> 4];
+    }
+#elif defined(SNOWGLOBE_PARTICLES_SSE2)
+    const __m128 vDt = _mm_set1_ps(dt);
+    const __m128 vZero = _mm_setzero_ps();
+    const __m128 vRadius2 = _mm_set1_ps(radius2);
+    const __m128i laneIndex = _mm_setr_epi32(0, 1, 2, 3);
+    const __m128 vExtent = _mm_set1_ps(surfaceExtent);
+    const __m128 vCellScale = _mm_set1_ps(cellScale);
+    const __m128 vMaxCell = _mm_set1_ps(static_cast<float>(surfaceResolution - 1));
+    const __m128i vResolution = _mm_set1_epi32(static_cast<int>(surfaceResolution));
+    alignas(16) std::int32_t cells[4];
+
+    for (std::size_t i = begin; i < end; i += 4) {
+        __m128 px = _mm_load_ps(&x[i]);
+        __m128 py = _mm_load_ps(&y[i]);
+        __m128 pz = _mm_load_ps(&z[i]);
+        __m128 previous = _mm_load_ps(&life[i]);
+        __m128 pl = _mm_sub_ps(previous, vDt);
+        __m128 ps = _mm_load_ps(&speed[i]);
+        _mm_store_ps(&prevX[i], px);
+        _mm_store_ps(&prevY[i], py);
+        _mm_store_ps(&prevZ[i], pz);
+
+        // SSE2 has no gather, the four heights are loaded one by one
+        __m128i cx = _mm_cvttps_epi32(
+            _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_add_ps(px, vExtent), vCellScale), vZero), vMaxCell));
+        __m128i cy = _mm_cvttps_epi32(
+            _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_add_ps(py, vExtent), vCellScale), vZero), vMaxCell));
+        _mm_store_si128(reinterpret_cast<__m128i*>(cells), _mm_add_epi32(mullo4(cy, vResolution), cx));
+        __m128 ground = _mm_setr_ps(surface[cells[0]], surface[cells[1]], surface[cells[2]], surface[cells[3]]);
+
+        __m128 alive = _mm_cmpgt_ps(pl, vZero);
+        __m128 falling = _mm_and_ps(alive, _mm_cmpgt_ps(pz, ground));
+        __m128i index = _mm_add_epi32(_mm_set1_epi32(static_cast<int>(i)), laneIndex);
+        px = _mm_add_ps(px, _mm_and_ps(falling, _mm_mul_ps(randomSigned4(index, seedX), vDt)));
+        py = _mm_add_ps(py, _mm_and_ps(falling, _mm_mul_ps(randomSigned4(index, seedY), vDt)));
+        __m128 fallen = _mm_max_ps(_mm_sub_ps(pz, _mm_mul_ps(ps, vDt)), ground);
+        pz = _mm_or_ps(_mm_and_ps(falling, fallen), _mm_andnot_ps(falling, pz));
+
+        __m128 landed = _mm_and_ps(alive, _mm_cmple_ps(pz, ground));
+        int landedMask = _mm_movemask_ps(landed);
+        if (landedMask != 0) {
+            deposit(landedMask, cells, deposits);
+            alive = _mm_andnot_ps(landed, alive);
+            pl = _mm_and_ps(alive, pl);
+        }
+        int died = _mm_movemask_ps(_mm_andnot_ps(alive, _mm_cmpgt_ps(previous, vZero)));
+        retire(died, i, retired);
+
+        _mm_store_ps(&x[i], px);
+        _mm_store_ps(&y[i], py);
+        _mm_store_ps(&z[i], pz);
+        _mm_store_ps(&life[i], pl);
+
+        __m128 dist2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, px), _mm_mul_ps(py, py)), _mm_mul_ps(pz, pz));
+        int mask = _mm_movemask_ps(_mm_and_ps(alive, _mm_cmplt_ps(dist2, vRadius2)));
+        n += bitCount4[mask];
+    }
+#else
+    const float maxCell = static_cast<float>(surfaceResolution - 1);
+    for (std::size_t i = begin; i < end; i++) {
+        const auto index = static_cast<std::uint32_t>(i);
+        prevX[i] = x[i];
+        prevY[i] = y[i];
+        prevZ[i] = z[i];
+
+        const auto cx = static_cast<std::size_t>(std::min(std::max((x[i] + surfaceExtent) * cellScale, 0.0f), maxCell));
+        const auto cy = static_cast<std::size_t>(std::min(std::max((y[i] + surfaceExtent) * cellScale, 0.0f), maxCell));
+        const std::size_t cell = cy * surfaceResolution + cx;
+        const float ground = surface[cell];
+
+        float l = life[i] - dt;
+        float falling = (l > 0.0f && z[i] > ground) ? 1.0f : 0.0f;
+        if (falling > 0.0f) {
+            z[i] = std::max(z[i] - speed[i] * dt, ground);
+        }
+        x[i] += falling * (randomSigned(index, seedX) * dt);
+        y[i] += falling * (randomSigned(index, seedY) * dt);
+
+        if (l > 0.0f && z[i] <= ground) {
+            deposits.push_back(static_cast<std::uint32_t>(cell));
+            l = 0.0f;
+        }
+        if (life[i] > 0.0f && l <= 0.0f) {
+            retired.push_back(index);
+        }
+        life[i] = l;
+        n += (l > 0.0f && x[i] * x[i] + y[i] * y[i] + z[i] * z[i] < radius2) ? 1 : 0;
+    }
+#endif
+    return n;
+}
+
+/**
+ * @brief Counts the alive particles inside the dome of a range, with the same test as simulate().
+ * @param begin, end   The range, multiples of simdWidth
+ * @return the number of visible particles
+ */
+std::size_t ParticleSystem::countVisible(std::size_t begin, std::size_t end) const {
+    const float radius2 = domeRadius * domeRadius;
+    std::size_t n = 0;
+
+#if defined(SNOWGLOBE_PARTICLES_AVX2) || defined(SNOWGLOBE_PARTICLES_SSE2)
+    const __m128 vZero = _mm_setzero_ps();
+    const __m128 vRadius2 = _mm_set1_ps(radius2);
+
+    for (std::size_t i = begin; i < end; i += 4) {
+        __m128 px = _mm_load_ps(&x[i]);
+        __m128 py = _mm_load_ps(&y[i]);
+        __m128 pz = _mm_load_ps(&z[i]);
+        __m128 pl = _mm_load_ps(&life[i]);
+
+        __m128 dist2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, px), _mm_mul_ps(py, py)), _mm_mul_ps(pz, pz));
+        n += bitCount4[_mm_movemask_ps(_mm_and_ps(_mm_cmpgt_ps(pl, vZero), _mm_cmplt_ps(dist2, vRadius2)))];
+    }
+#else
+    for (std::size_t i = begin; i < end; i++) {
+        n += (life[i] > 0.0f && x[i] * x[i] + y[i] * y[i] + z[i] * z[i] < radius2) ? 1 : 0;
+    }
+#endif
+    return n;
+}
+
+/**
+ * @brief Writes the alive particles inside the dome of a range. The visibility test repeats the one of
+ * simulate() on the stored attributes, so it selects the same particles, the written positions are
+ * interpolated.
+ * @param begin, end   The range, multiples of simdWidth
+ * @param alpha        Interpolation weight between the previous and the current position
+ * @param out          Output particles, exactly the number of visible particles of the range is written
+ */
+void ParticleSystem::writeVisible(std::size_t begin, std::size_t end, float alpha, glm::vec4* out) const {
+    const float radius2 = domeRadius * domeRadius;
+    std::size_t n = 0;
+
+#if defined(SNOWGLOBE_PARTICLES_AVX2) || defined(SNOWGLOBE_PARTICLES_SSE2)
+    // storeVisible() also stores the hidden particles, so it writes to a staging block first. Stored directly,
+    // the last hidden particles of the range would overwrite the first ones of the next range.
+    alignas(16) glm::vec4 staging[4];
+    const __m128 vZero = _mm_setzero_ps();
+    const __m128 vRadius2 = _mm_set1_ps(radius2);
+    const __m128 vAlpha = _mm_set1_ps(alpha);
+
+    for (std::size_t i = begin; i < end; i += 4) {
+        __m128 px = _mm_load_ps(&x[i]);
+        __m128 py = _mm_load_ps(&y[i]);
+        __m128 pz = _mm_load_ps(&z[i]);
+        __m128 pl = _mm_load_ps(&life[i]);
+
+        __m128 dist2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, px), _mm_mul_ps(py, py)), _mm_mul_ps(pz, pz));
+        int mask = _mm_movemask_ps(_mm_and_ps(_mm_cmpgt_ps(pl, vZero), _mm_cmplt_ps(dist2, vRadius2)));
+        if (mask != 0) {
+            __m128 qx = _mm_load_ps(&prevX[i]);
+            __m128 qy = _mm_load_ps(&prevY[i]);
+            __m128 qz = _mm_load_ps(&prevZ[i]);
+            qx = _mm_add_ps(qx, _mm_mul_ps(vAlpha, _mm_sub_ps(px, qx)));
+            qy = _mm_add_ps(qy, _mm_mul_ps(vAlpha, _mm_sub_ps(py, qy)));
+            qz = _mm_add_ps(qz, _mm_mul_ps(vAlpha, _mm_sub_ps(pz, qz)));
+            std::size_t k = storeVisible(qx, qy, qz, pl, mask, staging, 0);
+            std::memcpy(out + n, staging, k * sizeof(glm::vec4));
+            n += k;
+        }
+    }
+#else
+    for (std::size_t i = begin; i < end; i++) {
+        if (life[i] > 0.0f && x[i] * x[i] + y[i] * y[i] + z[i] * z[i] < radius2) {
+            out[n++] = glm::vec4(prevX[i] + alpha * (x[i] - prevX[i]), prevY[i] + alpha * (y[i] - prevY[i]),
+                                 prevZ[i] + alpha * (z[i] - prevZ[i]), life[i]);
+        }
+    }
+#endif
+}
@@ -0,0 +1,124 @@
+#ifndef OGL4CORE2_PLUGINS_PCVC_SNOWGLOBE_PARTICLESYSTEM_H
+#define OGL4CORE2_PLUGINS_PCVC_SNOWGLOBE_PARTICLESYSTEM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+namespace OGL4Core2::Plugins::PCVC::SnowGlobe {
+    class JobSystem;
+
+    /**
+     * Allocator for particle attributes which are loaded with aligned SIMD instructions.
+     */
+    template<typename T, std::size_t Alignment = 32>
+    struct AlignedAllocator {
+        using value_type = T;
+
+        template<typename U>
+        struct rebind {
+            using other = AlignedAllocator<U, Alignment>;
+        };
+
+        AlignedAllocator() = default;
+        template<typename U>
+        AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+        T* allocate(std::size_t n) {
+            return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+        }
+        void deallocate(T* p, std::size_t) { ::operator delete(p, std::align_val_t(Alignment)); }
+
+        template<typename U>
+        bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+        template<typename U>
+        bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+    };
+
+    template<typename T>
+    using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+    /**
+     * Snow particles simulated on the CPU. The attributes are stored as structure of arrays and updated by AVX2
+     * kernels if the plugin is compiled with AVX2, by SSE2 kernels on other x86 builds and by a scalar loop
+     * otherwise. The random numbers are a hash of the particle index and a frame counter, so all SIMD lanes
+     * draw them independently and every code path draws the same numbers. write() stores the alive
+     * particles inside the dome as (x, y, z, life) directly into the mapped vertex buffer.
+     *
+     * The update runs in chunks on a JobSystem. step() moves the particles and counts the visible ones per
+     * chunk, write() gives every chunk a disjoint range of the output by the prefix sum of the counts and fills
+     * it with the positions interpolated between the last two steps.
+     *
+     * Falling particles land on a heightfield of the scene. It is sampled at the cell of the particle, so the
+     * collision costs the same for every particle regardless of the scene. Landed particles die and add to a
+     * snow layer on top of the heightfield, which is drawn instead of keeping them as resting particles.
+     *
+     * Dead particles are kept on a stack of free indices. Spawning pops from it and the first pass collects the
+     * particles which die per chunk, so both cost O(1) per particle instead of a search for a dead one.
+     */
+    class ParticleSystem {
+    public:
+        static constexpr std::size_t simdWidth = 8;     //!< the arrays are padded to a multiple of this
+        static constexpr std::size_t chunkSize = 16384; //!< particles per job, a multiple of simdWidth
+        static constexpr float domeRadius = 2.4f;       //!< particles outside of this radius are not drawn
+        static constexpr float spawnHeight = 2.4f;      //!< height new particles start at
+        static constexpr float spawnExtent = 2.3f;      //!< half size of the square new particles start in
+        static constexpr float groundHeight = 0.01f;    //!< lowest height particles land at
+        static constexpr float flakeDepth = 0.002f;     //!< height a landed particle adds to the snow of its cell
+        static constexpr float maxSnowDepth = 0.15f;    //!< the snow layer grows up to this height
+
+        explicit ParticleSystem(std::size_t numParticles);
+
+        void resize(std::size_t numParticles);
+        void setHeightfield(std::vector<float> heights, std::size_t resolution, float extent);
+        void setSnow(std::vector<std::uint32_t> flakes);
+        static float snowDepth(std::uint32_t flakes);
+        std::size_t spawn(std::size_t count);
+        void emit(float rate, float dt);
+        void step(float dt, JobSystem& jobs);
+        std::size_t write(float alpha, glm::vec4* out, JobSystem& jobs);
+
+        [[nodiscard]] std::size_t size() const { return numParticles; }
+        [[nodiscard]] std::size_t capacity() const { return life.size(); }
+        [[nodiscard]] const std::vector<std::uint32_t>& snowLayer() const { return snow; }
+        [[nodiscard]] std::size_t numDeposited() const { return deposited; }
+
+    private:
+        std::size_t simulate(std::size_t begin, std::size_t end, float dt, std::uint32_t seedX, std::uint32_t seedY,
+                             std::vector<std::uint32_t>& retired, std::vector<std::uint32_t>& deposits);
+        void updateSurface(std::size_t cell);
+        [[nodiscard]] std::size_t countVisible(std::size_t begin, std::size_t end) const;
+        void writeVisible(std::size_t begin, std::size_t end, float alpha, glm::vec4* out) const;
+
+        AlignedVector<float> x;     //!< position x
+        AlignedVector<float> y;     //!< position y
+        AlignedVector<float> z;     //!< position z, the height above the ground
+        AlignedVector<float> life;  //!< remaining life, the particle is dead if it is <= 0
+        AlignedVector<float> speed; //!< falling speed
+        AlignedVector<float> prevX; //!< position x before the last step
+        AlignedVector<float> prevY; //!< position y before the last step
+        AlignedVector<float> prevZ; //!< position z before the last step
+
+        std::vector<float> heightfield;  //!< height of the scene per cell, row major in y
+        std::vector<std::uint32_t> snow; //!< flakes which landed per cell
+        std::vector<float> surface;      //!< height particles land at per cell, the scene plus the snow
+        std::size_t surfaceResolution;   //!< cells per side of the three grids
+        float surfaceExtent;             //!< half size of the square the grids cover
+        std::size_t deposited;           //!< flakes in the snow layer
+
+        std::size_t numParticles;                              //!< number of particles without the padding
+        std::vector<std::uint32_t> freeList;                   //!< indices of the dead particles
+        float emitRemainder;                                   //!< fraction of a particle emit() still owes
+        std::uint32_t frame;                                   //!< counter of the random numbers
+        bool countsValid;                                      //!< chunkCounts matches the current particles
+        std::vector<std::size_t> chunkCounts;                  //!< visible particles per chunk
+        std::vector<std::size_t> chunkOffsets;                 //!< output offset per chunk
+        std::vector<std::vector<std::uint32_t>> chunkRetired;  //!< particles which died per chunk
+        std::vector<std::vector<std::uint32_t>> chunkDeposits; //!< cells particles landed in per chunk
+    };
+} // namespace OGL4Core2::Plugins::PCVC::SnowGlobe
+
+#endif // OGL4CORE2_PLUGINS_PCVC_SNOWGLOBE_PARTICLESYSTEM_H
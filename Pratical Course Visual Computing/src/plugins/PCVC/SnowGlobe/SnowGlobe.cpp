@@ -1,20 +1,33 @@
 #include "SnowGlobe.h"
 
+#include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <cstdint>
 #include <fstream>
 #include <iostream>
+#include <numeric>
 #include <utility>
 
 #include <imgui.h>
 
+#include "DepthSorter.h"
+#include "JobSystem.h"
 #include "Objects.h"
+#include "ParticleSystem.h"
 #include "core/core.h"
 
 using namespace OGL4Core2::Plugins::PCVC::SnowGlobe;
 
 static const double pi = std::acos(-1.0);
 
+// Passes of particleSort.comp
+static const int sortModeKeys = 0;
+static const int sortModeSortBlock = 1;
+static const int sortModeMergeBlock = 2;
+static const int sortModeMergeStep = 3;
+static const int sortModeWriteBack = 4;
+
 /**
  * @brief SnowGlobe constructor.
  * Initlizes all variables with meaningful values and initializes
@@ -35,9 +48,15 @@ SnowGlobe::SnowGlobe(const OGL4Core2::Core::Core& c)
     fboTexNormals(0),
     fboTexPos(0),
     fboTexDepth(0),
+    heightfieldFbo(0),
+    heightfieldTex(0),
+    renderingHeightfield(false),
+    snowTex(0),
+    snowUploadedCPU(0),
     showFBOAtt(0),
     showparticleMode(0),
     maxParticles(1000),
+    spawnRate(1000),
     domeAlpha(0.1),
     useDayNightCycle(false),
     fovY(45.0),
@@ -57,23 +76,52 @@ SnowGlobe::SnowGlobe(const OGL4Core2::Core::Core& c)
     texSkybox(0),
     lastshowparticleMode(0),
     lastmaxParticles(maxParticles),
-    lastUsedParticle(0),
     drawParticleNum(0),
     vaCPU(0),
     vaGPU(0),
     vboCPU(0),
     positionBufferCPU(0),
+    positionMappingCPU(nullptr),
+    particleSlotSizeCPU(0),
+    particleFencesCPU{},
+    drawSlotCPU(0),
     vboGPU(0),
-    ssboGPU(0) {
+    ssboGPU(0),
+    visibleBufferGPU(0),
+    stateBufferGPU(0),
+    deadBufferGPU(0),
+    aliveBuffersGPU{0, 0},
+    previousBufferGPU(0),
+    aliveCurrentGPU(0),
+    emitRemainderGPU(0.0f),
+    sortBufferGPU(0),
+    sortSizeGPU(0),
+    sortQueryGPU(0),
+    sortQueryPendingGPU(false),
+    snowSpeed(0.06f),
+    particleDt(0.0f),
+    sortMillisCPU(0.0f),
+    sortParticles(true),
+    sortValid(false),
+    sortCameraPos(glm::vec3(0.0f)),
+    sortMillis(0.0f),
+    maxSubsteps(8),
+    stepAccumulator(0.0f),
+    numSteps(0),
+    stepAlpha(0.0f),
+    lastFrameTime(std::chrono::steady_clock::now()) {
 
     // Init Camera
     camera = std::make_shared<Core::OrbitCamera>(10.0f);
     core_.registerCamera(camera);
 
     // Initialize shaders, vertex arrays, skybox, and CPU particles
+    jobs = std::make_unique<JobSystem>();
+    depthSorterCPU = std::make_unique<DepthSorter>();
     initShaders();
     initVAs();
     initSkybox();
+    initHeightfield();
     initParticlesCPU();
 
     // Load textures from the "resources/textures" folder
@@ -92,6 +140,7 @@ SnowGlobe::SnowGlobe(const OGL4Core2::Core::Core& c)
     std::shared_ptr<Object> o2 = std::make_shared<Sphere>(*this, 102, texSphere, "");
     o2->modelMx = glm::translate(o2->modelMx, lightPos);
     o2->modelMx = glm::scale(o2->modelMx, glm::vec3(0.5f, 0.5f, 0.5f));
+    o2->collider = false; // The light moves around the dome
     objectList.emplace_back(o2);
 
     auto path3 = getResourceDirPath("models") / "penguin.obj";
@@ -135,6 +184,9 @@ SnowGlobe::~SnowGlobe() {
     glDeleteTextures(1, &fboTexPos);
     glDeleteTextures(1, &fboTexDepth);
     glDeleteTextures(1, &texSkybox);
+    glDeleteTextures(1, &heightfieldTex);
+    glDeleteTextures(1, &snowTex);
+    glDeleteFramebuffers(1, &heightfieldFbo);
     deleteFBOs();
     deleteParticlesCPU();
     deleteParticlesGPU();
@@ -151,8 +203,19 @@ void SnowGlobe::renderGUI() {
         ImGui::Combo("FBO attach.", &showFBOAtt, "Color\0IDs\0Normals\0Position\0Depth\0Deferred\0"); 
         ImGui::Combo("Particle mode", &showparticleMode, "CPU\0GPU\0");
         ImGui::SliderFloat("domeAlpha", &domeAlpha, 0.0f, 1.0f);
-        ImGui::InputInt("maxParticles", &maxParticles, 1000);
-        maxParticles = std::clamp(maxParticles, 1000, 100000);
+        ImGui::InputInt("maxParticles", &maxParticles, 1000, 100000);
+        maxParticles = std::clamp(maxParticles, 1000, 4000000);
+        ImGui::InputInt("spawnRate", &spawnRate, 1000, 100000);
+        spawnRate = std::clamp(spawnRate, 0, 4000000);
+        ImGui::SliderFloat("snowSpeed", &snowSpeed, 0.0f, 0.5f);
+        ImGui::SliderInt("maxSubsteps", &maxSubsteps, 1, 16);
+        if (ImGui::Checkbox("sortParticles", &sortParticles)) {
+            sortValid = false;
+        }
+        ImGui::Text("sort: %.3f ms", sortMillis);
+        if (ImGui::Button("clearSnow")) {
+            clearSnow();
+        }
         ImGui::Checkbox("Day/Night Cycle", &useDayNightCycle);
         ImGui::SliderFloat("fovY", &fovY, 1.0f, 90.0f); 
         ImGui::SliderFloat("zNear", &zNear, 0.01f, zFar);
@@ -173,9 +236,20 @@ void SnowGlobe::renderGUI() {
  * @brief SnowGlobe render callback.
  */
 void SnowGlobe::render() {
+    // The simulation advances in fixed steps of real time, as many as fit into the time since the last frame.
+    // Slow frames catch up at most maxSubsteps steps, the rest of their time is dropped.
+    auto now = std::chrono::steady_clock::now();
+    stepAccumulator += std::chrono::duration<float>(now - lastFrameTime).count();
+    lastFrameTime = now;
+    numSteps = std::min(static_cast<int>(stepAccumulator / stepSeconds), maxSubsteps);
+    stepAccumulator = std::min(stepAccumulator - static_cast<float>(numSteps) * stepSeconds, stepSeconds);
+    stepAlpha = stepAccumulator / stepSeconds;
+    particleDt = stepSeconds * snowSpeed;
+
     renderGUI();
     updateLight();
     updateMatrices();
+    updateHeightfield();
 
     if (showparticleMode == 0) { // Now: CPU particles mode
         if (lastshowparticleMode == 1) { // If mode has changed from GPU particles to CPU particles
@@ -185,8 +259,7 @@ void SnowGlobe::render() {
         }
         else if (lastmaxParticles != maxParticles) { // If the number of maximun particles has changed
             lastmaxParticles = maxParticles;
-            deleteParticlesCPU();
-            initParticlesCPU();
+            resizeParticlesCPU();
         }
         updateParticlesCPU();
     }
@@ -366,6 +439,24 @@ void SnowGlobe::initShaders() {
     }
     catch (glowl::GLSLProgramException& e) { std::cerr << e.what() << std::endl; }
 
+    try {
+        shaderParticleEmit = std::make_unique<glowl::GLSLProgram>(glowl::GLSLProgram::ShaderSourceList{
+            {glowl::GLSLProgram::ShaderType::Compute, getStringResource("shaders/particleEmit.comp")} });
+    }
+    catch (glowl::GLSLProgramException& e) { std::cerr << e.what() << std::endl; }
+
+    try {
+        shaderParticleDispatch = std::make_unique<glowl::GLSLProgram>(glowl::GLSLProgram::ShaderSourceList{
+            {glowl::GLSLProgram::ShaderType::Compute, getStringResource("shaders/particleDispatch.comp")} });
+    }
+    catch (glowl::GLSLProgramException& e) { std::cerr << e.what() << std::endl; }
+
+    try {
+        shaderParticleSort = std::make_unique<glowl::GLSLProgram>(glowl::GLSLProgram::ShaderSourceList{
+            {glowl::GLSLProgram::ShaderType::Compute, getStringResource("shaders/particleSort.comp")} });
+    }
+    catch (glowl::GLSLProgramException& e) { std::cerr << e.what() << std::endl; }
+
     try {
         shaderParticleGPU = std::make_unique<glowl::GLSLProgram>(glowl::GLSLProgram::ShaderSourceList{
             {glowl::GLSLProgram::ShaderType::Vertex, getStringResource("shaders/particleGPU.vert")},
@@ -599,15 +690,18 @@ void SnowGlobe::updateMatrices() {
 }
 
 /**
- * @brief Update the light position.
+ * @brief Update the light position. The day/night cycle advances with the simulation steps and is
+ * interpolated between them like the particles.
  */
 void SnowGlobe::updateLight() {
+    float lat = lightLat;
     if (useDayNightCycle) {
-        lightLat += 0.2f;
+        lightLat += dayNightStep * static_cast<float>(numSteps);
+        lat = lightLat - dayNightStep * (1.0f - stepAlpha);
     }
-    lightPos.x = lightDist * cos(glm::radians(lightLat)) * cos(glm::radians(lightLong));
-    lightPos.y = lightDist * cos(glm::radians(lightLat)) * sin(glm::radians(lightLong));
-    lightPos.z = lightDist * sin(glm::radians(lightLat));
+    lightPos.x = lightDist * cos(glm::radians(lat)) * cos(glm::radians(lightLong));
+    lightPos.y = lightDist * cos(glm::radians(lat)) * sin(glm::radians(lightLong));
+    lightPos.z = lightDist * sin(glm::radians(lat));
 
     // Update the model matrix of the sphere according to the light position
     glm::mat4 sphereModelMx = glm::mat4(1.0);
@@ -633,9 +727,19 @@ void SnowGlobe::drawToFBO() {
     GLenum drawBuffer[4] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3 };
     glDrawBuffers(4, drawBuffer);
 
-    // Draw objects from objectList
+    // Draw objects from objectList, the snow layer covers their tops
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, snowTex);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, heightfieldTex);
+    glActiveTexture(GL_TEXTURE0);
     for (int i = 0; i < objectList.size(); i++)
         objectList[i]->draw(projMx, camera->viewMx());
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
 
     // Draw snow
     if (showparticleMode == 0) { // CPU particles mode
@@ -656,13 +760,24 @@ void SnowGlobe::drawToFBO() {
 
         glEnableVertexAttribArray(1);
         glBindBuffer(GL_ARRAY_BUFFER, positionBufferCPU);
-        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 0, (void*)0);
+        const GLintptr slotOffset = drawSlotCPU * particleSlotSizeCPU * sizeof(glm::vec4);
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 0, reinterpret_cast<void*>(slotOffset));
         glVertexAttribDivisor(1, 1);
         glBindBuffer(GL_ARRAY_BUFFER, 0);
 
+        // Sorted back to front, so every flake blends over the ones behind it
+        if (sortParticles) {
+            glEnablei(GL_BLEND, 0);
+            glBlendFunci(0, GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        }
         glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, drawParticleNum);
+        glDisablei(GL_BLEND, 0);
         glBindVertexArray(0);
 
+        // The slot must not be overwritten before the draw call is done with it
+        glDeleteSync(particleFencesCPU[drawSlotCPU]);
+        particleFencesCPU[drawSlotCPU] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
         glDisableVertexAttribArray(0);
         glDisableVertexAttribArray(1);
         glBindTexture(GL_TEXTURE_2D, 0);
@@ -670,10 +785,12 @@ void SnowGlobe::drawToFBO() {
     }
     else if (showparticleMode == 1) { // GPU particles mode
         updateParticlesGPU();
+        sortParticlesGPU();
 
         shaderParticleGPU->use();
         shaderParticleGPU->setUniform("projMx", projMx);
         shaderParticleGPU->setUniform("viewMx", camera->viewMx());
+        shaderParticleGPU->setUniform("alpha", stepAlpha);
         glActiveTexture(GL_TEXTURE0);
         texSnowflake->bindTexture();
         shaderParticleGPU->setUniform("tex", 0);
@@ -686,13 +803,21 @@ void SnowGlobe::drawToFBO() {
         glVertexAttribDivisor(0, 0);
         glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboGPU);
+        // Only the visible particles the compute pass appended are drawn
         glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, ssboGPU);
-        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, maxParticles);
-        
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, visibleBufferGPU);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, previousBufferGPU);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, stateBufferGPU);
+        if (sortParticles) {
+            glEnablei(GL_BLEND, 0);
+            glBlendFunci(0, GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        }
+        glDrawArraysIndirect(GL_TRIANGLE_STRIP, nullptr);
+        glDisablei(GL_BLEND, 0);
+
         glDisableVertexAttribArray(0);
         glBindVertexArray(0);
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
         glBindTexture(GL_TEXTURE_2D, 0);
         glUseProgram(0);
     }
@@ -759,16 +884,132 @@ void SnowGlobe::initSkybox() {
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 }
 
+/**
+ * @brief Create the depth only FBO of the heightfield, it is rendered once the objects are placed.
+ */
+void SnowGlobe::initHeightfield() {
+    glGenTextures(1, &heightfieldTex);
+    glBindTexture(GL_TEXTURE_2D, heightfieldTex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, heightfieldResolution, heightfieldResolution, 0,
+                 GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, &heightfieldFbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, heightfieldFbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, heightfieldTex, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    checkFBOStatus();
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    heightfieldModelMx.clear();
+
+    // The particles of both modes count their landed flakes per texel, atomically on the GPU
+    glGenTextures(1, &snowTex);
+    glBindTexture(GL_TEXTURE_2D, snowTex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, heightfieldResolution, heightfieldResolution, 0, GL_RED_INTEGER,
+                 GL_UNSIGNED_INT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glClearTexImage(snowTex, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+    snowUploadedCPU = 0;
+}
+
+/**
+ * @brief Remove all snow the particles deposited.
+ */
+void SnowGlobe::clearSnow() {
+    glClearTexImage(snowTex, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+    if (particlesCPU != nullptr) {
+        if (particleJobCPU.valid()) {
+            particleJobCPU.wait();
+        }
+        particlesCPU->setSnow({});
+    }
+    snowUploadedCPU = 0;
+}
+
+/**
+ * @brief Set the uniforms of the snow layer on an object shader. The snow is only drawn on the highest surface
+ * at a position, while the heightfield itself is rendered there is none.
+ * @param program      Shader of an object, drawn with snowTex at unit 1 and heightfieldTex at unit 2
+ */
+void SnowGlobe::setSnowUniforms(glowl::GLSLProgram& program) const {
+    program.setUniform("snowTex", 1);
+    program.setUniform("heightfield", 2);
+    program.setUniform("snowExtent", heightfieldExtent);
+    program.setUniform("heightfieldRange", glm::vec2(heightfieldTop, heightfieldBottom));
+    program.setUniform("flakeDepth", ParticleSystem::flakeDepth);
+    program.setUniform("maxSnowDepth", renderingHeightfield ? 0.0f : ParticleSystem::maxSnowDepth);
+}
+
+/**
+ * @brief Render the colliding objects from above into the heightfield, if any of them moved since the last
+ * time. The CPU particles get a copy of the heights, the GPU particles sample the texture.
+ */
+void SnowGlobe::updateHeightfield() {
+    std::vector<glm::mat4> modelMxs;
+    for (const auto& object : objectList) {
+        if (object->collider) {
+            modelMxs.push_back(object->modelMx);
+        }
+    }
+    if (modelMxs == heightfieldModelMx) {
+        return;
+    }
+    heightfieldModelMx = modelMxs;
+
+    // Orthographic view along -z, so the eye space is the world space and the nearest depth is the highest point
+    const glm::mat4 topProjMx = glm::ortho(-heightfieldExtent, heightfieldExtent, -heightfieldExtent,
+                                           heightfieldExtent, -heightfieldTop, -heightfieldBottom);
+    glBindFramebuffer(GL_FRAMEBUFFER, heightfieldFbo);
+    glViewport(0, 0, heightfieldResolution, heightfieldResolution);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    renderingHeightfield = true;
+    for (const auto& object : objectList) {
+        if (object->collider) {
+            object->draw(topProjMx, glm::mat4(1.0f));
+        }
+    }
+    renderingHeightfield = false;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, wWidth, wHeight);
+
+    heightfieldCPU.resize(heightfieldResolution * heightfieldResolution);
+    glBindTexture(GL_TEXTURE_2D, heightfieldTex);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, GL_FLOAT, heightfieldCPU.data());
+    glBindTexture(GL_TEXTURE_2D, 0);
+    for (float& height : heightfieldCPU) {
+        height = heightfieldTop + height * (heightfieldBottom - heightfieldTop);
+    }
+
+    if (particlesCPU != nullptr) {
+        // The simulation of the next frame must not run while the heightfield changes
+        if (particleJobCPU.valid()) {
+            particleJobCPU.wait();
+        }
+        particlesCPU->setHeightfield(heightfieldCPU, heightfieldResolution, heightfieldExtent);
+    }
+}
+
 void SnowGlobe::initParticlesCPU() {
-    // Init particleContainer
-    particleContainer.clear();
-    for (int i = 0; i < maxParticles; i++) {
-        Particle p;
-        p.position = glm::vec3(0.0f);
-        p.speed = 0.0f;
-        p.life = 0.0f;
-        particleContainer.push_back(p);
+    particlesCPU = std::make_unique<ParticleSystem>(maxParticles);
+    if (!heightfieldCPU.empty()) {
+        particlesCPU->setHeightfield(heightfieldCPU, heightfieldResolution, heightfieldExtent);
+
+        // Continue with the snow the GPU particles left
+        std::vector<std::uint32_t> flakes(heightfieldCPU.size());
+        glBindTexture(GL_TEXTURE_2D, snowTex);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, flakes.data());
+        glBindTexture(GL_TEXTURE_2D, 0);
+        particlesCPU->setSnow(std::move(flakes));
     }
+    snowUploadedCPU = particlesCPU->numDeposited();
+    sortValid = false;
 
     // Snow quad
     const std::vector<float> particleVertices = {
@@ -787,100 +1028,135 @@ void SnowGlobe::initParticlesCPU() {
     glBufferData(GL_ARRAY_BUFFER, particleVertices.size() * sizeof(float), &particleVertices[0], GL_STATIC_DRAW);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 
+    glBindVertexArray(0);
+
+    initParticleBufferCPU(particlesCPU->size());
+}
+
+/**
+ * @brief Create the persistently mapped instance buffer of the CPU particles. The simulation writes the next
+ * frame into one slot while the GPU still draws from the others.
+ * @param slotSize     Particles per slot
+ */
+void SnowGlobe::initParticleBufferCPU(std::size_t slotSize) {
+    for (auto& fence : particleFencesCPU) {
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+    glDeleteBuffers(1, &positionBufferCPU);
+
+    const GLbitfield mapFlags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    particleSlotSizeCPU = slotSize;
+    const GLsizeiptr bufferSize = numParticleSlotsCPU * particleSlotSizeCPU * sizeof(glm::vec4);
     glGenBuffers(1, &positionBufferCPU);
     glBindBuffer(GL_ARRAY_BUFFER, positionBufferCPU);
-    glBufferData(GL_ARRAY_BUFFER, maxParticles * 4 * sizeof(float), NULL, GL_STATIC_DRAW);
+    glBufferStorage(GL_ARRAY_BUFFER, bufferSize, NULL, mapFlags);
+    positionMappingCPU = static_cast<glm::vec4*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, bufferSize, mapFlags));
     glBindBuffer(GL_ARRAY_BUFFER, 0);
+    drawSlotCPU = 0;
+    drawParticleNum = 0;
+}
 
-    glBindVertexArray(0);
+/**
+ * @brief Apply a new maxParticles to the CPU particles without restarting the snowfall. The instance buffer is
+ * only replaced when it is too small, then it grows by half at least, so stepping maxParticles up does not
+ * reallocate it every time.
+ */
+void SnowGlobe::resizeParticlesCPU() {
+    // The simulation of the next frame must not run while the pool changes
+    if (particleJobCPU.valid()) {
+        particleJobCPU.wait();
+    }
+    particlesCPU->resize(maxParticles);
+    sortValid = false;
+
+    if (particlesCPU->size() > particleSlotSizeCPU) {
+        // The particles simulated for the next frame are lost with the old buffer
+        particleJobCPU = {};
+        initParticleBufferCPU(std::max(particlesCPU->size(), particleSlotSizeCPU * 3 / 2));
+    }
 }
 
 void SnowGlobe::deleteParticlesCPU() {
+    // The simulation of the next frame still writes into the buffer
+    if (particleJobCPU.valid()) {
+        particleJobCPU.wait();
+        particleJobCPU = {};
+    }
+    for (auto& fence : particleFencesCPU) {
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
     glDeleteVertexArrays(1, &vaCPU);
     glDeleteBuffers(1, &vboCPU);
-    glDeleteBuffers(1, &positionBufferCPU);
+    glDeleteBuffers(1, &positionBufferCPU); // Also unmaps the buffer
+    positionMappingCPU = nullptr;
+    particlesCPU.reset();
 }
 
 void SnowGlobe::updateParticlesCPU() {
-    int addNewParticle = maxParticles / 1000;
-    float dt = 0.001f;
-    particlePosition.clear();
-
-    // Add new particles
-    for (int i = 0; i < addNewParticle; i++) {
-        int unusedParticle = firstUnusedParticle();
-        respawnParticle(particleContainer[unusedParticle]);
-    }
-
-    // Update all particles
-    for (int i = 0; i < maxParticles; i++) {
-        Particle& p = particleContainer[i];
-        p.life -= dt;
-        if (p.life > 0.0f) {
-            if (p.position.z > 0.01f) {
-                p.position.x += (rand() % 2 - 1) * dt;
-                p.position.y += (rand() % 2 - 1) * dt;
-                p.position.z -= p.speed * dt;
-            }
-            if (distance(p.position, glm::vec3(0.0)) < 2.4f) {
-                particlePosition.push_back(p.position.x);
-                particlePosition.push_back(p.position.y);
-                particlePosition.push_back(p.position.z);
-                particlePosition.push_back(p.life);
-            }
-        }
-    }
-    drawParticleNum = particlePosition.size() / 4;
-    if (drawParticleNum == 0) {
-        for (int i = 0; i < 4; i++) particlePosition.push_back(0.0f);
+    float rate = static_cast<float>(spawnRate);
+    float dt = particleDt;
+    int steps = numSteps;
+    float alpha = stepAlpha;
+
+    // Draw the particles simulated during the last frame
+    if (particleJobCPU.valid()) {
+        drawParticleNum = static_cast<int>(particleJobCPU.get());
+        drawSlotCPU = (drawSlotCPU + 1) % numParticleSlotsCPU;
+        sortMillis = sortMillisCPU;
     }
 
-    // Update buffer data
-    glBindVertexArray(vaCPU);
-    glBindBuffer(GL_ARRAY_BUFFER, positionBufferCPU);
-    glBufferData(GL_ARRAY_BUFFER, maxParticles * 4 * sizeof(float), NULL, GL_STATIC_DRAW);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, drawParticleNum * sizeof(float) * 4, &particlePosition[0]);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
-}
+    // Upload the snow layer if particles landed, the job is done with it until the next one is submitted
+    if (particlesCPU != nullptr && particlesCPU->numDeposited() != snowUploadedCPU &&
+        particlesCPU->snowLayer().size() == static_cast<std::size_t>(heightfieldResolution * heightfieldResolution)) {
+        glBindTexture(GL_TEXTURE_2D, snowTex);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, heightfieldResolution, heightfieldResolution, GL_RED_INTEGER,
+                        GL_UNSIGNED_INT, particlesCPU->snowLayer().data());
+        glBindTexture(GL_TEXTURE_2D, 0);
+        snowUploadedCPU = particlesCPU->numDeposited();
+    }
+    if (positionMappingCPU == nullptr) {
+        return;
+    }
 
-int SnowGlobe::firstUnusedParticle() {
-    // Search from last used particle
-    for (int i = lastUsedParticle; i < maxParticles; i++) {
-        if (particleContainer[i].life <= 0.0f) {
-            lastUsedParticle = i;
-            return i;
-        }
+    // Simulate the next frame into the following slot, while this frame is rendered. The slot was drawn two
+    // frames ago, so its fence is usually signaled already.
+    int slot = (drawSlotCPU + 1) % numParticleSlotsCPU;
+    if (particleFencesCPU[slot] != nullptr) {
+        while (glClientWaitSync(particleFencesCPU[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED) {}
+        glDeleteSync(particleFencesCPU[slot]);
+        particleFencesCPU[slot] = nullptr;
     }
-    // Otherwise do linear search
-    for (int i = 0; i < lastUsedParticle; i++) {
-        if (particleContainer[i].life <= 0.0f) {
-            lastUsedParticle = i;
-            return i;
+    glm::vec4* out = positionMappingCPU + slot * particleSlotSizeCPU;
+    const bool sort = sortParticles;
+    const bool resort = needsParticleSort();
+    const glm::mat4 viewMx = camera->viewMx();
+    const glm::vec4 viewRowZ(viewMx[0][2], viewMx[1][2], viewMx[2][2], viewMx[3][2]);
+    particleJobCPU = jobs->submit([this, rate, dt, steps, alpha, out, sort, resort, viewRowZ]() {
+        for (int i = 0; i < steps; i++) {
+            particlesCPU->emit(rate, dt);
+            particlesCPU->step(dt, *jobs);
+        }
+        if (!sort) {
+            return particlesCPU->write(alpha, out, *jobs);
         }
-    }
-    // Override first particle if all others are alive
-    lastUsedParticle = 0;
-    return 0;
-}
 
-void SnowGlobe::respawnParticle(Particle& particle) {
-    // Create new particle
-    particle.position = glm::vec3(((rand() % 461) - 231) / 100.f, ((rand() % 461) - 231) / 100.f, 2.4f);
-    particle.speed = rand() % 3 + 1;
-    particle.life = 1.0f;
+        // Without a step or a camera movement the particles keep their order, they are only gathered by the last
+        // sort. The mapped slot is write only, so they are written to sortInputCPU first.
+        sortInputCPU.resize(particlesCPU->size());
+        const std::size_t count = particlesCPU->write(alpha, sortInputCPU.data(), *jobs);
+        const auto start = std::chrono::steady_clock::now();
+        if (resort || count != depthSorterCPU->size()) {
+            depthSorterCPU->sort(sortInputCPU.data(), count, viewRowZ, *jobs);
+        }
+        depthSorterCPU->gather(sortInputCPU.data(), out, *jobs);
+        sortMillisCPU = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return count;
+    });
 }
 
 void SnowGlobe::initParticlesGPU() {
-    lastUsedParticle = 0;
-
-    // Init particleContainer
-    particleContainerGPU.clear();
-    for (int i = 0; i < maxParticles; i++) {
-        glm::vec4 p = glm::vec4(0.0);
-        particleContainerGPU.push_back(p);
-    }
-
     // Snow quad
     const std::vector<float> particleVertices = {
          0.0f, 0.0f, 0.0f,
@@ -898,37 +1174,217 @@ void SnowGlobe::initParticlesGPU() {
     glBufferData(GL_ARRAY_BUFFER, particleVertices.size() * sizeof(float), &particleVertices[0], GL_STATIC_DRAW);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 
+    glBindVertexArray(0);
+
+    // All particles start dead
     glGenBuffers(1, &ssboGPU);
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboGPU);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, maxParticles * sizeof(glm::vec4), &particleContainerGPU[0], GL_DYNAMIC_DRAW);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, maxParticles * sizeof(glm::vec4), NULL, GL_DYNAMIC_COPY);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_RGBA32F, GL_RGBA, GL_FLOAT, NULL);
+
+    // Positions before the last step, the rendering interpolates from them
+    glGenBuffers(1, &previousBufferGPU);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, previousBufferGPU);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, maxParticles * sizeof(glm::vec4), NULL, GL_DYNAMIC_COPY);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_RGBA32F, GL_RGBA, GL_FLOAT, NULL);
+
+    // Indices of the visible particles, appended by the simulation
+    glGenBuffers(1, &visibleBufferGPU);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibleBufferGPU);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, maxParticles * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+
+    // Stack of the dead particles, holds all of them at first
+    std::vector<GLuint> deadIndices(maxParticles);
+    std::iota(deadIndices.rbegin(), deadIndices.rend(), 0u);
+    glGenBuffers(1, &deadBufferGPU);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, deadBufferGPU);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, maxParticles * sizeof(GLuint), deadIndices.data(), GL_DYNAMIC_COPY);
+
+    // Alive particles of this step and the next one, their roles swap every step
+    glGenBuffers(2, aliveBuffersGPU);
+    for (GLuint buffer : aliveBuffersGPU) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, maxParticles * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+    }
+    aliveCurrentGPU = 0;
+    emitRemainderGPU = 0.0f;
+
+    // Layout of particle_state_block: draw command, dispatch command, dead count, two alive counts
+    const GLuint state[10] = {4, 0, 0, 0, 0, 1, 1, static_cast<GLuint>(maxParticles), 0, 0};
+    glGenBuffers(1, &stateBufferGPU);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, stateBufferGPU);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(state), state, GL_DYNAMIC_COPY);
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
-    glBindVertexArray(0);
+    // Depth and index per visible particle, the bitonic sort needs a power of two of them
+    sortSizeGPU = sortBlockSizeGPU;
+    while (sortSizeGPU < maxParticles) {
+        sortSizeGPU *= 2;
+    }
+    glGenBuffers(1, &sortBufferGPU);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, sortBufferGPU);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sortSizeGPU * 2 * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glGenQueries(1, &sortQueryGPU);
+    sortQueryPendingGPU = false;
+    sortValid = false;
 }
 
 void SnowGlobe::deleteParticlesGPU() {
     glDeleteVertexArrays(1, &vaGPU);
     glDeleteBuffers(1, &vboGPU);
     glDeleteBuffers(1, &ssboGPU);
+    glDeleteBuffers(1, &visibleBufferGPU);
+    glDeleteBuffers(1, &stateBufferGPU);
+    glDeleteBuffers(1, &deadBufferGPU);
+    glDeleteBuffers(2, aliveBuffersGPU);
+    glDeleteBuffers(1, &previousBufferGPU);
+    glDeleteBuffers(1, &sortBufferGPU);
+    glDeleteQueries(1, &sortQueryGPU);
 }
 
+/**
+ * @brief Emit and simulate the GPU particles for the steps of this frame. Emission pops dead particles onto the
+ * alive list of the step, the simulation moves the alive ones onto the list of the next step or back to the
+ * dead list and appends the visible ones for the indirect draw. All counts stay on the GPU. Without a step the
+ * particles of the last one are drawn again.
+ */
 void SnowGlobe::updateParticlesGPU() {
-    int addNewParticle = maxParticles / 1000;
-    if(lastUsedParticle <= maxParticles) lastUsedParticle += addNewParticle;
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, ssboGPU);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, visibleBufferGPU);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, stateBufferGPU);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, deadBufferGPU);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, previousBufferGPU);
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, stateBufferGPU);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, heightfieldTex);
+    glBindImageTexture(1, snowTex, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+
+    for (int i = 0; i < numSteps; i++) {
+        const int current = aliveCurrentGPU;
+        const int next = 1 - aliveCurrentGPU;
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, aliveBuffersGPU[current]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, aliveBuffersGPU[next]);
+
+        // Emit the particles of this step, fractions are carried over
+        emitRemainderGPU += static_cast<float>(spawnRate) * particleDt;
+        const int emitCount = std::min(static_cast<int>(emitRemainderGPU), maxParticles);
+        emitRemainderGPU -= std::floor(emitRemainderGPU);
+        if (emitCount > 0) {
+            shaderParticleEmit->use();
+            shaderParticleEmit->setUniform("emitCount", emitCount);
+            shaderParticleEmit->setUniform("current", current);
+            shaderParticleEmit->setUniform("seed", rand());
+            glDispatchCompute((emitCount + particleGroupSizeGPU - 1) / particleGroupSizeGPU, 1, 1);
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        }
 
-    shaderParticleCompute->use(); 
-    shaderParticleCompute->setUniform("lastUsedParticle", lastUsedParticle);
-    shaderParticleCompute->setUniform("seed", rand() % maxParticles);
+        // Size the simulation dispatch by the alive count and reset the lists it fills
+        shaderParticleDispatch->use();
+        shaderParticleDispatch->setUniform("current", current);
+        shaderParticleDispatch->setUniform("groupSize", particleGroupSizeGPU);
+        glDispatchCompute(1, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+        shaderParticleCompute->use();
+        shaderParticleCompute->setUniform("dt", particleDt);
+        shaderParticleCompute->setUniform("current", current);
+        shaderParticleCompute->setUniform("heightfield", 0);
+        shaderParticleCompute->setUniform("heightfieldExtent", heightfieldExtent);
+        shaderParticleCompute->setUniform("heightfieldRange", glm::vec2(heightfieldTop, heightfieldBottom));
+        shaderParticleCompute->setUniform("flakeDepth", ParticleSystem::flakeDepth);
+        shaderParticleCompute->setUniform("maxSnowDepth", ParticleSystem::maxSnowDepth);
+        glDispatchComputeIndirect(4 * sizeof(GLuint));
+
+        // The next step and the vertex shader read the particles and indices, the draw call reads the command,
+        // the next step, the objects and uploads or downloads access the snow
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT |
+                        GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+
+        aliveCurrentGPU = next;
+    }
 
-    glBindVertexArray(vaGPU);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboGPU);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, ssboGPU);
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glUseProgram(0);
+}
 
-    // Implement computer shader
-    glDispatchCompute(maxParticles / 100, 1, 1);
-    glMemoryBarrier(GL_ALL_BARRIER_BITS);
+/**
+ * @brief Sort the visible GPU particles back to front by a bitonic sort in compute shaders. Blocks of
+ * sortBlockSizeGPU entries are sorted and merged in shared memory, only the merge steps at larger distances go
+ * through the buffer. The stages are dispatched for the padded size, so the visible count is not read back.
+ * The sorted indices replace the visible list the indirect draw reads.
+ */
+void SnowGlobe::sortParticlesGPU() {
+    // The time of the last sort is read once the GPU is done with it, so the query does not stall
+    if (sortQueryPendingGPU) {
+        GLint available = 0;
+        glGetQueryObjectiv(sortQueryGPU, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available != 0) {
+            GLuint64 nanoseconds = 0;
+            glGetQueryObjectui64v(sortQueryGPU, GL_QUERY_RESULT, &nanoseconds);
+            sortMillis = static_cast<float>(nanoseconds) * 1.0e-6f;
+            sortQueryPendingGPU = false;
+        }
+    }
+    if (!needsParticleSort()) {
+        return;
+    }
 
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-    glBindVertexArray(0); 
+    const bool timed = !sortQueryPendingGPU;
+    if (timed) {
+        glBeginQuery(GL_TIME_ELAPSED, sortQueryGPU);
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, ssboGPU);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, visibleBufferGPU);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, stateBufferGPU);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, previousBufferGPU);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, sortBufferGPU);
+    shaderParticleSort->use();
+    shaderParticleSort->setUniform("viewMx", camera->viewMx());
+    shaderParticleSort->setUniform("alpha", stepAlpha);
+
+    // Every pass runs one invocation per pair of entries
+    auto pass = [this](int mode, int stageSize, int compareDistance) {
+        shaderParticleSort->setUniform("mode", mode);
+        shaderParticleSort->setUniform("stageSize", stageSize);
+        shaderParticleSort->setUniform("compareDistance", compareDistance);
+        glDispatchCompute(sortSizeGPU / sortBlockSizeGPU, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    };
+    pass(sortModeKeys, 0, 0);
+    pass(sortModeSortBlock, 0, 0);
+    for (int stageSize = 2 * sortBlockSizeGPU; stageSize <= sortSizeGPU; stageSize *= 2) {
+        for (int compareDistance = stageSize / 2; compareDistance >= sortBlockSizeGPU; compareDistance /= 2) {
+            pass(sortModeMergeStep, stageSize, compareDistance);
+        }
+        pass(sortModeMergeBlock, stageSize, 0);
+    }
+    pass(sortModeWriteBack, 0, 0);
+
+    if (timed) {
+        glEndQuery(GL_TIME_ELAPSED);
+        sortQueryPendingGPU = true;
+    }
     glUseProgram(0);
 }
+
+/**
+ * @brief Decide whether the particles are sorted in this frame. Every step moves the particles and respawns
+ * dead ones at the top of the dome, so a frame with a step is always sorted. Without a step the particles are
+ * only interpolated, their order is kept unless the camera moved farther than sortCameraThreshold since the
+ * last sort.
+ * @return true if the particles are sorted
+ */
+bool SnowGlobe::needsParticleSort() {
+    if (!sortParticles) {
+        return false;
+    }
+    const glm::vec3 cameraPos = glm::vec3(inverse(camera->viewMx())[3]);
+    if (sortValid && numSteps == 0 && glm::distance(cameraPos, sortCameraPos) <= sortCameraThreshold) {
+        return false;
+    }
+    sortCameraPos = cameraPos;
+    sortValid = true;
+    return true;
+}
@@ -1,6 +1,8 @@
 #ifndef OGL4CORE2_PLUGINS_PCVC_SNOWGLOBE_SNOWGLOBE_H
 #define OGL4CORE2_PLUGINS_PCVC_SNOWGLOBE_SNOWGLOBE_H
 
+#include <chrono>
+#include <future>
 #include <memory>
 #include <string>
 #include <vector>
@@ -14,13 +16,10 @@
 #include "core/renderplugin.h"
 
 namespace OGL4Core2::Plugins::PCVC::SnowGlobe {
-    struct Particle {
-        glm::vec3 position;
-        float life;
-        float speed;
-    };
-
+    class DepthSorter;
+    class JobSystem;
     class Object;
+    class ParticleSystem;
 
     class SnowGlobe : public Core::RenderPlugin {
         REGISTERPLUGIN(SnowGlobe, 105) // NOLINT
@@ -37,6 +36,8 @@ namespace OGL4Core2::Plugins::PCVC::SnowGlobe {
         void mouseButton(Core::MouseButton button, Core::MouseButtonAction action, Core::Mods mods) override;
         void mouseMove(double xpos, double ypos) override;
 
+        void setSnowUniforms(glowl::GLSLProgram& program) const;
+
     private:
         enum class ObjectMoveMode {
             None = 0,
@@ -63,17 +64,26 @@ namespace OGL4Core2::Plugins::PCVC::SnowGlobe {
 
         void initSkybox();
 
+        // Collision of the particles with the scene
+        void initHeightfield();
+        void updateHeightfield();
+        void clearSnow();
+
         // CPU particles
         void initParticlesCPU();
         void deleteParticlesCPU();
         void updateParticlesCPU();
-        int firstUnusedParticle();
-        void respawnParticle(Particle &particle);
+        void initParticleBufferCPU(std::size_t slotSize);
+        void resizeParticlesCPU();
 
         // GPU particles
         void initParticlesGPU();
         void deleteParticlesGPU();
         void updateParticlesGPU();
+        void sortParticlesGPU();
+
+        // Back to front order of the blended particles
+        bool needsParticleSort();
 
         // Window state
         int wWidth;              //!< width of the window
@@ -93,7 +103,10 @@ namespace OGL4Core2::Plugins::PCVC::SnowGlobe {
         std::unique_ptr<glowl::GLSLProgram> shaderDome;
         std::unique_ptr<glowl::GLSLProgram> shaderParticleCPU;
         std::unique_ptr<glowl::GLSLProgram> shaderParticleGPU;
-        std::unique_ptr<glowl::GLSLProgram> shaderParticleCompute; //!< Compute shader
+        std::unique_ptr<glowl::GLSLProgram> shaderParticleCompute;  //!< simulates the GPU particles
+        std::unique_ptr<glowl::GLSLProgram> shaderParticleEmit;     //!< emits GPU particles from the dead list
+        std::unique_ptr<glowl::GLSLProgram> shaderParticleDispatch; //!< sizes the GPU particle simulation
+        std::unique_ptr<glowl::GLSLProgram> shaderParticleSort;     //!< sorts the visible GPU particles by depth
 
         // Vertex buffer
         std::unique_ptr<glowl::Mesh> vaQuad;
@@ -103,12 +116,30 @@ namespace OGL4Core2::Plugins::PCVC::SnowGlobe {
         GLuint vaGPU;
 
         // Other buffer for CPU particles
+        static constexpr int numParticleSlotsCPU = 3;  //!< frames the CPU particle buffer holds
         GLuint vboCPU;
-        GLuint positionBufferCPU;
+        GLuint positionBufferCPU;                      //!< persistently mapped, numParticleSlotsCPU slots
+        glm::vec4* positionMappingCPU;                 //!< mapping of positionBufferCPU
+        std::size_t particleSlotSizeCPU;               //!< particles per slot of positionBufferCPU
+        GLsync particleFencesCPU[numParticleSlotsCPU]; //!< signaled when the GPU is done with a slot
+        int drawSlotCPU;                               //!< slot drawn in this frame
 
         // Other buffer for GPU particles
+        static constexpr int particleGroupSizeGPU = 256; //!< work group size of particleGPU.comp
         GLuint vboGPU;
         GLuint ssboGPU;
+        GLuint visibleBufferGPU;                         //!< indices of the visible particles
+        GLuint stateBufferGPU;                           //!< draw and dispatch commands, list counts
+        GLuint deadBufferGPU;                            //!< stack of the dead particles
+        GLuint aliveBuffersGPU[2];                       //!< alive particles of this and the next step
+        GLuint previousBufferGPU;                        //!< particle positions before the last step
+        int aliveCurrentGPU;                             //!< alive list of the next step
+        float emitRemainderGPU;                          //!< fraction of a particle still to emit
+        static constexpr int sortBlockSizeGPU = 1024;    //!< entries particleSort.comp sorts in shared memory
+        GLuint sortBufferGPU;                            //!< depth and index per visible particle
+        int sortSizeGPU;                                 //!< entries of sortBufferGPU, a power of two
+        GLuint sortQueryGPU;                             //!< time of the last sort
+        bool sortQueryPendingGPU;                        //!< the result of sortQueryGPU was not read yet
 
         // FBO and its attachment
         GLuint fbo;           //!< handle for FBO
@@ -118,6 +149,21 @@ namespace OGL4Core2::Plugins::PCVC::SnowGlobe {
         GLuint fboTexPos;     //!< handle for color attachments
         GLuint fboTexDepth;   //!< handle for depth buffer attachment
 
+        // Heightfield of the scene seen from above, the particles land on it
+        static constexpr int heightfieldResolution = 256; //!< texels per side
+        static constexpr float heightfieldExtent = 2.5f;  //!< half size of the square around the origin it covers
+        static constexpr float heightfieldTop = 2.5f;     //!< height of depth 0
+        static constexpr float heightfieldBottom = -0.1f; //!< height of depth 1, below the board
+        GLuint heightfieldFbo;
+        GLuint heightfieldTex;                            //!< depth of the colliding objects
+        std::vector<glm::mat4> heightfieldModelMx;        //!< model matrices the heightfield was rendered with
+        std::vector<float> heightfieldCPU;                //!< heights of heightfieldTex for the CPU particles
+        bool renderingHeightfield;                        //!< the objects are drawn into the heightfield
+
+        // Snow layer on top of the heightfield, built from the landed particles
+        GLuint snowTex;                                   //!< flakes per heightfield texel
+        std::size_t snowUploadedCPU;                      //!< flakes of the CPU particles in snowTex
+
         // Texture
         std::shared_ptr<glowl::Texture2D> texBoard;     //!< board texture
         std::shared_ptr<glowl::Texture2D> texSphere;    //!< sphere texture
@@ -134,6 +180,7 @@ namespace OGL4Core2::Plugins::PCVC::SnowGlobe {
         int showFBOAtt;         //!< selector to show the different fbo attachments
         int showparticleMode;   //!< selector to show the different particles mode
         int maxParticles;       //!< maximun number of the particles
+        int spawnRate;          //!< new particles per time unit, a particle lives one time unit
         float domeAlpha;     //!< transparency of the dome
         bool useDayNightCycle;
         
@@ -156,13 +203,33 @@ namespace OGL4Core2::Plugins::PCVC::SnowGlobe {
         glm::vec3 lightPos;     //!< position of light
         
         // particles variable
-        std::vector<Particle> particleContainer;        //!< store all particles for CPU particles
-        std::vector<float> particlePosition;            //!< only store the particles for CPU particles which are alive and are in the dome
-        std::vector<glm::vec4> particleContainerGPU;    //!< store all particles for GPU particles
+        std::unique_ptr<JobSystem> jobs;                //!< threads of the CPU particle simulation
+        std::unique_ptr<ParticleSystem> particlesCPU;   //!< simulation of the CPU particles
+        std::future<std::size_t> particleJobCPU;        //!< simulation of the next frame, returns the visible particles
         int drawParticleNum;                            //!< number of particles which are alive and are in the dome
         int lastshowparticleMode;
         int lastmaxParticles;
-        int lastUsedParticle;
+        float snowSpeed;                                //!< time units the particles live through per second
+        float particleDt;                               //!< time units of one simulation step
+        std::unique_ptr<DepthSorter> depthSorterCPU;    //!< back to front order of the CPU particles
+        std::vector<glm::vec4> sortInputCPU;            //!< visible CPU particles before they are sorted
+        float sortMillisCPU;                            //!< time of the last CPU sort, written by the job
+
+        // Sorting of the particles, it only runs when their order may have changed
+        static constexpr float sortCameraThreshold = 0.05f; //!< camera movement which triggers a sort
+        bool sortParticles;                                 //!< sort the particles back to front and blend them
+        bool sortValid;                                     //!< the last sort matches the particles
+        glm::vec3 sortCameraPos;                            //!< camera position of the last sort
+        float sortMillis;                                   //!< time of the last sort
+
+        // Fixed timestep of the particles and the day/night cycle
+        static constexpr float stepSeconds = 1.0f / 60.0f; //!< real time of one simulation step
+        static constexpr float dayNightStep = 0.2f;        //!< degrees the light moves per step
+        int maxSubsteps;                                   //!< steps per frame at most, the remaining time is dropped
+        float stepAccumulator;                             //!< real time not simulated yet
+        int numSteps;                                      //!< simulation steps of this frame
+        float stepAlpha;                                   //!< weight of the last step when interpolating the rendering
+        std::chrono::steady_clock::time_point lastFrameTime; //!< start of the last frame
     };
 
 } // namespace OGL4Core2::Plugins::PCVC::SnowGlobe
@@ -5,6 +5,13 @@ uniform mat4 viewMx;
 uniform mat4 modelMx;
 uniform mat3 normalMx;
 
+uniform usampler2D snowTex;    // flakes landed per heightfield texel
+uniform sampler2D heightfield; // depth of the scene seen from above
+uniform float snowExtent;      // half size of the square around the origin both textures cover
+uniform vec2 heightfieldRange; // heights of depth 0 and 1
+uniform float flakeDepth;      // height a flake adds to the snow
+uniform float maxSnowDepth;    // the snow grows up to this height, 0 draws no snow
+
 layout(location = 0) in vec3 in_position;
 layout(location = 1) in vec3 in_normals;
 layout(location = 2) in vec2 in_texCoords;
@@ -12,10 +19,32 @@ layout(location = 2) in vec2 in_texCoords;
 out vec3 normal;
 out vec2 texCoords;
 out vec3 pos;
+out float snow;
+
+// Snow on a surface point. Only surfaces facing up which are the highest one at their position get snow.
+float snowAt(vec3 worldPos, vec3 worldNormal) {
+    if (maxSnowDepth <= 0.0 || worldNormal.z < 0.3) {
+        return 0.0;
+    }
+    int size = textureSize(snowTex, 0).x;
+    vec2 texel = clamp((worldPos.xy + snowExtent) * (float(size) / (2.0 * snowExtent)), 0.0, float(size - 1));
+    ivec2 cell = ivec2(texel);
+    float top = mix(heightfieldRange.x, heightfieldRange.y, texelFetch(heightfield, cell, 0).r);
+    if (worldPos.z < top - 0.02) {
+        return 0.0;
+    }
+    return min(float(texelFetch(snowTex, cell, 0).r) * flakeDepth, maxSnowDepth);
+}
 
 void main() {
-    gl_Position = projMx * viewMx * modelMx * vec4(in_position, 1.0);
+    vec4 worldPos = modelMx * vec4(in_position, 1.0);
     normal = normalize(normalMx * in_normals);
     texCoords = in_texCoords;
-    pos = (modelMx * vec4(in_position, 1.0)).xyz;
+
+    // The snow layer lifts the surface
+    snow = snowAt(worldPos.xyz, normal);
+    worldPos.z += snow;
+
+    gl_Position = projMx * viewMx * worldPos;
+    pos = worldPos.xyz;
 }
@@ -2,15 +2,19 @@
 
 uniform mat4 projMx;
 uniform mat4 viewMx;
+uniform float alpha; // interpolation weight between the positions before and after the last step
 
 layout(location = 0) in vec3 in_vertex_position;
 layout(std430, binding = 3) buffer share_particles_block { vec4 data[]; };
+layout(std430, binding = 4) buffer visible_particles_block { uint visibleIndices[]; };
+layout(std430, binding = 9) buffer previous_particles_block { vec4 previous[]; };
 
 out vec2 texCoords;
-out vec3 pos;
 
 void main() {
-    float life = data[gl_InstanceID].w;
+    uint index = visibleIndices[gl_InstanceID];
+    vec4 particle = data[index];
+    float life = particle.w;
 
     // Select texture depends on lifetime
     texCoords = in_vertex_position.xy / 2;      // Left top texture
@@ -18,9 +22,7 @@ void main() {
     else if ((life > 0.25) && (life <= 0.5)) texCoords.y += 0.5f;      // Left bottom texture
     else if ((life > 0.0) && (life <= 0.25)) texCoords += vec2(0.5f);   // Right bottom texture
 
-    vec4 position_viewspace = viewMx * vec4(data[gl_InstanceID].xyz , 1.0);
+    vec4 position_viewspace = viewMx * vec4(mix(previous[index].xyz, particle.xyz, alpha), 1.0);
     position_viewspace.xy += 0.05 * (in_vertex_position.xy - vec2(0.5)); // Scale the snowflake
     gl_Position = projMx * position_viewspace;
-
-    pos = data[gl_InstanceID].xyz;
 }
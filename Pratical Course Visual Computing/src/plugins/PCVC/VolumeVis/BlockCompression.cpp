@@ -0,0 +1,239 @@
+#include "BlockCompression.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+#include "Parallel.h"
+
+using namespace OGL4Core2::Plugins::PCVC::VolumeVis;
+
+/**
+ * One BC4 block: two 8 bit endpoints followed by sixteen 3 bit palette indices, texel (x, y) at bit 3 * (4y + x).
+ */
+struct Bc4Block {
+    std::uint8_t r0 = 0;
+    std::uint8_t r1 = 0;
+    std::array<std::uint8_t, 16> indices{};
+};
+
+/**
+ * Palette of a block as the texture unit decodes it. With r0 > r1 there are six interpolated values, otherwise
+ * four plus exact 0 and 1.
+ */
+static std::array<float, 8> bc4Palette(std::uint8_t r0, std::uint8_t r1) {
+    std::array<float, 8> p{};
+    float a = static_cast<float>(r0) / 255.0f;
+    float b = static_cast<float>(r1) / 255.0f;
+    p[0] = a;
+    p[1] = b;
+    if (r0 > r1) {
+        for (int i = 2; i < 8; i++) {
+            p[i] = (static_cast<float>(8 - i) * a + static_cast<float>(i - 1) * b) / 7.0f;
+        }
+    } else {
+        for (int i = 2; i < 6; i++) {
+            p[i] = (static_cast<float>(6 - i) * a + static_cast<float>(i - 1) * b) / 5.0f;
+        }
+        p[6] = 0.0f;
+        p[7] = 1.0f;
+    }
+    return p;
+}
+
+/**
+ * Choose the nearest palette entry for every texel.
+ * @return the summed squared error of the block
+ */
+static float bc4Assign(const std::array<float, 16>& values, Bc4Block& block) {
+    std::array<float, 8> palette = bc4Palette(block.r0, block.r1);
+    float error = 0.0f;
+    for (int t = 0; t < 16; t++) {
+        float best = std::numeric_limits<float>::max();
+        for (std::uint8_t i = 0; i < 8; i++) {
+            float d = values[t] - palette[i];
+            if (d * d < best) {
+                best = d * d;
+                block.indices[t] = i;
+            }
+        }
+        error += best;
+    }
+    return error;
+}
+
+static std::uint8_t quantize(float value) {
+    return static_cast<std::uint8_t>(std::clamp(std::lround(value * 255.0f), 0l, 255l));
+}
+
+/**
+ * Encode 16 values in [0, 1]. Both modes are tried: six interpolants between the extremes, and four between
+ * the extremes of the values that are not better represented by the exact 0 and 1 of the second mode.
+ */
+static Bc4Block bc4Encode(const std::array<float, 16>& values) {
+    auto [lo, hi] = std::minmax_element(values.begin(), values.end());
+
+    Bc4Block interp;
+    interp.r0 = quantize(*hi);
+    interp.r1 = quantize(*lo);
+    if (interp.r0 == interp.r1) {
+        // Constant block, r0 <= r1 selects the second mode whose first entry is r0.
+        interp.indices.fill(0);
+        return interp;
+    }
+    float interpError = bc4Assign(values, interp);
+
+    float innerLo = 1.0f;
+    float innerHi = 0.0f;
+    for (float v : values) {
+        if (v > 0.5f / 255.0f && v < 254.5f / 255.0f) {
+            innerLo = std::min(innerLo, v);
+            innerHi = std::max(innerHi, v);
+        }
+    }
+    if (innerLo > innerHi) {
+        innerLo = innerHi = 0.0f;
+    }
+    Bc4Block exact;
+    exact.r0 = quantize(innerLo);
+    exact.r1 = quantize(innerHi);
+    float exactError = bc4Assign(values, exact);
+
+    return exactError < interpError ? exact : interp;
+}
+
+/**
+ * Write a block in the memory layout of the format.
+ */
+static void bc4Store(const Bc4Block& block, std::uint8_t* dst) {
+    dst[0] = block.r0;
+    dst[1] = block.r1;
+    std::uint64_t bits = 0;
+    for (int t = 0; t < 16; t++) {
+        bits |= static_cast<std::uint64_t>(block.indices[t]) << (3 * t);
+    }
+    for (int i = 0; i < 6; i++) {
+        dst[2 + i] = static_cast<std::uint8_t>(bits >> (8 * i));
+    }
+}
+
+/**
+ * @brief Encode all slices of a volume.
+ * @tparam T           The voxel type
+ * @param voxels       The voxels
+ * @param cancel       Stops handing out slices once set, may be nullptr
+ * @param numThreads   Number of threads
+ * @param volume       Resolution set, receives range, blocks and errors
+ */
+template<typename T>
+static void encodeSlices(const T* voxels, const std::atomic<bool>* cancel, unsigned int numThreads,
+                         CompressedVolume& volume) {
+    const glm::uvec3 res = volume.res;
+    const std::size_t sliceVoxels = static_cast<std::size_t>(res.x) * res.y;
+    const int numSlices = static_cast<int>(res.z);
+    const float normalization = VoxelFormat<T>::normalization;
+
+    // Value range in sampler values, per slice first to avoid synchronization.
+    std::vector<float> sliceMin(res.z, 0.0f);
+    std::vector<float> sliceMax(res.z, 0.0f);
+    parallelFor(numSlices, numThreads, [&](int z) {
+        auto [lo, hi] = std::minmax_element(voxels + sliceVoxels * z, voxels + sliceVoxels * (z + 1));
+        sliceMin[z] = static_cast<float>(*lo) * normalization;
+        sliceMax[z] = static_cast<float>(*hi) * normalization;
+    });
+    float minValue = *std::min_element(sliceMin.begin(), sliceMin.end());
+    float maxValue = *std::max_element(sliceMax.begin(), sliceMax.end());
+    volume.range = glm::vec2(minValue, maxValue > minValue ? maxValue : minValue + 1.0f);
+    const float scale = normalization / (volume.range.y - volume.range.x);
+    const float offset = volume.range.x / normalization;
+
+    // Texels beyond the border of a slice repeat the last row and column.
+    const unsigned int blocksX = (res.x + 3) / 4;
+    const unsigned int blocksY = (res.y + 3) / 4;
+    volume.blocks.assign(volume.sliceBytes() * res.z, 0);
+    std::vector<double> sliceSqError(res.z, 0.0);
+    std::vector<float> sliceMaxError(res.z, 0.0f);
+    parallelFor(numSlices, numThreads, [&](int z) {
+        if (cancel != nullptr && cancel->load(std::memory_order_relaxed)) {
+            return;
+        }
+        const T* slice = voxels + sliceVoxels * z;
+        std::uint8_t* dst = volume.blocks.data() + volume.sliceBytes() * z;
+        double sqError = 0.0;
+        float maxError = 0.0f;
+        std::array<float, 16> values{};
+        for (unsigned int by = 0; by < blocksY; by++) {
+            for (unsigned int bx = 0; bx < blocksX; bx++) {
+                for (unsigned int t = 0; t < 16; t++) {
+                    unsigned int x = std::min(bx * 4 + t % 4, res.x - 1);
+                    unsigned int y = std::min(by * 4 + t / 4, res.y - 1);
+                    values[t] = (static_cast<float>(slice[static_cast<std::size_t>(y) * res.x + x]) - offset) * scale;
+                }
+                Bc4Block block = bc4Encode(values);
+                bc4Store(block, dst + (static_cast<std::size_t>(by) * blocksX + bx) * CompressedVolume::blockBytes);
+
+                // Only texels inside the slice count for the error.
+                std::array<float, 8> palette = bc4Palette(block.r0, block.r1);
+                for (unsigned int t = 0; t < 16; t++) {
+                    if (bx * 4 + t % 4 < res.x && by * 4 + t / 4 < res.y) {
+                        float e = std::abs(values[t] - palette[block.indices[t]]);
+                        sqError += static_cast<double>(e) * e;
+                        maxError = std::max(maxError, e);
+                    }
+                }
+            }
+        }
+        sliceSqError[z] = sqError;
+        sliceMaxError[z] = maxError;
+    });
+
+    double sqError = 0.0;
+    for (double e : sliceSqError) {
+        sqError += e;
+    }
+    volume.stats.rawBytes = sliceVoxels * res.z * sizeof(T);
+    volume.stats.rmse = static_cast<float>(std::sqrt(sqError / static_cast<double>(sliceVoxels * res.z)));
+    volume.stats.maxError = *std::max_element(sliceMaxError.begin(), sliceMaxError.end());
+    volume.stats.psnr = volume.stats.rmse > 0.0f ? -20.0f * std::log10(volume.stats.rmse)
+                                                 : std::numeric_limits<float>::infinity();
+}
+
+/**
+ * @brief Compress a volume into BC4 blocks on all cores, slice by slice.
+ * @param data         The mapped voxels
+ * @param type         The voxel type
+ * @param res          The volume resolution
+ * @param cancel       Stops the encoder once set, may be nullptr
+ * @param numThreads   Number of threads, 0 uses all cores
+ * @return the compressed volume
+ */
+CompressedVolume OGL4Core2::Plugins::PCVC::VolumeVis::compressVolume(const MappedFile& data, VoxelType type,
+                                                                     const glm::uvec3& res,
+                                                                     const std::atomic<bool>* cancel,
+                                                                     unsigned int numThreads) {
+    auto start = std::chrono::steady_clock::now();
+    numThreads = workerCount(numThreads);
+
+    CompressedVolume volume;
+    volume.res = res;
+    if (res.x == 0 || res.y == 0 || res.z == 0) {
+        return volume;
+    }
+    switch (type) {
+        case VoxelType::UInt8:
+            encodeSlices(reinterpret_cast<const std::uint8_t*>(data.data()), cancel, numThreads, volume);
+            break;
+        case VoxelType::UInt16:
+            encodeSlices(reinterpret_cast<const std::uint16_t*>(data.data()), cancel, numThreads, volume);
+            break;
+        case VoxelType::Float32:
+            encodeSlices(reinterpret_cast<const float*>(data.data()), cancel, numThreads, volume);
+            break;
+    }
+    volume.stats.compressedBytes = volume.blocks.size();
+    volume.stats.cancelled = cancel != nullptr && cancel->load();
+    volume.stats.encodeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return volume;
+}
@@ -0,0 +1,58 @@
+#ifndef OGL4CORE2_PLUGINS_PCVC_VOLUMEVIS_BLOCKCOMPRESSION_H
+#define OGL4CORE2_PLUGINS_PCVC_VOLUMEVIS_BLOCKCOMPRESSION_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+
+#include "VolumeLoader.h"
+
+namespace OGL4Core2::Plugins::PCVC::VolumeVis {
+
+    /**
+     * Size and error of a compressed volume. Errors are relative to the value range of the volume.
+     */
+    struct CompressionStats {
+        std::size_t rawBytes = 0;        //!< size of the uncompressed voxels
+        std::size_t compressedBytes = 0; //!< size of the compressed blocks
+        float rmse = 0.0f;               //!< root mean square error
+        float maxError = 0.0f;           //!< largest error of a voxel
+        float psnr = 0.0f;               //!< peak signal to noise ratio in dB
+        double encodeMs = 0.0;           //!< wall clock time of the encoder
+        bool cancelled = false;          //!< the encoder was stopped, the blocks are incomplete
+
+        [[nodiscard]] float ratio() const {
+            return compressedBytes > 0 ? static_cast<float>(rawBytes) / static_cast<float>(compressedBytes) : 0.0f;
+        }
+    };
+
+    /**
+     * Volume compressed slice by slice into BC4 (RGTC1) blocks of 4x4 voxels, 8 bytes each. The slices are the
+     * layers of a GL_TEXTURE_2D_ARRAY, as the format is not available for 3D textures. The texture unit decodes
+     * the blocks and filters within a slice, the shaders interpolate between the slices. Values are normalized
+     * to the value range of the volume, the shaders map them back to the values the sampler of the uncompressed
+     * texture would return.
+     */
+    struct CompressedVolume {
+        static constexpr GLenum internalFormat = GL_COMPRESSED_RED_RGTC1;
+        static constexpr std::size_t blockBytes = 8;
+
+        glm::uvec3 res = glm::uvec3(0);          //!< volume resolution
+        glm::vec2 range = glm::vec2(0.0f, 1.0f); //!< value range the blocks are normalized to, in sampler values
+        std::vector<std::uint8_t> blocks;        //!< blocks of all slices, row by row
+        CompressionStats stats;                  //!< size and error
+
+        [[nodiscard]] std::size_t sliceBytes() const {
+            return static_cast<std::size_t>((res.x + 3) / 4) * ((res.y + 3) / 4) * blockBytes;
+        }
+    };
+
+    CompressedVolume compressVolume(const MappedFile& data, VoxelType type, const glm::uvec3& res,
+                                    const std::atomic<bool>* cancel = nullptr, unsigned int numThreads = 0);
+} // namespace OGL4Core2::Plugins::PCVC::VolumeVis
+
+#endif // OGL4CORE2_PLUGINS_PCVC_VOLUMEVIS_BLOCKCOMPRESSION_H
@@ -0,0 +1,911 @@
+#include "CpuRaycaster.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+#include "Parallel.h"
+
+#if defined(__AVX2__)
+#define VOLUMEVIS_RAYCASTER_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VOLUMEVIS_RAYCASTER_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace OGL4Core2::Plugins::PCVC::VolumeVis;
+
+static constexpr int tileSize = 32;  //!< edge length of the tiles handed out to the workers
+static constexpr int packetSize = 8; //!< number of neighboring pixels traced together
+static constexpr float pi = 3.14159265358979323846f;
+
+/**
+ * One float per ray of a packet, an AVX register, two SSE2 registers or an array without either. Comparisons
+ * return masks with all bits of the true lanes set, like the intrinsics do.
+ */
+struct Lanes {
+#if defined(VOLUMEVIS_RAYCASTER_AVX2)
+    __m256 v;
+#elif defined(VOLUMEVIS_RAYCASTER_SSE2)
+    __m128 lo;
+    __m128 hi;
+#else
+    float v[packetSize];
+#endif
+};
+
+#if !defined(VOLUMEVIS_RAYCASTER_AVX2) && !defined(VOLUMEVIS_RAYCASTER_SSE2)
+static inline std::uint32_t floatBits(float f) {
+    std::uint32_t u;
+    std::memcpy(&u, &f, sizeof(u));
+    return u;
+}
+
+static inline float bitsFloat(std::uint32_t u) {
+    float f;
+    std::memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+static inline float maskLane(bool b) {
+    return bitsFloat(b ? ~0u : 0u);
+}
+#endif
+
+static inline Lanes set1(float f) {
+#if defined(VOLUMEVIS_RAYCASTER_AVX2)
+    return {_mm256_set1_ps(f)};
+#elif defined(VOLUMEVIS_RAYCASTER_SSE2)
+    return {_mm_set1_ps(f), _mm_set1_ps(f)};
+#else
+    Lanes r;
+    std::fill(r.v, r.v + packetSize, f);
+    return r;
+#endif
+}
+
+/**
+ * Load from 32 byte aligned memory.
+ */
+static inline Lanes load(const float* p) {
+#if defined(VOLUMEVIS_RAYCASTER_AVX2)
+    return {_mm256_load_ps(p)};
+#elif defined(VOLUMEVIS_RAYCASTER_SSE2)
+    return {_mm_load_ps(p), _mm_load_ps(p + 4)};
+#else
+    Lanes r;
+    std::copy(p, p + packetSize, r.v);
+    return r;
+#endif
+}
+
+/**
+ * Store to 32 byte aligned memory.
+ */
+static inline void store(float* p, const Lanes& a) {
+#if defined(VOLUMEVIS_RAYCASTER_AVX2)
+    _mm256_store_ps(p, a.v);
+#elif defined(VOLUMEVIS_RAYCASTER_SSE2)
+    _mm_store_ps(p, a.lo);
+    _mm_store_ps(p + 4, a.hi);
+#else
+    std::copy(a.v, a.v + packetSize, p);
+#endif
+}
+
+static inline Lanes operator+(const Lanes& a, const Lanes& b) {
+#if defined(VOLUMEVIS_RAYCASTER_AVX2)
+    return {_mm256_add_ps(a.v, b.v)};
+#elif defined(VOLUMEVIS_RAYCASTER_SSE2)
+    return {_mm_add_ps(a.lo, b.lo), _mm_add_ps(a.hi, b.hi)};
+#else
+    Lanes r;
+    for (int l = 0; l < packetSize; l++) {
+        r.v[l] = a.v[l] + b.v[l];
+    }
+    return r;
+#endif
+}
+
+static inline Lanes operator-(const Lanes& a, const Lanes& b) {
+#if defined(VOLUMEVIS_RAYCASTER_AVX2)
+    return {_mm256_sub_ps(a.v, b.v)};
+#elif defined(VOLUMEVIS_RAYCASTER_SSE2)
+    return {_mm_sub_ps(a.lo, b.lo), _mm_sub_ps(a.hi, b.hi)};
+#else
+    Lanes r;
+    for (int l = 0; l < packetSize; l++) {
+        r.v[l] = a.v[l] - b.v[l];
+    }
+    return r;
+#endif
+}
+
+static inline Lanes operator*(const Lanes& a, const Lanes& b) {
+#if defined(VOLUMEVIS_RAYCASTER_AVX2)
+    return {_mm256_mul_ps(a.v, b.v)};
+#elif defined(VOLUMEVIS_RAYCASTER_SSE2)
+    return {_mm_mul_ps(a.lo, b.lo), _mm_mul_ps(a.hi, b.hi)};
+#else
+    Lanes r;
+    for (int l = 0; l < packetSize; l++) {
+        r.v[l] = a.v[l] * b.v[l];
+    }
+    return r;
+#endif
+}
+
+static inline Lanes minimum(const Lanes& a, const Lanes& b) {
+#if defined(VOLUMEVIS_RAYCASTER_AVX2)
+    return {_mm256_min_ps(a.v, b.v)};
+#elif defined(VOLUMEVIS_RAYCASTER_SSE2)
+    return {_mm_min_ps(a.lo, b.lo), _mm_min_ps(a.hi, b.hi)};
+#else
+    Lanes r;
+    for (int l = 0; l < packetSize; l++) {
+        r.v[l] = a.v[l] < b.v[l] ? a.v[l] : b.v[l];
+    }
+    return r;
+#endif
+}
+
+static inline Lanes maximum(const Lanes& a, const Lanes& b) {
+#if defined(VOLUMEVIS_RAYCASTER_AVX2)
+    return {_mm256_max_ps(a.v, b.v)};
+#elif defined(VOLUMEVIS_RAYCASTER_SSE2)
+    return {_mm_max_ps(a.lo, b.lo), _mm_max_ps(a.hi, b.hi)};
+#else
+    Lanes r;
+    for (int l = 0; l < packetSize; l++) {
+        r.v[l] = a.v[l] > b.v[l] ? a.v[l] : b.v[l];
+    }
+    return r;
+#endif
+}
+
+/**
+ * Mask of the lanes with a < b.
+ */
+static inline Lanes lessThan(const Lanes& a, const Lanes& b) {
+#if defined(VOLUMEVIS_RAYCASTER_AVX2)
+    return {_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)};
+#elif defined(VOLUMEVIS_RAYCASTER_SSE2)
+    return {_mm_cmplt_ps(a.lo, b.lo), _mm_cmplt_ps(a.hi, b.hi)};
+#else
+    Lanes r;
+    for (int l = 0; l < packetSize; l++) {
+        r.v[l] = maskLane(a.v[l] < b.v[l]);
+    }
+    return r;
+#endif
+}
+
+/**
+ * Mask of the lanes with a <= b.
+ */
+static inline Lanes lessEqual(const Lanes& a, const Lanes& b) {
+#if defined(VOLUMEVIS_RAYCASTER_AVX2)
+    return {_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ)};
+#elif defined(VOLUMEVIS_RAYCASTER_SSE2)
+    return {_mm_cmple_ps(a.lo, b.lo), _mm_cmple_ps(a.hi, b.hi)};
+#else
+    Lanes r;
+    for (int l = 0; l < packetSize; l++) {
+        r.v[l] = maskLane(a.v[l] <= b.v[l]);
+    }
+    return r;
+#endif
+}
+
+/**
+ * Bitwise a & ~b, the lanes of mask a which are not in mask b.
+ */
+static inline Lanes andNot(const Lanes& a, const Lanes& b) {
+#if defined(VOLUMEVIS_RAYCASTER_AVX2)
+    return {_mm256_andnot_ps(b.v, a.v)};
+#elif defined(VOLUMEVIS_RAYCASTER_SSE2)
+    return {_mm_andnot_ps(b.lo, a.lo), _mm_andnot_ps(b.hi, a.hi)};
+#else
+    Lanes r;
+    for (int l = 0; l < packetSize; l++) {
+        r.v[l] = bitsFloat(floatBits(a.v[l]) & ~floatBits(b.v[l]));
+    }
+    return r;
+#endif
+}
+
+/**
+ * Bitwise a & b, the lanes of a where mask b is set and zero elsewhere.
+ */
+static inline Lanes operator&(const Lanes& a, const Lanes& b) {
+#if defined(VOLUMEVIS_RAYCASTER_AVX2)
+    return {_mm256_and_ps(a.v, b.v)};
+#elif defined(VOLUMEVIS_RAYCASTER_SSE2)
+    return {_mm_and_ps(a.lo, b.lo), _mm_and_ps(a.hi, b.hi)};
+#else
+    Lanes r;
+    for (int l = 0; l < packetSize; l++) {
+        r.v[l] = bitsFloat(floatBits(a.v[l]) & floatBits(b.v[l]));
+    }
+    return r;
+#endif
+}
+
+/**
+ * a where the mask is set, b elsewhere.
+ */
+static inline Lanes select(const Lanes& mask, const Lanes& a, const Lanes& b) {
+#if defined(VOLUMEVIS_RAYCASTER_AVX2)
+    return {_mm256_blendv_ps(b.v, a.v, mask.v)};
+#elif defined(VOLUMEVIS_RAYCASTER_SSE2)
+    return {_mm_or_ps(_mm_and_ps(mask.lo, a.lo), _mm_andnot_ps(mask.lo, b.lo)),
+            _mm_or_ps(_mm_and_ps(mask.hi, a.hi), _mm_andnot_ps(mask.hi, b.hi))};
+#else
+    Lanes r;
+    for (int l = 0; l < packetSize; l++) {
+        r.v[l] = floatBits(mask.v[l]) != 0u ? a.v[l] : b.v[l];
+    }
+    return r;
+#endif
+}
+
+/**
+ * Bit l is set if lane l of the mask is set.
+ */
+static inline int maskBits(const Lanes& mask) {
+#if defined(VOLUMEVIS_RAYCASTER_AVX2)
+    return _mm256_movemask_ps(mask.v);
+#elif defined(VOLUMEVIS_RAYCASTER_SSE2)
+    return _mm_movemask_ps(mask.lo) | (_mm_movemask_ps(mask.hi) << 4);
+#else
+    int bits = 0;
+    for (int l = 0; l < packetSize; l++) {
+        bits |= floatBits(mask.v[l]) != 0u ? 1 << l : 0;
+    }
+    return bits;
+#endif
+}
+
+/**
+ * Round down, the results are returned as float and stored as int.
+ * @param a            Values in the range of int
+ * @param out          32 byte aligned target of the integers
+ */
+static inline Lanes floorToInt(const Lanes& a, std::int32_t* out) {
+#if defined(VOLUMEVIS_RAYCASTER_AVX2)
+    __m256 f = _mm256_floor_ps(a.v);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(out), _mm256_cvttps_epi32(f));
+    return {f};
+#elif defined(VOLUMEVIS_RAYCASTER_SSE2)
+    // Truncation rounds negative values up, the mask of those is -1 as integer.
+    __m128i lo = _mm_cvttps_epi32(a.lo);
+    __m128i hi = _mm_cvttps_epi32(a.hi);
+    lo = _mm_add_epi32(lo, _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(lo), a.lo)));
+    hi = _mm_add_epi32(hi, _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(hi), a.hi)));
+    _mm_store_si128(reinterpret_cast<__m128i*>(out), lo);
+    _mm_store_si128(reinterpret_cast<__m128i*>(out + 4), hi);
+    return {_mm_cvtepi32_ps(lo), _mm_cvtepi32_ps(hi)};
+#else
+    Lanes r;
+    for (int l = 0; l < packetSize; l++) {
+        r.v[l] = std::floor(a.v[l]);
+        out[l] = static_cast<std::int32_t>(r.v[l]);
+    }
+    return r;
+#endif
+}
+
+/**
+ * Like mix() in GLSL.
+ */
+static inline Lanes mix(const Lanes& a, const Lanes& b, const Lanes& f) {
+    return a + (b - a) * f;
+}
+
+/**
+ * Trilinear sampling of the voxels with the wrap mode and normalization of the 3D texture.
+ */
+template<typename T>
+class VoxelSampler {
+public:
+    VoxelSampler(const T* voxels, const glm::uvec3& res, const glm::vec3& volumeDim, const glm::vec2& valueRange)
+        : voxels(voxels),
+          res(res),
+          resF(res),
+          volumeDim(volumeDim),
+          texelScale(resF / volumeDim),
+          texelOffset(0.5f * resF - glm::vec3(0.5f)),
+          valueOffset(valueRange.x),
+          valueScale(1.0f / (valueRange.y - valueRange.x)) {}
+
+    /**
+     * Like texture(volumeTex, texCoords).x, GL_REPEAT and GL_LINEAR.
+     * @param texCoords    Texture coordinates
+     */
+    [[nodiscard]] float texture(const glm::vec3& texCoords) const {
+        glm::vec3 p = texCoords * resF - glm::vec3(0.5f);
+        glm::vec3 p0 = glm::floor(p);
+        glm::vec3 f = p - p0;
+        int x0 = wrap(static_cast<int>(p0.x), res.x);
+        int y0 = wrap(static_cast<int>(p0.y), res.y);
+        int z0 = wrap(static_cast<int>(p0.z), res.z);
+        int x1 = x0 + 1 < static_cast<int>(res.x) ? x0 + 1 : 0;
+        int y1 = y0 + 1 < static_cast<int>(res.y) ? y0 + 1 : 0;
+        int z1 = z0 + 1 < static_cast<int>(res.z) ? z0 + 1 : 0;
+
+        float c00 = glm::mix(fetch(x0, y0, z0), fetch(x1, y0, z0), f.x);
+        float c10 = glm::mix(fetch(x0, y1, z0), fetch(x1, y1, z0), f.x);
+        float c01 = glm::mix(fetch(x0, y0, z1), fetch(x1, y0, z1), f.x);
+        float c11 = glm::mix(fetch(x0, y1, z1), fetch(x1, y1, z1), f.x);
+        float c0 = glm::mix(c00, c10, f.y);
+        float c1 = glm::mix(c01, c11, f.y);
+        return glm::mix(c0, c1, f.z) * VoxelFormat<T>::normalization;
+    }
+
+    /**
+     * Like sampleVolume() in volume.frag for all rays of a packet, the value range is mapped to [0, 1]. Only the
+     * voxel fetches are done per lane, the lanes without mask bit are skipped and return garbage.
+     * @param x            World coordinates x
+     * @param y            World coordinates y
+     * @param z            World coordinates z
+     * @param active       Mask bits of the lanes to sample
+     */
+    [[nodiscard]] Lanes values(const Lanes& x, const Lanes& y, const Lanes& z, int active) const {
+        alignas(32) std::int32_t ix[packetSize];
+        alignas(32) std::int32_t iy[packetSize];
+        alignas(32) std::int32_t iz[packetSize];
+        Lanes px = x * set1(texelScale.x) + set1(texelOffset.x);
+        Lanes py = y * set1(texelScale.y) + set1(texelOffset.y);
+        Lanes pz = z * set1(texelScale.z) + set1(texelOffset.z);
+        Lanes fx = px - floorToInt(px, ix);
+        Lanes fy = py - floorToInt(py, iy);
+        Lanes fz = pz - floorToInt(pz, iz);
+
+        alignas(32) float corners[8][packetSize] = {};
+        for (int l = 0; l < packetSize; l++) {
+            if ((active & (1 << l)) == 0) {
+                continue;
+            }
+            int x0 = wrapFast(ix[l], res.x);
+            int y0 = wrapFast(iy[l], res.y);
+            int z0 = wrapFast(iz[l], res.z);
+            int x1 = x0 + 1 < static_cast<int>(res.x) ? x0 + 1 : 0;
+            int y1 = y0 + 1 < static_cast<int>(res.y) ? y0 + 1 : 0;
+            int z1 = z0 + 1 < static_cast<int>(res.z) ? z0 + 1 : 0;
+            corners[0][l] = fetch(x0, y0, z0);
+            corners[1][l] = fetch(x1, y0, z0);
+            corners[2][l] = fetch(x0, y1, z0);
+            corners[3][l] = fetch(x1, y1, z0);
+            corners[4][l] = fetch(x0, y0, z1);
+            corners[5][l] = fetch(x1, y0, z1);
+            corners[6][l] = fetch(x0, y1, z1);
+            corners[7][l] = fetch(x1, y1, z1);
+        }
+
+        Lanes c0 = mix(mix(load(corners[0]), load(corners[1]), fx), mix(load(corners[2]), load(corners[3]), fx), fy);
+        Lanes c1 = mix(mix(load(corners[4]), load(corners[5]), fx), mix(load(corners[6]), load(corners[7]), fx), fy);
+        return mix(c0, c1, fz) * set1(VoxelFormat<T>::normalization * valueScale) - set1(valueOffset * valueScale);
+    }
+
+    /**
+     * Like mapTexCoords() in volume.frag.
+     * @param pos          World coordinates
+     */
+    [[nodiscard]] glm::vec3 texCoords(const glm::vec3& pos) const {
+        return pos / volumeDim + glm::vec3(0.5f);
+    }
+
+    /**
+     * Like calcNormal() in volume.frag with central differences.
+     * @param pos          World coordinates
+     */
+    [[nodiscard]] glm::vec3 normal(const glm::vec3& pos) const {
+        glm::vec3 tc = texCoords(pos);
+        glm::vec3 texel = glm::vec3(1.0f) / resF;
+        glm::vec3 gradient(texture(tc + glm::vec3(texel.x, 0.0f, 0.0f)) - texture(tc - glm::vec3(texel.x, 0.0f, 0.0f)),
+                           texture(tc + glm::vec3(0.0f, texel.y, 0.0f)) - texture(tc - glm::vec3(0.0f, texel.y, 0.0f)),
+                           texture(tc + glm::vec3(0.0f, 0.0f, texel.z)) - texture(tc - glm::vec3(0.0f, 0.0f, texel.z)));
+        float len = glm::length(gradient);
+        return len > 0.0f ? gradient / len : glm::vec3(0.0f);
+    }
+
+private:
+    static int wrap(int i, unsigned int n) {
+        int m = i % static_cast<int>(n);
+        return m < 0 ? m + static_cast<int>(n) : m;
+    }
+
+    static int wrapFast(int i, unsigned int n) {
+        return static_cast<unsigned int>(i) < n ? i : wrap(i, n);
+    }
+
+    [[nodiscard]] float fetch(int x, int y, int z) const {
+        return static_cast<float>(voxels[(static_cast<std::size_t>(z) * res.y + y) * res.x + x]);
+    }
+
+    const T* voxels;
+    glm::uvec3 res;
+    glm::vec3 resF;
+    glm::vec3 volumeDim;
+    glm::vec3 texelScale;
+    glm::vec3 texelOffset;
+    float valueOffset;
+    float valueScale;
+};
+
+/**
+ * Transfer function lookup with linear filtering, like a texture fetch at lutCoord() in volume.frag.
+ * @param tf           Transfer function values (r,g,b,a)
+ * @param s            Position in entries, 0 and numEntries - 1 are the first and last entry
+ */
+static glm::vec4 tfLookup(const std::vector<float>& tf, float s) {
+    auto numEntries = static_cast<int>(tf.size() / 4);
+    s = std::clamp(s, 0.0f, static_cast<float>(numEntries - 1));
+    int i0 = static_cast<int>(s);
+    int i1 = std::min(i0 + 1, numEntries - 1);
+    float f = s - static_cast<float>(i0);
+    glm::vec4 c0(tf[4 * i0], tf[4 * i0 + 1], tf[4 * i0 + 2], tf[4 * i0 + 3]);
+    glm::vec4 c1(tf[4 * i1], tf[4 * i1 + 1], tf[4 * i1 + 2], tf[4 * i1 + 3]);
+    return glm::mix(c0, c1, f);
+}
+
+/**
+ * Pre-integration table like preintegrate.comp computes it, front sample along x, back sample along y.
+ */
+class PreIntTable {
+public:
+    PreIntTable(const std::vector<float>& tf, float stepRatio, std::size_t maxSize, unsigned int numThreads)
+        : size(static_cast<int>(std::min(tf.size() / 4, maxSize))),
+          entries(static_cast<std::size_t>(size) * size) {
+        auto numPoints = static_cast<float>(tf.size() / 4);
+        float scaleToTf = (numPoints - 1.0f) / static_cast<float>(std::max(size - 1, 1));
+        parallelFor(size, numThreads, [&](int y) {
+            for (int x = 0; x < size; x++) {
+                float front = static_cast<float>(x) * scaleToTf;
+                float back = static_cast<float>(y) * scaleToTf;
+                int numSub = std::max(static_cast<int>(std::ceil(std::abs(back - front))), 1);
+                float subRatio = stepRatio / static_cast<float>(numSub);
+                glm::vec4 acc(0.0f);
+                for (int k = 0; k < numSub; k++) {
+                    float s = glm::mix(front, back, (static_cast<float>(k) + 0.5f) / static_cast<float>(numSub));
+                    glm::vec4 c = tfLookup(tf, s);
+                    float alpha = 1.0f - std::pow(1.0f - std::clamp(c.a, 0.0f, 1.0f), subRatio);
+                    acc += (1.0f - acc.a) * glm::vec4(glm::vec3(c) * alpha, alpha);
+                }
+                entries[static_cast<std::size_t>(y) * size + x] = acc;
+            }
+        });
+    }
+
+    /**
+     * Bilinear lookup of a segment.
+     * @param front        Normalized value at the front sample
+     * @param back         Normalized value at the back sample
+     */
+    [[nodiscard]] glm::vec4 lookup(float front, float back) const {
+        float maxIdx = static_cast<float>(size - 1);
+        float x = std::clamp(front, 0.0f, 1.0f) * maxIdx;
+        float y = std::clamp(back, 0.0f, 1.0f) * maxIdx;
+        int x0 = static_cast<int>(x);
+        int y0 = static_cast<int>(y);
+        int x1 = std::min(x0 + 1, size - 1);
+        int y1 = std::min(y0 + 1, size - 1);
+        float fx = x - static_cast<float>(x0);
+        float fy = y - static_cast<float>(y0);
+        glm::vec4 c0 = glm::mix(at(x0, y0), at(x1, y0), fx);
+        glm::vec4 c1 = glm::mix(at(x0, y1), at(x1, y1), fx);
+        return glm::mix(c0, c1, fy);
+    }
+
+private:
+    [[nodiscard]] const glm::vec4& at(int x, int y) const { return entries[static_cast<std::size_t>(y) * size + x]; }
+
+    int size;
+    std::vector<glm::vec4> entries;
+};
+
+/**
+ * Rays of up to packetSize neighboring pixels. All rays start at the camera, the per-lane data is stored as
+ * aligned arrays which load into Lanes. Lanes without ray or intersection have tFar < tNear.
+ */
+struct RayPacket {
+    int count = 0;
+    alignas(32) float dx[packetSize] = {};
+    alignas(32) float dy[packetSize] = {};
+    alignas(32) float dz[packetSize] = {};
+    alignas(32) float tNear[packetSize] = {};
+    alignas(32) float tFar[packetSize] = {};
+    bool hit[packetSize] = {};
+    bool frontEdge[packetSize] = {};
+    bool backEdge[packetSize] = {};
+
+    [[nodiscard]] glm::vec3 dir(int l) const { return glm::vec3(dx[l], dy[l], dz[l]); }
+};
+
+/**
+ * Positions of a step of all rays in a packet.
+ */
+struct PacketStep {
+    Lanes active; //!< mask of the rays which take this step
+    Lanes x;
+    Lanes y;
+    Lanes z;
+    Lanes length; //!< distance to the previous step
+};
+
+/**
+ * Like intersectBox() in volume.frag.
+ */
+static bool intersectBox(const glm::vec3& o, const glm::vec3& d, const glm::vec3& boxMin, const glm::vec3& boxMax,
+                         float& tNear, float& tFar) {
+    float tMin = (boxMin.x - o.x) / d.x;
+    float tMax = (boxMax.x - o.x) / d.x;
+    if (tMin > tMax) std::swap(tMin, tMax);
+
+    float tyMin = (boxMin.y - o.y) / d.y;
+    float tyMax = (boxMax.y - o.y) / d.y;
+    if (tyMin > tyMax) std::swap(tyMin, tyMax);
+
+    if ((tMin > tyMax) || (tyMin > tMax)) return false;
+    if (tyMin > tMin) tMin = tyMin;
+    if (tyMax < tMax) tMax = tyMax;
+
+    float tzMin = (boxMin.z - o.z) / d.z;
+    float tzMax = (boxMax.z - o.z) / d.z;
+    if (tzMin > tzMax) std::swap(tzMin, tzMax);
+
+    if ((tMin > tzMax) || (tzMin > tMax)) return false;
+    if (tzMin > tMin) tMin = tzMin;
+    if (tzMax < tMax) tMax = tzMax;
+
+    tNear = tMin;
+    tFar = tMax;
+    return true;
+}
+
+/**
+ * Like isBoxEdge() in volume.frag.
+ */
+static bool isBoxEdge(const glm::vec3& pos, const glm::vec3& volumeDim) {
+    glm::vec3 diffNear = glm::abs(pos - 0.5f * volumeDim);
+    glm::vec3 diffFar = glm::abs(pos + 0.5f * volumeDim);
+    int count = 0;
+    for (int i = 0; i < 3; i++) {
+        count += diffNear[i] < 0.01f ? 1 : 0;
+        count += diffFar[i] < 0.01f ? 1 : 0;
+    }
+    return count >= 2;
+}
+
+/**
+ * Like blinnPhong() in volume.frag.
+ */
+static glm::vec3 blinnPhong(const CpuRaycaster::Params& p, const glm::vec3& n, const glm::vec3& l, const glm::vec3& v) {
+    glm::vec3 h = glm::normalize(v + l);
+    glm::vec3 color = p.k.x * p.ambient;
+    color += p.k.y * p.diffuse * std::max(0.0f, glm::dot(n, glm::normalize(l)));
+    color += p.k.z * p.specular * std::pow(std::max(0.0f, glm::dot(n, h)), p.k.w) * (p.k.w + 2.0f) /
+             (2.0f * pi);
+    return color;
+}
+
+/**
+ * March all rays of a packet in lockstep. step(PacketStep) is called for every step in which any ray is in front
+ * of its back intersection and returns the mask of the active rays which go on.
+ * @param packet       The rays
+ * @param o            Origin of all rays
+ * @param p            The parameters
+ * @param toFar        Clamp the last step of every ray to its back intersection, like the volume mode of the shader
+ * @param step         Kernel
+ */
+template<typename F>
+static void marchPacket(const RayPacket& packet, const glm::vec3& o, const CpuRaycaster::Params& p, bool toFar,
+                        F&& step) {
+    const Lanes tNear = load(packet.tNear);
+    const Lanes tFar = load(packet.tFar);
+    const Lanes dx = load(packet.dx);
+    const Lanes dy = load(packet.dy);
+    const Lanes dz = load(packet.dz);
+    const Lanes stepSize = set1(p.stepSize);
+    Lanes tFront = tNear;
+    Lanes active = lessEqual(tNear, tFar);
+
+    for (int i = 1; i <= p.maxSteps; i++) {
+        Lanes t = stepSize * set1(static_cast<float>(i)) + tNear;
+        if (toFar) {
+            active = active & lessThan(tFront, tFar);
+            t = minimum(t, tFar);
+        } else {
+            active = active & lessThan(t, tFar);
+        }
+        if (maskBits(active) == 0) {
+            break;
+        }
+        active = step(PacketStep{active, t * dx + set1(o.x), t * dy + set1(o.y), t * dz + set1(o.z), t - tFront});
+        tFront = t;
+    }
+}
+
+/**
+ * Trace one packet and return the colors of its pixels.
+ * @param sampler      The volume
+ * @param preInt       Pre-integration table, may be nullptr
+ * @param p            The parameters
+ * @param packet       The rays
+ * @param o            Origin of all rays
+ * @param colors       Resulting colors
+ */
+template<typename T>
+static void tracePacket(const VoxelSampler<T>& sampler, const PreIntTable* preInt, const CpuRaycaster::Params& p,
+                        const RayPacket& packet, const glm::vec3& o, glm::vec3* colors) {
+    const glm::vec3 black(0.0f);
+    const glm::vec3 yellow(1.0f, 1.0f, 0.0f);
+
+    alignas(32) float result[packetSize];
+
+    switch (p.viewMode) {
+        case 0: { // line-of-sight
+            Lanes value = set1(0.0f);
+            marchPacket(packet, o, p, false, [&](const PacketStep& s) {
+                Lanes sample = sampler.values(s.x, s.y, s.z, maskBits(s.active));
+                value = select(s.active, value + sample * set1(p.scale), value);
+                return s.active;
+            });
+            store(result, value);
+            for (int l = 0; l < packet.count; l++) {
+                colors[l] = glm::vec3(result[l]);
+            }
+            break;
+        }
+        case 1: { // maximum-intensity projection
+            Lanes value = set1(0.0f);
+            marchPacket(packet, o, p, false, [&](const PacketStep& s) {
+                Lanes sample = sampler.values(s.x, s.y, s.z, maskBits(s.active));
+                value = select(s.active, maximum(value, sample), value);
+                return s.active;
+            });
+            store(result, value);
+            for (int l = 0; l < packet.count; l++) {
+                colors[l] = glm::vec3(result[l]);
+            }
+            break;
+        }
+        case 2: { // isosurface, the test is done for the previous sample like in the shader
+            Lanes lastValue = set1(0.0f);
+            Lanes lastX = set1(o.x);
+            Lanes lastY = set1(o.y);
+            Lanes lastZ = set1(o.z);
+            for (int l = 0; l < packetSize; l++) {
+                colors[l] = black;
+            }
+            marchPacket(packet, o, p, false, [&](const PacketStep& s) {
+                Lanes value = sampler.values(s.x, s.y, s.z, maskBits(s.active));
+                Lanes surface = s.active & lessThan(set1(p.isoValue), lastValue);
+                if (int bits = maskBits(surface); bits != 0) {
+                    // Shading needs the normal, which is only computed for the few rays hitting the surface.
+                    alignas(32) float lane[8][packetSize];
+                    store(lane[0], value);
+                    store(lane[1], lastValue);
+                    store(lane[2], lastX);
+                    store(lane[3], lastY);
+                    store(lane[4], lastZ);
+                    store(lane[5], s.x);
+                    store(lane[6], s.y);
+                    store(lane[7], s.z);
+                    for (int l = 0; l < packetSize; l++) {
+                        if ((bits & (1 << l)) == 0) {
+                            continue;
+                        }
+                        glm::vec3 pos(lane[5][l], lane[6][l], lane[7][l]);
+                        glm::vec3 isoPos = glm::mix(glm::vec3(lane[2][l], lane[3][l], lane[4][l]), pos,
+                                                    (p.isoValue - lane[1][l]) / (lane[0][l] - lane[1][l]));
+                        colors[l] = blinnPhong(p, -sampler.normal(isoPos), o, -packet.dir(l));
+                    }
+                }
+                lastValue = select(s.active, value, lastValue);
+                lastX = select(s.active, s.x, lastX);
+                lastY = select(s.active, s.y, lastY);
+                lastZ = select(s.active, s.z, lastZ);
+                return andNot(s.active, surface);
+            });
+            for (int l = 0; l < packet.count; l++) {
+                if (!packet.frontEdge[l] && !packet.backEdge[l] && colors[l] == black) {
+                    colors[l] = p.background;
+                } else if (p.showBox && packet.backEdge[l] && colors[l] == black) {
+                    colors[l] = yellow;
+                }
+            }
+            break;
+        }
+        case 3: { // volume visualization with transfer function, composited front to back in all lanes at once
+            const Lanes tNear = load(packet.tNear);
+            Lanes front = sampler.values(tNear * load(packet.dx) + set1(o.x), tNear * load(packet.dy) + set1(o.y),
+                                         tNear * load(packet.dz) + set1(o.z),
+                                         maskBits(lessEqual(tNear, load(packet.tFar))));
+            Lanes accR = set1(0.0f);
+            Lanes accG = set1(0.0f);
+            Lanes accB = set1(0.0f);
+            Lanes accA = set1(0.0f);
+            auto tfSize = static_cast<float>(p.tf.size() / 4);
+            marchPacket(packet, o, p, true, [&](const PacketStep& s) {
+                int bits = maskBits(s.active);
+                Lanes back = sampler.values(s.x, s.y, s.z, bits);
+
+                // Classification needs table lookups and pow() per lane, opacities are corrected for the actual
+                // length of every segment like in the shader.
+                alignas(32) float lane[3][packetSize];
+                alignas(32) float segment[4][packetSize] = {};
+                store(lane[0], front);
+                store(lane[1], back);
+                store(lane[2], s.length);
+                for (int l = 0; l < packetSize; l++) {
+                    if ((bits & (1 << l)) == 0) {
+                        continue;
+                    }
+                    glm::vec4 c;
+                    if (preInt != nullptr) {
+                        c = preInt->lookup(lane[0][l], lane[1][l]);
+                        if (lane[2][l] < p.stepSize && c.a > 0.0f) {
+                            float alpha = 1.0f - std::pow(1.0f - std::min(c.a, 0.9999f), lane[2][l] / p.stepSize);
+                            c *= alpha / c.a;
+                        }
+                    } else {
+                        c = tfLookup(p.tf, std::clamp(lane[1][l], 0.0f, 1.0f) * (tfSize - 1.0f));
+                        float alpha = 1.0f - std::pow(1.0f - std::clamp(c.a, 0.0f, 1.0f), lane[2][l] / p.refStep);
+                        c = glm::vec4(glm::vec3(c) * alpha, alpha);
+                    }
+                    segment[0][l] = c.r;
+                    segment[1][l] = c.g;
+                    segment[2][l] = c.b;
+                    segment[3][l] = c.a;
+                }
+
+                // Inactive lanes have an empty segment and keep their color.
+                Lanes transmittance = set1(1.0f) - accA;
+                accR = accR + transmittance * load(segment[0]);
+                accG = accG + transmittance * load(segment[1]);
+                accB = accB + transmittance * load(segment[2]);
+                accA = accA + transmittance * load(segment[3]);
+                front = select(s.active, back, front);
+                return s.active & lessEqual(accA, set1(0.99f));
+            });
+            alignas(32) float acc[4][packetSize];
+            store(acc[0], accR);
+            store(acc[1], accG);
+            store(acc[2], accB);
+            store(acc[3], accA);
+            for (int l = 0; l < packet.count; l++) {
+                colors[l] = glm::vec3(acc[0][l], acc[1][l], acc[2][l]) + (1.0f - acc[3][l]) * p.background;
+            }
+            break;
+        }
+        default:
+            for (int l = 0; l < packet.count; l++) {
+                colors[l] = glm::vec3(1.0f, 0.0f, 0.0f);
+            }
+            break;
+    }
+
+    for (int l = 0; l < packet.count; l++) {
+        if (!packet.hit[l]) {
+            colors[l] = p.background;
+        } else if (p.showBox && packet.frontEdge[l]) {
+            colors[l] = yellow;
+        }
+    }
+}
+
+/**
+ * @brief CpuRaycaster constructor.
+ * @param data         The mapped voxels
+ * @param type         Type of the voxels
+ * @param res          Volume resolution
+ */
+CpuRaycaster::CpuRaycaster(std::shared_ptr<MappedFile> data, VoxelType type, const glm::uvec3& res)
+    : data(std::move(data)),
+      voxelType(type),
+      res(res) {}
+
+/**
+ * @brief Render an image. Blocks until done, the raycaster may be used from several threads at once.
+ * @param params       The parameters
+ * @param width        Image width
+ * @param height       Image height
+ * @param numThreads   Number of threads, 0 uses all cores
+ * @return the image
+ */
+CpuRaycaster::Image CpuRaycaster::render(const Params& params, int width, int height, unsigned int numThreads) const {
+    auto start = std::chrono::steady_clock::now();
+    numThreads = workerCount(numThreads);
+
+    Image image;
+    image.width = std::max(width, 0);
+    image.height = std::max(height, 0);
+    image.rgba.assign(static_cast<std::size_t>(image.width) * image.height * 4, 0);
+    if (image.rgba.empty() || data == nullptr || res.x == 0 || res.y == 0 || res.z == 0) {
+        return image;
+    }
+
+    switch (voxelType) {
+        case VoxelType::UInt8:
+            renderTiles<std::uint8_t>(params, image, numThreads);
+            break;
+        case VoxelType::UInt16:
+            renderTiles<std::uint16_t>(params, image, numThreads);
+            break;
+        case VoxelType::Float32:
+            renderTiles<float>(params, image, numThreads);
+            break;
+    }
+    image.renderMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return image;
+}
+
+/**
+ * @brief Trace all tiles of the image.
+ * @tparam T           The voxel type
+ * @param params       The parameters
+ * @param image        Target image of the final size
+ * @param numThreads   Number of threads
+ */
+template<typename T>
+void CpuRaycaster::renderTiles(const Params& params, Image& image, unsigned int numThreads) const {
+    VoxelSampler<T> sampler(reinterpret_cast<const T*>(data->data()), res, params.volumeDim, params.valueRange);
+
+    std::unique_ptr<PreIntTable> preInt;
+    if (params.viewMode == 3 && params.preIntegration && params.tf.size() >= 8) {
+        preInt = std::make_unique<PreIntTable>(params.tf, params.stepSize / params.refStep,
+                                               params.preIntMaxSize, numThreads);
+    }
+
+    glm::vec3 o(params.invViewMx * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+    glm::vec3 boxMax = 0.5f * params.volumeDim;
+    int tilesX = (image.width + tileSize - 1) / tileSize;
+    int tilesY = (image.height + tileSize - 1) / tileSize;
+
+    parallelFor(tilesX * tilesY, numThreads, [&](int tile) {
+        int x0 = (tile % tilesX) * tileSize;
+        int y0 = (tile / tilesX) * tileSize;
+        int x1 = std::min(x0 + tileSize, image.width);
+        int y1 = std::min(y0 + tileSize, image.height);
+        RayPacket packet;
+        glm::vec3 colors[packetSize];
+        for (int y = y0; y < y1; y++) {
+            float ndcY = 2.0f * ((static_cast<float>(y) + 0.5f) / static_cast<float>(image.height)) - 1.0f;
+            for (int x = x0; x < x1; x += packetSize) {
+                packet.count = std::min(packetSize, x1 - x);
+                for (int l = 0; l < packet.count; l++) {
+                    float ndcX = 2.0f * ((static_cast<float>(x + l) + 0.5f) / static_cast<float>(image.width)) - 1.0f;
+                    glm::vec4 clipPos(ndcX, ndcY, -1.0f, 1.0f);
+                    glm::vec3 d = glm::normalize(glm::vec3(params.invViewProjMx * clipPos) - o);
+                    packet.dx[l] = d.x;
+                    packet.dy[l] = d.y;
+                    packet.dz[l] = d.z;
+                    packet.hit[l] = intersectBox(o, d, -boxMax, boxMax, packet.tNear[l], packet.tFar[l]);
+                    packet.frontEdge[l] = packet.hit[l] && isBoxEdge(packet.tNear[l] * d + o, params.volumeDim);
+                    packet.backEdge[l] = packet.hit[l] && isBoxEdge(packet.tFar[l] * d + o, params.volumeDim);
+                }
+                for (int l = 0; l < packetSize; l++) {
+                    if (l >= packet.count || !packet.hit[l]) {
+                        packet.hit[l] = false;
+                        packet.tNear[l] = 0.0f;
+                        packet.tFar[l] = -1.0f;
+                    }
+                }
+
+                tracePacket(sampler, preInt.get(), params, packet, o, colors);
+
+                std::uint8_t* dst = &image.rgba[(static_cast<std::size_t>(y) * image.width + x) * 4];
+                for (int l = 0; l < packet.count; l++) {
+                    glm::vec3 c = glm::clamp(colors[l], 0.0f, 1.0f) * 255.0f + glm::vec3(0.5f);
+                    dst[4 * l] = static_cast<std::uint8_t>(c.r);
+                    dst[4 * l + 1] = static_cast<std::uint8_t>(c.g);
+                    dst[4 * l + 2] = static_cast<std::uint8_t>(c.b);
+                    dst[4 * l + 3] = 255;
+                }
+            }
+        }
+    });
+}
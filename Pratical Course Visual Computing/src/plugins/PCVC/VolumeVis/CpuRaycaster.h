@@ -0,0 +1,73 @@
+#ifndef OGL4CORE2_PLUGINS_PCVC_VOLUMEVIS_CPURAYCASTER_H
+#define OGL4CORE2_PLUGINS_PCVC_VOLUMEVIS_CPURAYCASTER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "VolumeLoader.h"
+
+namespace OGL4Core2::Plugins::PCVC::VolumeVis {
+
+    /**
+     * Raycaster on the CPU, implementing the same view modes as volume.frag on the mapped voxels. Rays are traced
+     * in packets of eight neighboring pixels, one per SSE2 or AVX2 lane, the image is split into tiles which are
+     * handed out to all cores.
+     * Without random offset and sub-pixel jitter the result matches the shader up to the filtering precision of
+     * the GPU, so it serves as reference for the shader and renders images without an OpenGL context.
+     */
+    class CpuRaycaster {
+    public:
+        /**
+         * Everything the shader gets as uniforms.
+         */
+        struct Params {
+            glm::mat4 invViewMx;       //!< inverse view matrix
+            glm::mat4 invViewProjMx;   //!< inverse view-projection matrix
+            glm::vec3 volumeDim;       //!< volume dimensions
+            glm::vec2 valueRange;      //!< minimum and maximum voxel value as returned by the sampler
+            int viewMode;              //!< 0: line-of-sight, 1: mip, 2: isosurface, 3: volume
+            bool showBox;              //!< draw the box edges
+            int maxSteps;              //!< maximum number of steps
+            float stepSize;            //!< step size
+            float scale;               //!< scaling factor of the line-of-sight
+            float isoValue;            //!< value of the isosurface
+            glm::vec3 ambient;         //!< ambient color
+            glm::vec3 diffuse;         //!< diffuse color
+            glm::vec3 specular;        //!< specular color
+            glm::vec4 k;               //!< ambient, diffuse and specular factor, specular exponent
+            glm::vec3 background;      //!< color behind the volume
+            std::vector<float> tf;     //!< transfer function values (r,g,b,a)
+            bool preIntegration;       //!< classify ray segments instead of single samples
+            float refStep;             //!< length of the step the transfer function opacities refer to
+            std::size_t preIntMaxSize; //!< maximum resolution of the pre-integration table
+        };
+
+        /**
+         * RGBA8 image, rows from bottom to top like glReadPixels returns them.
+         */
+        struct Image {
+            int width = 0;
+            int height = 0;
+            std::vector<std::uint8_t> rgba;
+            double renderMs = 0.0; //!< wall clock time of render()
+        };
+
+        CpuRaycaster(std::shared_ptr<MappedFile> data, VoxelType type, const glm::uvec3& res);
+
+        [[nodiscard]] Image render(const Params& params, int width, int height, unsigned int numThreads = 0) const;
+
+    private:
+        template<typename T>
+        void renderTiles(const Params& params, Image& image, unsigned int numThreads) const;
+
+        std::shared_ptr<MappedFile> data; //!< mapped voxels, kept alive while rendering
+        VoxelType voxelType;              //!< type of the voxels
+        glm::uvec3 res;                   //!< volume resolution
+    };
+} // namespace OGL4Core2::Plugins::PCVC::VolumeVis
+
+#endif // OGL4CORE2_PLUGINS_PCVC_VOLUMEVIS_CPURAYCASTER_H
@@ -0,0 +1,413 @@
+#include "IsoSurfaceExtractor.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <numeric>
+#include <unordered_map>
+
+#include "Parallel.h"
+
+using namespace OGL4Core2::Plugins::PCVC::VolumeVis;
+
+/**
+ * Corners of the cube edges. Corner i lies at (i & 1, (i >> 1) & 1, (i >> 2) & 1), edge e runs along axis e / 4
+ * and starts at its lower corner.
+ */
+static constexpr int edgeCorners[12][2] = {{0, 1}, {2, 3}, {4, 5}, {6, 7}, {0, 2}, {1, 3},
+                                           {4, 6}, {5, 7}, {0, 4}, {1, 5}, {2, 6}, {3, 7}};
+
+/**
+ * Triangles of the 256 corner configurations as triples of cube edges. A corner is inside if its value is larger
+ * than the isovalue.
+ */
+struct CaseTable {
+    std::array<std::vector<std::uint8_t>, 256> triangles;
+};
+
+static glm::vec3 cornerPos(int corner) {
+    return glm::vec3(static_cast<float>(corner & 1), static_cast<float>((corner >> 1) & 1),
+                     static_cast<float>((corner >> 2) & 1));
+}
+
+static int cubeEdge(int a, int b) {
+    for (int e = 0; e < 12; e++) {
+        if ((edgeCorners[e][0] == a && edgeCorners[e][1] == b) || (edgeCorners[e][0] == b && edgeCorners[e][1] == a)) {
+            return e;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Test if two cube edges lie on a common face.
+ */
+static bool shareFace(int e0, int e1) {
+    for (int axis = 0; axis < 3; axis++) {
+        if (axis == e0 / 4 || axis == e1 / 4) {
+            continue;
+        }
+        if (((edgeCorners[e0][0] >> axis) & 1) == ((edgeCorners[e1][0] >> axis) & 1)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Build the case table instead of spelling it out. On every cube face the crossed edges are connected by
+ * segments, on faces with two diagonal inside corners the inside corners are cut off. As this decision only
+ * depends on the face, neighboring cells agree on it and the surface has no cracks. The segments are chained to
+ * loops, oriented to face the outside corners and triangulated as fans. The apex of a fan is chosen such that no
+ * diagonal runs along a cube face, the neighboring cell could use the same diagonal otherwise.
+ */
+static CaseTable buildCaseTable() {
+    CaseTable table;
+    static constexpr int faceUV[4][2] = {{0, 0}, {1, 0}, {1, 1}, {0, 1}};
+    for (int c = 1; c < 255; c++) {
+        auto inside = [c](int corner) { return ((c >> corner) & 1) != 0; };
+
+        std::vector<std::array<int, 2>> segments;
+        for (int axis = 0; axis < 3; axis++) {
+            for (int side = 0; side < 2; side++) {
+                int corners[4];
+                int edges[4];
+                int crossed[4];
+                int numCrossed = 0;
+                for (int k = 0; k < 4; k++) {
+                    corners[k] = (side << axis) | (faceUV[k][0] << ((axis + 1) % 3)) |
+                                 (faceUV[k][1] << ((axis + 2) % 3));
+                }
+                for (int k = 0; k < 4; k++) {
+                    edges[k] = cubeEdge(corners[k], corners[(k + 1) % 4]);
+                    if (inside(corners[k]) != inside(corners[(k + 1) % 4])) {
+                        crossed[numCrossed++] = edges[k];
+                    }
+                }
+                if (numCrossed == 2) {
+                    segments.push_back({crossed[0], crossed[1]});
+                } else if (numCrossed == 4) {
+                    for (int k = 0; k < 4; k++) {
+                        if (inside(corners[k])) {
+                            segments.push_back({edges[(k + 3) % 4], edges[k]});
+                        }
+                    }
+                }
+            }
+        }
+
+        // Every crossed edge lies on two faces, so it is shared by exactly two segments.
+        std::vector<bool> used(segments.size(), false);
+        for (std::size_t s = 0; s < segments.size(); s++) {
+            if (used[s]) {
+                continue;
+            }
+            used[s] = true;
+            std::vector<int> loop{segments[s][0]};
+            int next = segments[s][1];
+            while (next != loop.front()) {
+                loop.push_back(next);
+                for (std::size_t t = 0; t < segments.size(); t++) {
+                    if (!used[t] && (segments[t][0] == next || segments[t][1] == next)) {
+                        used[t] = true;
+                        next = segments[t][0] == next ? segments[t][1] : segments[t][0];
+                        break;
+                    }
+                }
+            }
+
+            // Newell normal of the loop through the edge midpoints, compared to the inside-outside directions.
+            auto mid = [](int e) { return 0.5f * (cornerPos(edgeCorners[e][0]) + cornerPos(edgeCorners[e][1])); };
+            glm::vec3 normal(0.0f);
+            float score = 0.0f;
+            for (std::size_t i = 0; i < loop.size(); i++) {
+                normal += glm::cross(mid(loop[i]), mid(loop[(i + 1) % loop.size()]));
+            }
+            for (int e : loop) {
+                glm::vec3 dir = cornerPos(edgeCorners[e][1]) - cornerPos(edgeCorners[e][0]);
+                score += inside(edgeCorners[e][0]) ? glm::dot(normal, dir) : -glm::dot(normal, dir);
+            }
+            if (score < 0.0f) {
+                std::reverse(loop.begin(), loop.end());
+            }
+            std::size_t n = loop.size();
+            std::size_t apex = 0;
+            for (std::size_t a = 0; a < n; a++) {
+                bool valid = true;
+                for (std::size_t i = 2; i + 1 < n; i++) {
+                    valid = valid && !shareFace(loop[a], loop[(a + i) % n]);
+                }
+                if (valid) {
+                    apex = a;
+                    break;
+                }
+            }
+            for (std::size_t i = 1; i + 1 < n; i++) {
+                table.triangles[c].push_back(static_cast<std::uint8_t>(loop[apex]));
+                table.triangles[c].push_back(static_cast<std::uint8_t>(loop[(apex + i) % n]));
+                table.triangles[c].push_back(static_cast<std::uint8_t>(loop[(apex + i + 1) % n]));
+            }
+        }
+    }
+    return table;
+}
+
+static const CaseTable& caseTable() {
+    static const CaseTable table = buildCaseTable();
+    return table;
+}
+
+/**
+ * Normalized access to the voxels.
+ */
+template<typename T>
+class VoxelGrid {
+public:
+    VoxelGrid(const T* voxels, const glm::uvec3& res, const glm::vec2& valueRange)
+        : voxels(voxels),
+          res(res),
+          valueOffset(valueRange.x / (valueRange.y - valueRange.x)),
+          valueScale(VoxelFormat<T>::normalization / (valueRange.y - valueRange.x)) {}
+
+    [[nodiscard]] std::size_t index(unsigned int x, unsigned int y, unsigned int z) const {
+        return (static_cast<std::size_t>(z) * res.y + y) * res.x + x;
+    }
+
+    [[nodiscard]] float value(unsigned int x, unsigned int y, unsigned int z) const {
+        return static_cast<float>(voxels[index(x, y, z)]) * valueScale - valueOffset;
+    }
+
+    /**
+     * Central differences in voxel units, one-sided at the border.
+     */
+    [[nodiscard]] glm::vec3 gradient(unsigned int x, unsigned int y, unsigned int z) const {
+        return glm::vec3(value(std::min(x + 1, res.x - 1), y, z) - value(x > 0 ? x - 1 : 0, y, z),
+                         value(x, std::min(y + 1, res.y - 1), z) - value(x, y > 0 ? y - 1 : 0, z),
+                         value(x, y, std::min(z + 1, res.z - 1)) - value(x, y, z > 0 ? z - 1 : 0));
+    }
+
+private:
+    const T* voxels;
+    glm::uvec3 res;
+    float valueOffset;
+    float valueScale;
+};
+
+/**
+ * @brief IsoSurfaceExtractor constructor. The brick ranges are computed by the first extraction.
+ * @param data         The mapped voxels
+ * @param type         Type of the voxels
+ * @param res          Volume resolution
+ * @param volumeDim    Volume dimensions
+ * @param valueRange   Minimum and maximum voxel value as returned by the sampler
+ */
+IsoSurfaceExtractor::IsoSurfaceExtractor(std::shared_ptr<MappedFile> data, VoxelType type, const glm::uvec3& res,
+                                         const glm::vec3& volumeDim, const glm::vec2& valueRange)
+    : data(std::move(data)),
+      voxelType(type),
+      res(res),
+      volumeDim(volumeDim),
+      valueRange(valueRange),
+      numBricks(glm::uvec3(0)) {}
+
+/**
+ * @brief Extract the isosurface. Blocks until done, run it on a worker thread for large volumes.
+ * @param isoValue     Normalized isovalue
+ * @param cancel       Aborts the extraction once set, may be nullptr. The mesh is incomplete then.
+ * @param numThreads   Number of threads, 0 uses all cores
+ * @return the mesh
+ */
+IsoMesh IsoSurfaceExtractor::extract(float isoValue, const std::atomic<bool>* cancel, unsigned int numThreads) {
+    auto start = std::chrono::steady_clock::now();
+    numThreads = workerCount(numThreads);
+
+    IsoMesh mesh;
+    mesh.isoValue = isoValue;
+    if (data == nullptr || res.x < 2 || res.y < 2 || res.z < 2) {
+        return mesh;
+    }
+
+    if (brickMin.empty()) {
+        switch (voxelType) {
+            case VoxelType::UInt8:
+                computeBricks<std::uint8_t>(numThreads);
+                break;
+            case VoxelType::UInt16:
+                computeBricks<std::uint16_t>(numThreads);
+                break;
+            case VoxelType::Float32:
+                computeBricks<float>(numThreads);
+                break;
+        }
+    }
+
+    // A brick contains a part of the surface if some voxel is inside and some is not.
+    std::vector<std::size_t> bricks;
+    for (std::size_t b = 0; b < brickMin.size(); b++) {
+        if (brickMax[b] > isoValue && brickMin[b] <= isoValue) {
+            bricks.push_back(b);
+        }
+    }
+    mesh.numBricks = brickMin.size();
+    mesh.activeBricks = bricks.size();
+
+    switch (voxelType) {
+        case VoxelType::UInt8:
+            extractBricks<std::uint8_t>(isoValue, bricks, cancel, numThreads, mesh);
+            break;
+        case VoxelType::UInt16:
+            extractBricks<std::uint16_t>(isoValue, bricks, cancel, numThreads, mesh);
+            break;
+        case VoxelType::Float32:
+            extractBricks<float>(isoValue, bricks, cancel, numThreads, mesh);
+            break;
+    }
+    mesh.cancelled = cancel != nullptr && cancel->load();
+    mesh.extractMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return mesh;
+}
+
+/**
+ * @brief Compute the value range of all bricks, including the voxels on their far faces.
+ * @tparam T           The voxel type
+ * @param numThreads   Number of threads
+ */
+template<typename T>
+void IsoSurfaceExtractor::computeBricks(unsigned int numThreads) {
+    VoxelGrid<T> grid(reinterpret_cast<const T*>(data->data()), res, valueRange);
+    glm::uvec3 numCells = res - glm::uvec3(1);
+    numBricks = (numCells + glm::uvec3(brickCells - 1)) / brickCells;
+    std::size_t count = static_cast<std::size_t>(numBricks.x) * numBricks.y * numBricks.z;
+    brickMin.assign(count, 0.0f);
+    brickMax.assign(count, 0.0f);
+
+    parallelFor(static_cast<int>(count), numThreads, [&](int b) {
+        glm::uvec3 brick(b % numBricks.x, (b / numBricks.x) % numBricks.y, b / (numBricks.x * numBricks.y));
+        glm::uvec3 first = brick * brickCells;
+        glm::uvec3 last = glm::min(first + glm::uvec3(brickCells), numCells);
+        float lo = grid.value(first.x, first.y, first.z);
+        float hi = lo;
+        for (unsigned int z = first.z; z <= last.z; z++) {
+            for (unsigned int y = first.y; y <= last.y; y++) {
+                for (unsigned int x = first.x; x <= last.x; x++) {
+                    float v = grid.value(x, y, z);
+                    lo = std::min(lo, v);
+                    hi = std::max(hi, v);
+                }
+            }
+        }
+        brickMin[b] = lo;
+        brickMax[b] = hi;
+    });
+}
+
+/**
+ * @brief Run marching cubes on the given bricks and weld the vertices of all bricks.
+ * @tparam T           The voxel type
+ * @param isoValue     Normalized isovalue
+ * @param bricks       Indices of the bricks to visit
+ * @param cancel       Stops handing out bricks once set, may be nullptr
+ * @param numThreads   Number of threads
+ * @param mesh         Receives the vertices and triangles
+ */
+template<typename T>
+void IsoSurfaceExtractor::extractBricks(float isoValue, const std::vector<std::size_t>& bricks,
+                                        const std::atomic<bool>* cancel, unsigned int numThreads,
+                                        IsoMesh& mesh) const {
+    VoxelGrid<T> grid(reinterpret_cast<const T*>(data->data()), res, valueRange);
+    const CaseTable& table = caseTable();
+    glm::uvec3 numCells = res - glm::uvec3(1);
+    glm::vec3 voxelSize = volumeDim / glm::vec3(res);
+    glm::vec3 origin = -0.5f * volumeDim + 0.5f * voxelSize;
+
+    // Vertices are identified by their cell edge: index of the lower voxel times 3 plus the axis.
+    struct BrickMesh {
+        std::vector<std::uint64_t> keys;
+        std::vector<glm::vec3> positions;
+        std::vector<glm::vec3> normals;
+        std::vector<std::uint32_t> indices;
+    };
+    std::vector<BrickMesh> brickMeshes(bricks.size());
+
+    parallelFor(static_cast<int>(bricks.size()), numThreads, [&](int i) {
+        if (cancel != nullptr && cancel->load(std::memory_order_relaxed)) {
+            return;
+        }
+        std::size_t b = bricks[i];
+        glm::uvec3 brick(b % numBricks.x, (b / numBricks.x) % numBricks.y, b / (numBricks.x * numBricks.y));
+        glm::uvec3 first = brick * brickCells;
+        glm::uvec3 last = glm::min(first + glm::uvec3(brickCells), numCells);
+
+        BrickMesh& out = brickMeshes[i];
+        std::unordered_map<std::uint64_t, std::uint32_t> edgeVertices;
+        float values[8];
+        glm::uvec3 voxels[8];
+        for (unsigned int z = first.z; z < last.z; z++) {
+            for (unsigned int y = first.y; y < last.y; y++) {
+                for (unsigned int x = first.x; x < last.x; x++) {
+                    int c = 0;
+                    for (int k = 0; k < 8; k++) {
+                        voxels[k] = glm::uvec3(x + (k & 1), y + ((k >> 1) & 1), z + ((k >> 2) & 1));
+                        values[k] = grid.value(voxels[k].x, voxels[k].y, voxels[k].z);
+                        c |= values[k] > isoValue ? 1 << k : 0;
+                    }
+                    for (std::uint8_t e : table.triangles[c]) {
+                        int a = edgeCorners[e][0];
+                        int d = edgeCorners[e][1];
+                        std::uint64_t key = grid.index(voxels[a].x, voxels[a].y, voxels[a].z) * 3 + e / 4;
+                        auto it = edgeVertices.find(key);
+                        if (it == edgeVertices.end()) {
+                            float t = (isoValue - values[a]) / (values[d] - values[a]);
+                            glm::vec3 posA = origin + glm::vec3(voxels[a]) * voxelSize;
+                            glm::vec3 posD = origin + glm::vec3(voxels[d]) * voxelSize;
+                            glm::vec3 gradient = glm::mix(grid.gradient(voxels[a].x, voxels[a].y, voxels[a].z),
+                                                          grid.gradient(voxels[d].x, voxels[d].y, voxels[d].z), t);
+                            float len = glm::length(gradient);
+                            // The normal faces the lower values, along the edge if the gradient vanishes.
+                            glm::vec3 normal = len > 0.0f ? -gradient / len
+                                                          : (values[a] > isoValue ? posD - posA : posA - posD) /
+                                                                glm::length(posD - posA);
+                            it = edgeVertices.emplace(key, static_cast<std::uint32_t>(out.keys.size())).first;
+                            out.keys.push_back(key);
+                            out.positions.push_back(glm::mix(posA, posD, t));
+                            out.normals.push_back(normal);
+                        }
+                        out.indices.push_back(it->second);
+                    }
+                }
+            }
+        }
+    });
+
+    // Weld the vertices on the brick faces. Sorting by key also orders the vertices spatially.
+    std::vector<std::size_t> offsets(brickMeshes.size() + 1, 0);
+    for (std::size_t i = 0; i < brickMeshes.size(); i++) {
+        offsets[i + 1] = offsets[i] + brickMeshes[i].keys.size();
+    }
+    std::vector<std::uint64_t> keys(offsets.back());
+    for (std::size_t i = 0; i < brickMeshes.size(); i++) {
+        std::copy(brickMeshes[i].keys.begin(), brickMeshes[i].keys.end(), keys.begin() + offsets[i]);
+    }
+    std::vector<std::uint32_t> order(keys.size());
+    std::iota(order.begin(), order.end(), 0u);
+    std::sort(order.begin(), order.end(), [&keys](std::uint32_t a, std::uint32_t b) { return keys[a] < keys[b]; });
+
+    std::vector<std::uint32_t> remap(keys.size());
+    std::size_t brick = 0;
+    for (std::size_t i = 0; i < order.size(); i++) {
+        std::uint32_t v = order[i];
+        if (i == 0 || keys[v] != keys[order[i - 1]]) {
+            brick = static_cast<std::size_t>(std::upper_bound(offsets.begin(), offsets.end(), v) - offsets.begin()) - 1;
+            const glm::vec3& p = brickMeshes[brick].positions[v - offsets[brick]];
+            const glm::vec3& n = brickMeshes[brick].normals[v - offsets[brick]];
+            mesh.positions.insert(mesh.positions.end(), {p.x, p.y, p.z});
+            mesh.normals.insert(mesh.normals.end(), {n.x, n.y, n.z});
+        }
+        remap[v] = static_cast<std::uint32_t>(mesh.positions.size() / 3 - 1);
+    }
+    for (std::size_t i = 0; i < brickMeshes.size(); i++) {
+        for (std::uint32_t idx : brickMeshes[i].indices) {
+            mesh.indices.push_back(remap[offsets[i] + idx]);
+        }
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef OGL4CORE2_PLUGINS_PCVC_VOLUMEVIS_ISOSURFACEEXTRACTOR_H
+#define OGL4CORE2_PLUGINS_PCVC_VOLUMEVIS_ISOSURFACEEXTRACTOR_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "VolumeLoader.h"
+
+namespace OGL4Core2::Plugins::PCVC::VolumeVis {
+
+    /**
+     * Triangle mesh of an isosurface in world coordinates. Triangles are counterclockwise seen from the side of
+     * the lower values, the normals point there as well.
+     */
+    struct IsoMesh {
+        float isoValue = 0.0f;              //!< normalized isovalue the mesh was extracted for
+        std::vector<float> positions;       //!< vertex positions (x,y,z)
+        std::vector<float> normals;         //!< vertex normals (x,y,z)
+        std::vector<std::uint32_t> indices; //!< three indices per triangle
+        std::size_t numBricks = 0;          //!< number of bricks of the volume
+        std::size_t activeBricks = 0;       //!< number of bricks the isovalue lies in
+        double extractMs = 0.0;             //!< wall clock time of the extraction
+        bool cancelled = false;             //!< the extraction was stopped, the mesh is incomplete
+    };
+
+    /**
+     * Multithreaded marching cubes on the mapped voxels. The cells between the voxel centers are grouped into
+     * bricks, whose value range is computed once on the first extraction. Only bricks containing the isovalue
+     * are visited, in parallel, and vertices on shared cell edges are welded. Values are normalized to the value
+     * range like sampleVolume() in volume.frag, so the isovalue of the raycaster applies directly.
+     * Extractions must not run concurrently on one instance.
+     */
+    class IsoSurfaceExtractor {
+    public:
+        static constexpr unsigned int brickCells = 8; //!< edge length of a brick in cells
+
+        IsoSurfaceExtractor(std::shared_ptr<MappedFile> data, VoxelType type, const glm::uvec3& res,
+                            const glm::vec3& volumeDim, const glm::vec2& valueRange);
+
+        IsoMesh extract(float isoValue, const std::atomic<bool>* cancel = nullptr, unsigned int numThreads = 0);
+
+    private:
+        template<typename T>
+        void computeBricks(unsigned int numThreads);
+
+        template<typename T>
+        void extractBricks(float isoValue, const std::vector<std::size_t>& bricks, const std::atomic<bool>* cancel,
+                           unsigned int numThreads, IsoMesh& mesh) const;
+
+        std::shared_ptr<MappedFile> data; //!< mapped voxels
+        VoxelType voxelType;              //!< type of the voxels
+        glm::uvec3 res;                   //!< volume resolution
+        glm::vec3 volumeDim;              //!< volume dimensions
+        glm::vec2 valueRange;             //!< minimum and maximum voxel value as returned by the sampler
+
+        glm::uvec3 numBricks;        //!< number of bricks per axis
+        std::vector<float> brickMin; //!< smallest normalized value of the voxels of each brick
+        std::vector<float> brickMax; //!< largest normalized value of the voxels of each brick
+    };
+} // namespace OGL4Core2::Plugins::PCVC::VolumeVis
+
+#endif // OGL4CORE2_PLUGINS_PCVC_VOLUMEVIS_ISOSURFACEEXTRACTOR_H
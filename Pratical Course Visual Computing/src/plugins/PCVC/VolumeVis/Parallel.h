@@ -0,0 +1,47 @@
+#ifndef OGL4CORE2_PLUGINS_PCVC_VOLUMEVIS_PARALLEL_H
+#define OGL4CORE2_PLUGINS_PCVC_VOLUMEVIS_PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace OGL4Core2::Plugins::PCVC::VolumeVis {
+
+    /**
+     * Number of worker threads for the CPU passes.
+     * @param numThreads   Requested number, 0 uses all cores
+     */
+    inline unsigned int workerCount(unsigned int numThreads) {
+        return numThreads > 0 ? numThreads : std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    /**
+     * Run func(index) for all indices of [0, count) on numWorkers threads, the calling thread being one of them.
+     * The indices are handed out dynamically, so work items of different cost are balanced.
+     * @param count        Number of indices
+     * @param numWorkers   Number of threads
+     * @param func         The kernel
+     */
+    template<typename F>
+    void parallelFor(int count, unsigned int numWorkers, F&& func) {
+        std::atomic<int> next(0);
+        auto worker = [&]() {
+            for (int i = next.fetch_add(1, std::memory_order_relaxed); i < count;
+                 i = next.fetch_add(1, std::memory_order_relaxed)) {
+                func(i);
+            }
+        };
+        numWorkers = std::min(numWorkers, static_cast<unsigned int>(std::max(count, 1)));
+        std::vector<std::thread> threads;
+        for (unsigned int w = 1; w < numWorkers; w++) {
+            threads.emplace_back(worker);
+        }
+        worker();
+        for (auto& t : threads) {
+            t.join();
+        }
+    }
+} // namespace OGL4Core2::Plugins::PCVC::VolumeVis
+
+#endif // OGL4CORE2_PLUGINS_PCVC_VOLUMEVIS_PARALLEL_H
@@ -0,0 +1,142 @@
+#include "RaycastBenchmark.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <numeric>
+#include <stdexcept>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+using namespace OGL4Core2::Plugins::PCVC::VolumeVis;
+
+static constexpr const char* viewModeNames[] = {"LineOfSight", "Mip", "Isosurface", "Volume"};
+
+/**
+ * Quote a string for JSON.
+ */
+static std::string jsonString(const std::string& str) {
+    std::string quoted = "\"";
+    for (char c : str) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+        }
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+/**
+ * @brief RaycastBenchmark constructor, creates all combinations of the given parameters.
+ * @param volumeNames      Names of the volume files, one sweep per volume
+ * @param viewModes        Raycaster modes
+ * @param stepSizes        Step sizes along the rays
+ * @param maxSteps         Maximum numbers of steps
+ * @param resolutions      Sizes of the render target
+ * @param numOrbitSteps    Camera positions around the volume per case
+ */
+RaycastBenchmark::RaycastBenchmark(std::vector<std::string> volumeNames, const std::vector<int>& viewModes,
+                                   const std::vector<float>& stepSizes, const std::vector<int>& maxSteps,
+                                   const std::vector<glm::ivec2>& resolutions, int numOrbitSteps)
+    : volumeNames(std::move(volumeNames)),
+      orbitSteps(std::max(1, numOrbitSteps)) {
+    for (std::size_t v = 0; v < this->volumeNames.size(); v++) {
+        for (int mode : viewModes) {
+            for (float step : stepSizes) {
+                for (int steps : maxSteps) {
+                    for (const auto& res : resolutions) {
+                        cases.push_back({v, mode, step, steps, res});
+                    }
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief The sweep used by the GUI and by unattended runs: all modes, three step sizes, a step limit which
+ * truncates the rays and one which does not, and three resolutions.
+ * @param volumeNames      Names of the volume files
+ */
+RaycastBenchmark RaycastBenchmark::defaultSweep(std::vector<std::string> volumeNames) {
+    return RaycastBenchmark(std::move(volumeNames), {0, 1, 2, 3}, {0.01f, 0.005f, 0.0025f}, {200, 1000},
+                            {{256, 256}, {512, 512}, {1024, 1024}}, 8);
+}
+
+/**
+ * @brief View matrix of an orbit position. The camera circles the volume center slightly from above.
+ * @param step         The orbit position
+ * @param distance     Distance of the camera to the center
+ */
+glm::mat4 RaycastBenchmark::orbitViewMx(int step, float distance) const {
+    float azimuth = glm::radians(360.0f) * static_cast<float>(step) / static_cast<float>(orbitSteps);
+    float elevation = glm::radians(20.0f);
+    glm::vec3 eye = distance * glm::vec3(std::cos(elevation) * std::sin(azimuth), std::sin(elevation),
+                                         std::cos(elevation) * std::cos(azimuth));
+    return glm::lookAt(eye, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+}
+
+/**
+ * @brief Store the result of the current case and continue with the next one.
+ */
+void RaycastBenchmark::record(Result result) {
+    if (done()) {
+        throw std::logic_error("Benchmark is already done!");
+    }
+    results.push_back(std::move(result));
+}
+
+/**
+ * @brief Write the finished cases as JSON.
+ * @param filename     The output file
+ * @param renderer     The OpenGL renderer string
+ * @param features     Names and states of the features which influence the raycaster performance
+ */
+void RaycastBenchmark::write(const std::filesystem::path& filename, const std::string& renderer,
+                             const std::vector<std::pair<std::string, bool>>& features) const {
+    std::ofstream file(filename);
+    if (!file.is_open()) {
+        throw std::runtime_error("Cannot open file: " + filename.string());
+    }
+
+    file << "{\n";
+    file << "  \"renderer\": " << jsonString(renderer) << ",\n";
+    file << "  \"features\": {";
+    for (std::size_t i = 0; i < features.size(); i++) {
+        file << (i > 0 ? ", " : "") << jsonString(features[i].first) << ": "
+             << (features[i].second ? "true" : "false");
+    }
+    file << "},\n";
+    file << "  \"orbitSteps\": " << orbitSteps << ",\n";
+    file << "  \"cases\": [";
+    for (std::size_t i = 0; i < results.size(); i++) {
+        const Case& c = cases[i];
+        const Result& r = results[i];
+        std::vector<double> sorted = r.gpuMs;
+        std::sort(sorted.begin(), sorted.end());
+        double mean = sorted.empty() ? 0.0 : std::accumulate(sorted.begin(), sorted.end(), 0.0) / sorted.size();
+        double median = sorted.empty() ? 0.0 : sorted[sorted.size() / 2];
+        double minimum = sorted.empty() ? 0.0 : sorted.front();
+        double samplesPerPixel = r.numPixels > 0 ? static_cast<double>(r.numSamples) / r.numPixels : 0.0;
+
+        file << (i > 0 ? "," : "") << "\n    {";
+        file << "\"volume\": " << jsonString(volumeNames[c.volume]) << ", ";
+        file << "\"viewMode\": "
+             << jsonString(c.viewMode >= 0 && c.viewMode < 4 ? viewModeNames[c.viewMode] : std::to_string(c.viewMode))
+             << ", ";
+        file << "\"stepSize\": " << c.stepSize << ", ";
+        file << "\"maxSteps\": " << c.maxSteps << ", ";
+        file << "\"width\": " << c.resolution.x << ", ";
+        file << "\"height\": " << c.resolution.y << ", ";
+        file << "\"meanMs\": " << mean << ", ";
+        file << "\"medianMs\": " << median << ", ";
+        file << "\"minMs\": " << minimum << ", ";
+        file << "\"samplesPerPixel\": " << samplesPerPixel << ", ";
+        file << "\"gpuMs\": [";
+        for (std::size_t j = 0; j < r.gpuMs.size(); j++) {
+            file << (j > 0 ? ", " : "") << r.gpuMs[j];
+        }
+        file << "]}";
+    }
+    file << "\n  ]\n}\n";
+}
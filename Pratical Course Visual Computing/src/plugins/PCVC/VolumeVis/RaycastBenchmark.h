@@ -0,0 +1,71 @@
+#ifndef OGL4CORE2_PLUGINS_PCVC_VOLUMEVIS_RAYCASTBENCHMARK_H
+#define OGL4CORE2_PLUGINS_PCVC_VOLUMEVIS_RAYCASTBENCHMARK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+namespace OGL4Core2::Plugins::PCVC::VolumeVis {
+
+    /**
+     * Sweep of raycaster configurations for repeatable performance measurements. The benchmark only keeps the
+     * list of cases and their results, the plugin renders each case offscreen from all orbit positions, times
+     * the volume passes with timer queries and counts the volume samples per pixel. Cases are ordered by volume,
+     * so each volume is loaded once. The results are written as JSON together with the renderer and the
+     * features that were enabled, to compare runs with acceleration features on and off.
+     */
+    class RaycastBenchmark {
+    public:
+        /**
+         * One configuration of the sweep.
+         */
+        struct Case {
+            std::size_t volume;    //!< index of the volume file
+            int viewMode;          //!< raycaster mode, see VolumeVis::ViewMode
+            float stepSize;        //!< step size along the rays
+            int maxSteps;          //!< maximum number of steps
+            glm::ivec2 resolution; //!< size of the render target
+        };
+
+        /**
+         * Measurements of one case.
+         */
+        struct Result {
+            std::vector<double> gpuMs; //!< GPU time of the volume pass per orbit position
+            std::uint64_t numSamples;  //!< volume samples of all orbit positions
+            std::uint64_t numPixels;   //!< pixels of all orbit positions
+        };
+
+        RaycastBenchmark(std::vector<std::string> volumeNames, const std::vector<int>& viewModes,
+                         const std::vector<float>& stepSizes, const std::vector<int>& maxSteps,
+                         const std::vector<glm::ivec2>& resolutions, int numOrbitSteps);
+
+        static RaycastBenchmark defaultSweep(std::vector<std::string> volumeNames);
+
+        [[nodiscard]] bool done() const { return results.size() >= cases.size(); }
+        [[nodiscard]] const Case& current() const { return cases[results.size()]; }
+        [[nodiscard]] std::size_t numDone() const { return results.size(); }
+        [[nodiscard]] std::size_t numCases() const { return cases.size(); }
+        [[nodiscard]] int numOrbitSteps() const { return orbitSteps; }
+
+        [[nodiscard]] glm::mat4 orbitViewMx(int step, float distance) const;
+
+        void record(Result result);
+
+        void write(const std::filesystem::path& filename, const std::string& renderer,
+                   const std::vector<std::pair<std::string, bool>>& features) const;
+
+    private:
+        std::vector<std::string> volumeNames; //!< names of the volume files
+        std::vector<Case> cases;              //!< all configurations in the order they are run
+        std::vector<Result> results;          //!< results of the finished cases
+        int orbitSteps;                       //!< camera positions around the volume per case
+    };
+} // namespace OGL4Core2::Plugins::PCVC::VolumeVis
+
+#endif // OGL4CORE2_PLUGINS_PCVC_VOLUMEVIS_RAYCASTBENCHMARK_H
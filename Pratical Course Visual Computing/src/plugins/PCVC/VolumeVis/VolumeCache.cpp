@@ -0,0 +1,124 @@
+#include "VolumeCache.h"
+
+#include <algorithm>
+
+using namespace OGL4Core2::Plugins::PCVC::VolumeVis;
+
+/**
+ * @brief Texture memory of the volume and its gradients.
+ */
+std::size_t CachedVolume::gpuBytes() const {
+    std::size_t numVoxels = static_cast<std::size_t>(res.x) * res.y * res.z;
+    std::size_t bytes = 0;
+    if (compressed) {
+        bytes = compressionStats.compressedBytes;
+    } else {
+        switch (type) {
+            case VoxelType::UInt8:
+                bytes = numVoxels * sizeof(std::uint8_t);
+                break;
+            case VoxelType::UInt16:
+                bytes = numVoxels * sizeof(std::uint16_t);
+                break;
+            case VoxelType::Float32:
+                bytes = numVoxels * sizeof(float);
+                break;
+        }
+    }
+    if (gradientTex != 0) {
+        bytes += numVoxels * 4; // RGBA8
+    }
+    return bytes;
+}
+
+/**
+ * @brief VolumeCache constructor.
+ * @param budgetBytes  Texture memory the cached volumes may use
+ */
+VolumeCache::VolumeCache(std::size_t budgetBytes) : budgetBytes(budgetBytes), totalBytes(0) {}
+
+/**
+ * @brief VolumeCache destructor, deletes the textures of all cached volumes.
+ */
+VolumeCache::~VolumeCache() {
+    clear();
+}
+
+/**
+ * @brief Remove a volume from the cache, its textures are owned by the caller afterwards.
+ * @param file         The dat file
+ * @param compressed   Look for the compressed version of the volume
+ * @return the volume, std::nullopt if it is not cached
+ */
+std::optional<CachedVolume> VolumeCache::take(const std::filesystem::path& file, bool compressed) {
+    auto it = std::find_if(volumes.begin(), volumes.end(), [&](const CachedVolume& v) {
+        return v.file == file && v.compressed == compressed;
+    });
+    if (it == volumes.end()) {
+        return std::nullopt;
+    }
+    CachedVolume volume = std::move(*it);
+    volumes.erase(it);
+    totalBytes -= volume.gpuBytes();
+    return volume;
+}
+
+/**
+ * @brief Add a volume as the most recently used one and evict the oldest volumes beyond the budget. The cache
+ * owns the textures of the volume afterwards. A volume larger than the whole budget is deleted right away.
+ * @param volume       The volume
+ */
+void VolumeCache::put(CachedVolume volume) {
+    if (volume.volumeTex == 0) {
+        release(volume);
+        return;
+    }
+    // Replace an older copy of the same volume.
+    if (auto old = take(volume.file, volume.compressed)) {
+        release(*old);
+    }
+    totalBytes += volume.gpuBytes();
+    volumes.push_front(std::move(volume));
+    evict();
+}
+
+/**
+ * @brief Change the budget, evicts the oldest volumes if it shrinks.
+ * @param budgetBytes  Texture memory the cached volumes may use
+ */
+void VolumeCache::setBudget(std::size_t budgetBytes) {
+    this->budgetBytes = budgetBytes;
+    evict();
+}
+
+/**
+ * @brief Delete all cached volumes.
+ */
+void VolumeCache::clear() {
+    for (auto& volume : volumes) {
+        release(volume);
+    }
+    volumes.clear();
+    totalBytes = 0;
+}
+
+/**
+ * @brief Delete least recently used volumes until the budget is kept.
+ */
+void VolumeCache::evict() {
+    while (totalBytes > budgetBytes && !volumes.empty()) {
+        totalBytes -= volumes.back().gpuBytes();
+        release(volumes.back());
+        volumes.pop_back();
+    }
+}
+
+/**
+ * @brief Delete the textures of a volume.
+ */
+void VolumeCache::release(CachedVolume& volume) {
+    glDeleteTextures(1, &volume.volumeTex);
+    glDeleteTextures(1, &volume.gradientTex);
+    volume.volumeTex = 0;
+    volume.gradientTex = 0;
+}
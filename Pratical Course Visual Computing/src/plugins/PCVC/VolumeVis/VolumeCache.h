@@ -0,0 +1,71 @@
+#ifndef OGL4CORE2_PLUGINS_PCVC_VOLUMEVIS_VOLUMECACHE_H
+#define OGL4CORE2_PLUGINS_PCVC_VOLUMEVIS_VOLUMECACHE_H
+
+#include <cstddef>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <optional>
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+
+#include "BlockCompression.h"
+#include "IsoSurfaceExtractor.h"
+#include "VolumeLoader.h"
+
+namespace OGL4Core2::Plugins::PCVC::VolumeVis {
+    class VolumeStats;
+
+    /**
+     * A volume with everything derived from its voxels, as it is swapped in and out of the plugin.
+     */
+    struct CachedVolume {
+        std::filesystem::path file;                        //!< dat file
+        bool compressed = false;                           //!< volumeTex holds BC4 compressed slices
+        GLuint volumeTex = 0;                              //!< 3D texture, or 2D array texture if compressed
+        GLuint gradientTex = 0;                            //!< precomputed gradients, 0 if not computed
+        std::shared_ptr<MappedFile> data;                  //!< memory mapped voxels
+        VoxelType type = VoxelType::UInt8;                 //!< type of the voxels
+        glm::uvec3 res = glm::uvec3(0);                    //!< resolution
+        glm::vec2 compressedRange = glm::vec2(0.0f, 1.0f); //!< value range of the compressed slices
+        CompressionStats compressionStats;                 //!< size and error of the compressed slices
+        std::shared_ptr<const VolumeStats> stats;          //!< value statistics and histograms
+        std::shared_ptr<IsoSurfaceExtractor> isoExtractor; //!< value range bricks for the marching cubes
+
+        [[nodiscard]] std::size_t gpuBytes() const;
+    };
+
+    /**
+     * GPU resident volumes which are not shown at the moment, so switching back to them needs no upload. Volumes
+     * are kept in least recently used order and the oldest ones are deleted once their textures exceed the
+     * memory budget. The cache owns the textures of its volumes. It must only be used on the GL thread.
+     */
+    class VolumeCache {
+    public:
+        explicit VolumeCache(std::size_t budgetBytes);
+        ~VolumeCache();
+
+        VolumeCache(const VolumeCache&) = delete;
+        VolumeCache& operator=(const VolumeCache&) = delete;
+
+        std::optional<CachedVolume> take(const std::filesystem::path& file, bool compressed);
+        void put(CachedVolume volume);
+        void setBudget(std::size_t budgetBytes);
+        void clear();
+
+        [[nodiscard]] std::size_t budget() const { return budgetBytes; }
+        [[nodiscard]] std::size_t usedBytes() const { return totalBytes; }
+        [[nodiscard]] std::size_t size() const { return volumes.size(); }
+
+    private:
+        void evict();
+        static void release(CachedVolume& volume);
+
+        std::list<CachedVolume> volumes; //!< cached volumes, most recently used first
+        std::size_t budgetBytes;         //!< texture memory the cached volumes may use
+        std::size_t totalBytes;          //!< texture memory of the cached volumes
+    };
+} // namespace OGL4Core2::Plugins::PCVC::VolumeVis
+
+#endif // OGL4CORE2_PLUGINS_PCVC_VOLUMEVIS_VOLUMECACHE_H
@@ -0,0 +1,414 @@
+#include "VolumeLoader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <datraw.h>
+
+#include "BlockCompression.h"
+
+using namespace OGL4Core2::Plugins::PCVC::VolumeVis;
+
+/**
+ * @brief MappedFile constructor, maps the file read-only.
+ * @param path     The file to map
+ * @param offset   First byte to map
+ * @param length   Number of bytes to map, 0 maps the rest of the file
+ */
+MappedFile::MappedFile(const std::filesystem::path& path, std::size_t offset, std::size_t length)
+    : data_(nullptr),
+      size_(0),
+      mapBase(nullptr),
+      mapSize(0) {
+    std::size_t fileSize = 0;
+    std::size_t granularity = 0;
+#ifdef _WIN32
+    file = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                       FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Cannot open \"" + path.string() + "\"!");
+    }
+    LARGE_INTEGER largeSize;
+    if (!GetFileSizeEx(file, &largeSize)) {
+        CloseHandle(file);
+        throw std::runtime_error("Cannot read the size of \"" + path.string() + "\"!");
+    }
+    fileSize = static_cast<std::size_t>(largeSize.QuadPart);
+    SYSTEM_INFO sysInfo;
+    GetSystemInfo(&sysInfo);
+    granularity = sysInfo.dwAllocationGranularity;
+#else
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open \"" + path.string() + "\"!");
+    }
+    struct stat st {};
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw std::runtime_error("Cannot read the size of \"" + path.string() + "\"!");
+    }
+    fileSize = static_cast<std::size_t>(st.st_size);
+    granularity = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+#endif
+    if (offset > fileSize || (length > 0 && length > fileSize - offset) || fileSize == offset) {
+#ifdef _WIN32
+        CloseHandle(file);
+#else
+        close(fd);
+#endif
+        // Empty ranges cannot be mapped.
+        throw std::runtime_error(fileSize == offset ? "No data in \"" + path.string() + "\"!"
+                                                    : "Range exceeds \"" + path.string() + "\"!");
+    }
+    size_ = length > 0 ? length : fileSize - offset;
+    // Mappings start at a multiple of the granularity.
+    std::size_t mapOffset = offset - offset % granularity;
+    mapSize = size_ + (offset - mapOffset);
+#ifdef _WIN32
+    mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr) {
+        CloseHandle(file);
+        throw std::runtime_error("Cannot map \"" + path.string() + "\"!");
+    }
+    mapBase = MapViewOfFile(mapping, FILE_MAP_READ, static_cast<DWORD>(static_cast<std::uint64_t>(mapOffset) >> 32u),
+                            static_cast<DWORD>(mapOffset & 0xffffffffu), mapSize);
+    if (mapBase == nullptr) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        throw std::runtime_error("Cannot map \"" + path.string() + "\"!");
+    }
+#else
+    mapBase = mmap(nullptr, mapSize, PROT_READ, MAP_PRIVATE, fd, static_cast<off_t>(mapOffset));
+    if (mapBase == MAP_FAILED) {
+        close(fd);
+        throw std::runtime_error("Cannot map \"" + path.string() + "\"!");
+    }
+    // The volume is streamed front to back, let the kernel read ahead.
+    madvise(mapBase, mapSize, MADV_SEQUENTIAL);
+    madvise(mapBase, mapSize, MADV_WILLNEED);
+#endif
+    data_ = static_cast<const std::uint8_t*>(mapBase) + (offset - mapOffset);
+}
+
+/**
+ * @brief MappedFile destructor, unmaps the file.
+ */
+MappedFile::~MappedFile() {
+#ifdef _WIN32
+    UnmapViewOfFile(mapBase);
+    CloseHandle(mapping);
+    CloseHandle(file);
+#else
+    munmap(mapBase, mapSize);
+    close(fd);
+#endif
+}
+
+/**
+ * @brief Read all pages from disk, so later accesses do not block. Meant for prefetching on a worker thread.
+ */
+void MappedFile::touch() const {
+    static constexpr std::size_t pageSize = 4096;
+    volatile std::uint8_t sink = 0;
+    for (std::size_t i = 0; i < size_; i += pageSize) {
+        sink = sink ^ data_[i];
+    }
+    if (size_ > 0) {
+        sink = sink ^ data_[size_ - 1];
+    }
+}
+
+/**
+ * Texture format of a voxel type.
+ */
+static GLenum internalFormatOf(VoxelType type) {
+    switch (type) {
+        case VoxelType::UInt16:
+            return VoxelFormat<std::uint16_t>::internalFormat;
+        case VoxelType::Float32:
+            return VoxelFormat<float>::internalFormat;
+        default:
+            return VoxelFormat<std::uint8_t>::internalFormat;
+    }
+}
+
+/**
+ * @brief Read a dat file and locate the raw data of all time steps.
+ * @param datFile  The dat file describing the volume
+ * @return the header
+ */
+VolumeHeader VolumeHeader::read(const std::filesystem::path& datFile) {
+    datraw::raw_reader<char> rd = datraw::raw_reader<char>::open(datFile.string());
+    VolumeHeader header;
+    header.res = glm::uvec3(rd.info().resolution()[0], rd.info().resolution()[1], rd.info().resolution()[2]);
+
+    switch (rd.info().format()) {
+        case datraw::scalar_type::uint8:
+            header.type = VoxelType::UInt8;
+            header.voxelBytes = sizeof(std::uint8_t);
+            break;
+        case datraw::scalar_type::uint16:
+            header.type = VoxelType::UInt16;
+            header.voxelBytes = sizeof(std::uint16_t);
+            break;
+        case datraw::scalar_type::float32:
+            header.type = VoxelType::Float32;
+            header.voxelBytes = sizeof(float);
+            break;
+        default:
+            throw std::runtime_error("Unsupported voxel format in \"" + datFile.string() + "\"!");
+    }
+
+    // Time steps either have their own raw files or follow each other in one file.
+    std::size_t numSteps = std::max<std::size_t>(1, rd.info().time_steps());
+    for (std::size_t t = 0; t < numSteps; t++) {
+        std::filesystem::path rawFile(numSteps > 1 ? rd.info().object_file_name(t) : rd.info().object_file_name());
+        if (rawFile.is_relative()) {
+            rawFile = datFile.parent_path() / rawFile;
+        }
+        bool sharedFile = t > 0 && rawFile == header.rawFiles.front();
+        header.rawOffsets.push_back(sharedFile ? t * header.frameBytes() : 0);
+        header.rawFiles.push_back(std::move(rawFile));
+    }
+    return header;
+}
+
+/**
+ * @brief Map the raw data of a time step.
+ * @param timeStep     The time step
+ */
+std::shared_ptr<MappedFile> VolumeHeader::map(std::size_t timeStep) const {
+    return std::make_shared<MappedFile>(rawFiles.at(timeStep), rawOffsets.at(timeStep), frameBytes());
+}
+
+/**
+ * @brief VolumeLoader constructor.
+ * Reads the dat header, maps the raw file and allocates the texture and pixel buffers. No voxel data is touched.
+ * @param datFile  The dat file describing the volume
+ * @param timeStep The time step to load
+ * @param compress Store the volume as BC4 compressed slices
+ */
+VolumeLoader::VolumeLoader(const std::filesystem::path& datFile, std::size_t timeStep, bool compress)
+    : VolumeLoader(VolumeHeader::read(datFile), timeStep, nullptr, 0, compress) {}
+
+/**
+ * @brief VolumeLoader constructor for already mapped or prefetched data.
+ * @param header   The header of the volume
+ * @param timeStep The time step to load
+ * @param data     The mapped raw data of the time step, nullptr maps it
+ * @param target   Texture to upload to, created with the resolution and format of the volume. 0 creates one.
+ * @param compress Store the volume as BC4 compressed slices, the encoder starts right away
+ */
+VolumeLoader::VolumeLoader(const VolumeHeader& header, std::size_t timeStep, std::shared_ptr<MappedFile> data,
+                           GLuint target, bool compress)
+    : file(data != nullptr ? std::move(data) : header.map(timeStep)),
+      res(header.res),
+      voxelType(header.type),
+      sliceVoxels(static_cast<std::size_t>(header.res.x) * header.res.y),
+      sliceBytes(sliceVoxels * header.voxelBytes),
+      slicesPerChunk(1),
+      uploadedSlices(0),
+      volumeHeader(header),
+      compress(compress),
+      uploadSliceBytes(sliceBytes),
+      tex(target),
+      pbos{0, 0},
+      nextPbo(0) {
+    if (file->size() < sliceBytes * res.z) {
+        throw std::runtime_error("Raw data of time step " + std::to_string(timeStep) +
+                                 " is smaller than the volume resolution!");
+    }
+
+    if (compress) {
+        uploadSliceBytes = static_cast<std::size_t>((res.x + 3) / 4) * ((res.y + 3) / 4) * CompressedVolume::blockBytes;
+        encodeCancel = std::make_shared<std::atomic<bool>>(false);
+        pendingEncode = std::async(std::launch::async, [f = file, type = voxelType, r = res, cancel = encodeCancel]() {
+            return std::make_shared<const CompressedVolume>(compressVolume(*f, type, r, cancel.get()));
+        });
+    }
+
+    // Copy about 4 MB per chunk.
+    slicesPerChunk = static_cast<unsigned int>(
+        std::max<std::size_t>(1, (4u << 20u) / std::max<std::size_t>(1, uploadSliceBytes)));
+    slicesPerChunk = std::min(slicesPerChunk, std::max(1u, res.z));
+
+    if (tex == 0 && compress) {
+        glGenTextures(1, &tex);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, tex);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, CompressedVolume::internalFormat, static_cast<GLsizei>(res.x),
+                       static_cast<GLsizei>(res.y), static_cast<GLsizei>(res.z));
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    } else if (tex == 0) {
+        glGenTextures(1, &tex);
+        glBindTexture(GL_TEXTURE_3D, tex);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexStorage3D(GL_TEXTURE_3D, 1, internalFormatOf(voxelType), static_cast<GLsizei>(res.x),
+                       static_cast<GLsizei>(res.y), static_cast<GLsizei>(res.z));
+        glBindTexture(GL_TEXTURE_3D, 0);
+    }
+
+    glGenBuffers(numPbos, pbos);
+    for (GLuint pbo : pbos) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, static_cast<GLsizeiptr>(uploadSliceBytes * slicesPerChunk), nullptr,
+                     GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+/**
+ * @brief VolumeLoader destructor, deletes the texture unless it was released.
+ */
+VolumeLoader::~VolumeLoader() {
+    if (encodeCancel != nullptr) {
+        *encodeCancel = true;
+    }
+    if (pendingEncode.valid()) {
+        pendingEncode.wait();
+    }
+    glDeleteBuffers(numPbos, pbos);
+    glDeleteTextures(1, &tex);
+}
+
+/**
+ * @brief Upload the next slice ranges to the texture.
+ * @param budgetMs     Time in milliseconds after which no further chunk is started
+ * @return true if the whole volume is uploaded
+ */
+bool VolumeLoader::upload(double budgetMs) {
+    if (finished()) {
+        return true;
+    }
+    // Compressed slices are uploaded once the encoder is done.
+    if (compress && compressedVolume == nullptr) {
+        if (pendingEncode.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            return false;
+        }
+        compressedVolume = pendingEncode.get();
+    }
+    auto start = std::chrono::steady_clock::now();
+
+    glBindTexture(textureTarget(), tex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    do {
+        unsigned int slices = std::min(slicesPerChunk, res.z - uploadedSlices);
+        if (compress) {
+            uploadCompressedChunk(slices);
+        } else {
+            switch (voxelType) {
+                case VoxelType::UInt8:
+                    uploadChunk<std::uint8_t>(slices);
+                    break;
+                case VoxelType::UInt16:
+                    uploadChunk<std::uint16_t>(slices);
+                    break;
+                case VoxelType::Float32:
+                    uploadChunk<float>(slices);
+                    break;
+            }
+        }
+        uploadedSlices += slices;
+        nextPbo = (nextPbo + 1) % numPbos;
+    } while (!finished() &&
+             std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() < budgetMs);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(textureTarget(), 0);
+
+    // Only the range and the statistics of the compressed volume are needed afterwards.
+    if (finished() && compressedVolume != nullptr) {
+        auto header = std::make_shared<CompressedVolume>();
+        header->res = compressedVolume->res;
+        header->range = compressedVolume->range;
+        header->stats = compressedVolume->stats;
+        compressedVolume = std::move(header);
+    }
+    return finished();
+}
+
+/**
+ * @brief Copy the next slices through a PBO to the texture.
+ * @tparam T           The voxel type
+ * @param slices       Number of slices, starting at uploadedSlices
+ */
+template<typename T>
+void VolumeLoader::uploadChunk(unsigned int slices) {
+    std::size_t bytes = sliceVoxels * slices * sizeof(T);
+    const void* pixels = stageChunk(file->data() + sliceBytes * uploadedSlices, bytes);
+    glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, static_cast<GLint>(uploadedSlices), static_cast<GLsizei>(res.x),
+                    static_cast<GLsizei>(res.y), static_cast<GLsizei>(slices), GL_RED, VoxelFormat<T>::type, pixels);
+}
+
+/**
+ * @brief Copy the next compressed slices through a PBO to the texture.
+ * @param slices       Number of slices, starting at uploadedSlices
+ */
+void VolumeLoader::uploadCompressedChunk(unsigned int slices) {
+    std::size_t bytes = uploadSliceBytes * slices;
+    const void* pixels = stageChunk(compressedVolume->blocks.data() + uploadSliceBytes * uploadedSlices, bytes);
+    glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, static_cast<GLint>(uploadedSlices),
+                              static_cast<GLsizei>(res.x), static_cast<GLsizei>(res.y), static_cast<GLsizei>(slices),
+                              CompressedVolume::internalFormat, static_cast<GLsizei>(bytes), pixels);
+}
+
+/**
+ * @brief Copy data into the next PBO and leave it bound as unpack buffer.
+ * @param src          The data
+ * @param bytes        Size of the data
+ * @return the pixel pointer for the following transfer, src itself if the PBO cannot be mapped
+ */
+const void* VolumeLoader::stageChunk(const std::uint8_t* src, std::size_t bytes) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[nextPbo]);
+    // Invalidating the buffer lets the driver hand out fresh memory while a previous transfer is pending.
+    void* dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, static_cast<GLsizeiptr>(bytes),
+                                 GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (dst == nullptr) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        return src;
+    }
+    std::memcpy(dst, src, bytes);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    return nullptr;
+}
+
+/**
+ * @brief Fraction of the volume which is already uploaded.
+ */
+float VolumeLoader::progress() const {
+    if (res.z == 0) {
+        return 1.0f;
+    }
+    return static_cast<float>(uploadedSlices) / static_cast<float>(res.z);
+}
+
+/**
+ * @brief Hand over ownership of the texture to the caller.
+ * @return texture handle
+ */
+GLuint VolumeLoader::releaseTexture() {
+    GLuint t = tex;
+    tex = 0;
+    return t;
+}
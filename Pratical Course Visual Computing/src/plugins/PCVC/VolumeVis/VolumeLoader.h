@@ -0,0 +1,164 @@
+#ifndef OGL4CORE2_PLUGINS_PCVC_VOLUMEVIS_VOLUMELOADER_H
+#define OGL4CORE2_PLUGINS_PCVC_VOLUMEVIS_VOLUMELOADER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <vector>
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+
+namespace OGL4Core2::Plugins::PCVC::VolumeVis {
+
+    enum class VoxelType { UInt8, UInt16, Float32 };
+
+    struct CompressedVolume;
+
+    /**
+     * Texture format of a voxel type. The normalization maps a stored value to the value returned by the sampler.
+     */
+    template<typename T>
+    struct VoxelFormat;
+
+    template<>
+    struct VoxelFormat<std::uint8_t> {
+        static constexpr VoxelType voxelType = VoxelType::UInt8;
+        static constexpr GLenum internalFormat = GL_R8;
+        static constexpr GLenum type = GL_UNSIGNED_BYTE;
+        static constexpr float normalization = 1.0f / 255.0f;
+    };
+
+    template<>
+    struct VoxelFormat<std::uint16_t> {
+        static constexpr VoxelType voxelType = VoxelType::UInt16;
+        static constexpr GLenum internalFormat = GL_R16;
+        static constexpr GLenum type = GL_UNSIGNED_SHORT;
+        static constexpr float normalization = 1.0f / 65535.0f;
+    };
+
+    template<>
+    struct VoxelFormat<float> {
+        static constexpr VoxelType voxelType = VoxelType::Float32;
+        static constexpr GLenum internalFormat = GL_R32F;
+        static constexpr GLenum type = GL_FLOAT;
+        static constexpr float normalization = 1.0f;
+    };
+
+    /**
+     * Read-only memory mapping of a file or a byte range of it. The pages are only read from disk when they are
+     * touched.
+     */
+    class MappedFile {
+    public:
+        explicit MappedFile(const std::filesystem::path& path, std::size_t offset = 0, std::size_t length = 0);
+        ~MappedFile();
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        void touch() const;
+
+        [[nodiscard]] const std::uint8_t* data() const { return data_; }
+        [[nodiscard]] std::size_t size() const { return size_; }
+
+    private:
+        const std::uint8_t* data_;
+        std::size_t size_;
+        void* mapBase;       //!< start of the mapping, aligned to the mapping granularity
+        std::size_t mapSize; //!< size of the mapping
+#ifdef _WIN32
+        void* file;
+        void* mapping;
+#else
+        int fd;
+#endif
+    };
+
+    /**
+     * Contents of a dat file. Every time step is stored in its own raw file or, if all share one file, at
+     * consecutive offsets.
+     */
+    struct VolumeHeader {
+        static VolumeHeader read(const std::filesystem::path& datFile);
+
+        [[nodiscard]] std::shared_ptr<MappedFile> map(std::size_t timeStep) const;
+
+        [[nodiscard]] std::size_t numTimeSteps() const { return rawFiles.size(); }
+        [[nodiscard]] std::size_t frameBytes() const {
+            return static_cast<std::size_t>(res.x) * res.y * res.z * voxelBytes;
+        }
+
+        glm::uvec3 res = glm::uvec3(0);              //!< volume resolution
+        VoxelType type = VoxelType::UInt8;           //!< type of the stored voxels
+        std::size_t voxelBytes = 1;                  //!< size of one voxel in bytes
+        std::vector<std::filesystem::path> rawFiles; //!< raw file of each time step
+        std::vector<std::size_t> rawOffsets;         //!< offset of each time step in its raw file
+    };
+
+    /**
+     * Loads a dat/raw volume without blocking the application. The raw file is memory mapped and uploaded to a 3D
+     * texture slice range by slice range through pixel buffer objects, as much per call of upload() as fits into
+     * the given time budget. 8 and 16 bit unsigned integer as well as float voxels are supported. Of a time series
+     * one time step is loaded. Optionally the volume is compressed into BC4 blocks on worker threads first and
+     * stored in a 2D array texture of compressed slices, see CompressedVolume.
+     */
+    class VolumeLoader {
+    public:
+        explicit VolumeLoader(const std::filesystem::path& datFile, std::size_t timeStep = 0, bool compress = false);
+        VolumeLoader(const VolumeHeader& header, std::size_t timeStep, std::shared_ptr<MappedFile> data = nullptr,
+                     GLuint target = 0, bool compress = false);
+        ~VolumeLoader();
+
+        VolumeLoader(const VolumeLoader&) = delete;
+        VolumeLoader& operator=(const VolumeLoader&) = delete;
+
+        bool upload(double budgetMs);
+
+        [[nodiscard]] bool finished() const { return uploadedSlices >= res.z; }
+        [[nodiscard]] float progress() const;
+
+        GLuint releaseTexture();
+
+        [[nodiscard]] const glm::uvec3& resolution() const { return res; }
+        [[nodiscard]] VoxelType type() const { return voxelType; }
+        [[nodiscard]] std::size_t numVoxels() const { return sliceVoxels * res.z; }
+        [[nodiscard]] std::shared_ptr<MappedFile> data() const { return file; }
+        [[nodiscard]] const VolumeHeader& header() const { return volumeHeader; }
+        [[nodiscard]] std::size_t numTimeSteps() const { return volumeHeader.numTimeSteps(); }
+        [[nodiscard]] GLenum textureTarget() const { return compress ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_3D; }
+        [[nodiscard]] std::shared_ptr<const CompressedVolume> compressed() const { return compressedVolume; }
+
+    private:
+        static constexpr int numPbos = 2;
+
+        template<typename T>
+        void uploadChunk(unsigned int slices);
+        void uploadCompressedChunk(unsigned int slices);
+        const void* stageChunk(const std::uint8_t* src, std::size_t bytes);
+
+        std::shared_ptr<MappedFile> file; //!< mapped raw file
+        glm::uvec3 res;                   //!< volume resolution
+        VoxelType voxelType;              //!< type of the stored voxels
+        std::size_t sliceVoxels;          //!< number of voxels in one z slice
+        std::size_t sliceBytes;           //!< size of one z slice in bytes
+        unsigned int slicesPerChunk;      //!< number of slices copied through one PBO
+        unsigned int uploadedSlices;      //!< number of slices already uploaded
+        VolumeHeader volumeHeader;        //!< contents of the dat file
+
+        bool compress;                                                      //!< upload BC4 compressed slices
+        std::size_t uploadSliceBytes;                                       //!< size of one slice as uploaded
+        std::shared_ptr<std::atomic<bool>> encodeCancel;                    //!< stops the pending encoder
+        std::future<std::shared_ptr<const CompressedVolume>> pendingEncode; //!< encoder on worker threads
+        std::shared_ptr<const CompressedVolume> compressedVolume; //!< encoded slices, blocks dropped after the upload
+
+        GLuint tex;            //!< target 3D texture, or 2D array texture if compressed
+        GLuint pbos[numPbos];  //!< pixel unpack buffers, used round robin
+        int nextPbo;           //!< index of the next PBO to fill
+    };
+} // namespace OGL4Core2::Plugins::PCVC::VolumeVis
+
+#endif // OGL4CORE2_PLUGINS_PCVC_VOLUMEVIS_VOLUMELOADER_H
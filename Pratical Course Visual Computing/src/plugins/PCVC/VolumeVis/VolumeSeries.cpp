@@ -0,0 +1,317 @@
+#include "VolumeSeries.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+
+#include "BlockCompression.h"
+
+using namespace OGL4Core2::Plugins::PCVC::VolumeVis;
+
+/**
+ * @brief VolumeSeries constructor, adopts the texture of the first time step and starts prefetching.
+ * @param header       The header of the series
+ * @param firstTex     Texture holding the first time step, owned by the series afterwards
+ * @param firstData    The mapped raw data of the first time step
+ * @param firstRange   Value range of the compressed first time step
+ * @param compress     Store the time steps as BC4 compressed slices, like the first one
+ * @param numPrefetch  Number of staging slots, i.e. how many steps are read ahead
+ * @param numTextures  Number of textures, at least two
+ */
+VolumeSeries::VolumeSeries(VolumeHeader header, GLuint firstTex, std::shared_ptr<MappedFile> firstData,
+                           glm::vec2 firstRange, bool compress, std::size_t numPrefetch, std::size_t numTextures)
+    : header(std::move(header)),
+      compress(compress),
+      textures(std::max<std::size_t>(2, numTextures)),
+      uploadStep(npos),
+      uploadTarget(npos),
+      slots(std::max<std::size_t>(1, numPrefetch)),
+      windowStart(0),
+      loadMsSum(0.0),
+      loadCount(0),
+      stop(false) {
+    if (this->header.numTimeSteps() == 0) {
+        throw std::runtime_error("Volume series without time steps!");
+    }
+    textures[0] = {firstTex, 0, std::move(firstData), firstRange};
+    residentSteps.push_back(0);
+    windowStart = 1 % numSteps();
+    prefetcher = std::thread(&VolumeSeries::prefetchLoop, this);
+}
+
+/**
+ * @brief VolumeSeries destructor, stops the prefetch thread and deletes all textures.
+ */
+VolumeSeries::~VolumeSeries() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    wakeUp.notify_one();
+    prefetcher.join();
+
+    if (uploader != nullptr) {
+        textures[uploadTarget].tex = uploader->releaseTexture();
+        uploader.reset();
+    }
+    for (auto& r : textures) {
+        glDeleteTextures(1, &r.tex);
+    }
+}
+
+/**
+ * @brief Move the prefetch window and continue the uploads, called once per frame.
+ * The textures hold the displayed step and the steps right after the due one. Staged steps of that range are
+ * uploaded into a texture whose step is outside of it.
+ * @param due          The step which should be shown now
+ * @param displayed    The step currently shown, its texture is kept
+ * @param budgetMs     Time in milliseconds after which no further upload chunk is started
+ */
+void VolumeSeries::update(std::size_t due, std::size_t displayed, double budgetMs) {
+    auto start = std::chrono::steady_clock::now();
+    std::size_t n = numSteps();
+    due %= n;
+    // One texture is reserved for the displayed step, the others for the steps from the due one on.
+    std::size_t ahead = std::min(textures.size() - 1, n);
+    auto aheadOfDue = [&](std::size_t step) { return (step + n - due) % n < ahead; };
+
+    // A seek leaves the upload in progress behind, its texture is reused.
+    if (uploader != nullptr && !aheadOfDue(uploadStep)) {
+        textures[uploadTarget].tex = uploader->releaseTexture();
+        uploader.reset();
+        uploadStep = npos;
+        uploadTarget = npos;
+    }
+
+    // Prefetch from the first step that is not resident yet.
+    std::size_t first = due;
+    for (std::size_t i = 0; i < textures.size() && (isResident(first) || first == uploadStep); i++) {
+        first = (first + 1) % n;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        windowStart = first;
+        residentSteps.clear();
+        for (const auto& r : textures) {
+            if (r.step != npos) {
+                residentSteps.push_back(r.step);
+            }
+        }
+        if (uploader != nullptr) {
+            residentSteps.push_back(uploadStep);
+        }
+    }
+    wakeUp.notify_one();
+
+    while (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() < budgetMs) {
+        if (uploader == nullptr) {
+            std::size_t target = chooseTarget(due, displayed);
+            if (target == npos) {
+                break;
+            }
+            std::size_t step = npos;
+            std::shared_ptr<MappedFile> staged;
+            for (std::size_t i = 0; i < ahead && staged == nullptr; i++) {
+                step = (due + i) % n;
+                if (!isResident(step)) {
+                    staged = take(step);
+                }
+            }
+            if (staged == nullptr) {
+                break;
+            }
+            try {
+                uploader = std::make_unique<VolumeLoader>(header, step, std::move(staged), textures[target].tex,
+                                                          compress);
+            } catch (std::exception& e) {
+                std::cerr << "Cannot upload time step " << step << ": " << e.what() << std::endl;
+                std::lock_guard<std::mutex> lock(mutex);
+                brokenSteps.insert(step);
+                continue;
+            }
+            textures[target].step = npos;
+            textures[target].data.reset();
+            uploadStep = step;
+            uploadTarget = target;
+        }
+
+        double remainingMs =
+            budgetMs - std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (!uploader->upload(remainingMs)) {
+            break;
+        }
+        glm::vec2 range = uploader->compressed() != nullptr ? uploader->compressed()->range : glm::vec2(0.0f, 1.0f);
+        textures[uploadTarget] = {uploader->releaseTexture(), uploadStep, uploader->data(), range};
+        uploader.reset();
+        uploadStep = npos;
+        uploadTarget = npos;
+    }
+}
+
+/**
+ * @brief Texture of a resident step, 0 if the step is not resident.
+ */
+GLuint VolumeSeries::texture(std::size_t step) const {
+    std::size_t idx = findResident(step);
+    return idx != npos ? textures[idx].tex : 0;
+}
+
+/**
+ * @brief Mapped raw data of a resident step, nullptr if the step is not resident.
+ */
+std::shared_ptr<MappedFile> VolumeSeries::data(std::size_t step) const {
+    std::size_t idx = findResident(step);
+    return idx != npos ? textures[idx].data : nullptr;
+}
+
+/**
+ * @brief Value range the compressed slices of a resident step are normalized to.
+ */
+glm::vec2 VolumeSeries::compressedRange(std::size_t step) const {
+    std::size_t idx = findResident(step);
+    return idx != npos ? textures[idx].range : glm::vec2(0.0f, 1.0f);
+}
+
+/**
+ * @brief Number of steps which are read and wait for their upload.
+ */
+std::size_t VolumeSeries::numStaged() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return static_cast<std::size_t>(std::count_if(slots.begin(), slots.end(), [](const Slot& s) { return s.ready; }));
+}
+
+/**
+ * @brief Average time the prefetch thread needed to read one step in milliseconds.
+ */
+double VolumeSeries::prefetchMs() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return loadCount > 0 ? loadMsSum / static_cast<double>(loadCount) : 0.0;
+}
+
+/**
+ * @brief Body of the prefetch thread. Reads the steps of the window one after the other into free slots and
+ * evicts slots whose step left the window. Sleeps while all slots are in use.
+ */
+void VolumeSeries::prefetchLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stop) {
+        for (auto& slot : slots) {
+            if (slot.step != npos && !inWindow(slot.step)) {
+                slot = {};
+            }
+        }
+
+        // Next step of the window which is neither resident, staged nor broken.
+        std::size_t n = numSteps();
+        std::size_t next = npos;
+        for (std::size_t i = 0; i < std::min(slots.size(), n) && next == npos; i++) {
+            std::size_t step = (windowStart + i) % n;
+            bool known = std::find(residentSteps.begin(), residentSteps.end(), step) != residentSteps.end() ||
+                         brokenSteps.count(step) > 0 ||
+                         std::any_of(slots.begin(), slots.end(), [step](const Slot& s) { return s.step == step; });
+            if (!known) {
+                next = step;
+            }
+        }
+        auto free = std::find_if(slots.begin(), slots.end(), [](const Slot& s) { return s.step == npos; });
+        if (next == npos || free == slots.end()) {
+            wakeUp.wait(lock);
+            continue;
+        }
+        std::size_t slotIdx = static_cast<std::size_t>(free - slots.begin());
+        slots[slotIdx].step = next;
+
+        // Mapping and reading the pages run without the lock, the GL thread may move the window meanwhile.
+        lock.unlock();
+        auto start = std::chrono::steady_clock::now();
+        std::shared_ptr<MappedFile> data;
+        try {
+            data = header.map(next);
+            data->touch();
+        } catch (std::exception& e) {
+            std::cerr << "Cannot read time step " << next << ": " << e.what() << std::endl;
+            data.reset();
+        }
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        lock.lock();
+
+        if (data == nullptr) {
+            brokenSteps.insert(next);
+        } else {
+            loadMsSum += ms;
+            loadCount++;
+        }
+        if (slots[slotIdx].step == next && data != nullptr) {
+            slots[slotIdx].data = std::move(data);
+            slots[slotIdx].ready = true;
+        } else if (slots[slotIdx].step == next) {
+            slots[slotIdx] = {};
+        }
+    }
+}
+
+/**
+ * @brief Test if a step lies in the prefetch window. The mutex must be held.
+ */
+bool VolumeSeries::inWindow(std::size_t step) const {
+    std::size_t n = numSteps();
+    return (step + n - windowStart) % n < slots.size();
+}
+
+/**
+ * @brief Remove a step from the staging slots without waiting.
+ * @param step     The time step
+ * @return the mapped data of the step, nullptr if it is not read yet
+ */
+std::shared_ptr<MappedFile> VolumeSeries::take(std::size_t step) {
+    std::shared_ptr<MappedFile> data;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& slot : slots) {
+            if (slot.step == step && slot.ready) {
+                data = std::move(slot.data);
+                slot = {};
+                break;
+            }
+        }
+    }
+    if (data != nullptr) {
+        wakeUp.notify_one();
+    }
+    return data;
+}
+
+/**
+ * @brief Index of the texture holding a step, npos if the step is not resident.
+ */
+std::size_t VolumeSeries::findResident(std::size_t step) const {
+    for (std::size_t i = 0; i < textures.size(); i++) {
+        if (textures[i].step == step && step != npos) {
+            return i;
+        }
+    }
+    return npos;
+}
+
+/**
+ * @brief Texture the next upload goes to: a free one, or one whose step is neither displayed nor needed soon.
+ * @param due          The step which should be shown now
+ * @param displayed    The step currently shown
+ * @return texture index, npos if all textures are in use
+ */
+std::size_t VolumeSeries::chooseTarget(std::size_t due, std::size_t displayed) const {
+    std::size_t n = numSteps();
+    std::size_t ahead = std::min(textures.size() - 1, n);
+    std::size_t target = npos;
+    for (std::size_t i = 0; i < textures.size(); i++) {
+        const auto& r = textures[i];
+        if (r.step == npos) {
+            return i;
+        }
+        if (r.step != displayed && (r.step + n - due) % n >= ahead) {
+            target = i;
+        }
+    }
+    return target;
+}
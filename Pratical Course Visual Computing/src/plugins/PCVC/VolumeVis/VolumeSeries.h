@@ -0,0 +1,96 @@
+#ifndef OGL4CORE2_PLUGINS_PCVC_VOLUMEVIS_VOLUMESERIES_H
+#define OGL4CORE2_PLUGINS_PCVC_VOLUMEVIS_VOLUMESERIES_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+
+#include "VolumeLoader.h"
+
+namespace OGL4Core2::Plugins::PCVC::VolumeVis {
+
+    /**
+     * Time series of volumes for playback. A prefetch thread maps the time steps following the due one into a
+     * ring of staging slots and reads their pages from disk. On the GL thread, update() uploads the staged steps
+     * through a VolumeLoader into a rotating set of 3D textures, within a time budget per frame. A step can be
+     * shown as soon as it is resident in one of the textures. Compressed series keep BC4 compressed slices in the
+     * textures, which are encoded by the VolumeLoader of each upload.
+     */
+    class VolumeSeries {
+    public:
+        static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+        VolumeSeries(VolumeHeader header, GLuint firstTex, std::shared_ptr<MappedFile> firstData,
+                     glm::vec2 firstRange = glm::vec2(0.0f, 1.0f), bool compress = false, std::size_t numPrefetch = 4,
+                     std::size_t numTextures = 3);
+        ~VolumeSeries();
+
+        VolumeSeries(const VolumeSeries&) = delete;
+        VolumeSeries& operator=(const VolumeSeries&) = delete;
+
+        void update(std::size_t due, std::size_t displayed, double budgetMs);
+
+        [[nodiscard]] bool isResident(std::size_t step) const { return findResident(step) != npos; }
+        [[nodiscard]] GLuint texture(std::size_t step) const;
+        [[nodiscard]] std::shared_ptr<MappedFile> data(std::size_t step) const;
+        [[nodiscard]] glm::vec2 compressedRange(std::size_t step) const;
+
+        [[nodiscard]] std::size_t numSteps() const { return header.numTimeSteps(); }
+        [[nodiscard]] std::size_t numStaged() const;
+        [[nodiscard]] double prefetchMs() const;
+
+    private:
+        /**
+         * Staging slot of the prefetch thread.
+         */
+        struct Slot {
+            std::size_t step = npos;          //!< time step mapped into the slot
+            bool ready = false;               //!< the pages of the step are read
+            std::shared_ptr<MappedFile> data; //!< mapped raw data of the step
+        };
+
+        /**
+         * Texture of the ring.
+         */
+        struct Resident {
+            GLuint tex = 0;                   //!< 3D texture, created by the first upload into it
+            std::size_t step = npos;          //!< time step the texture holds
+            std::shared_ptr<MappedFile> data; //!< mapped raw data of the step, for the CPU passes
+            glm::vec2 range{0.0f, 1.0f};      //!< value range of the compressed slices
+        };
+
+        void prefetchLoop();
+        bool inWindow(std::size_t step) const;
+        std::shared_ptr<MappedFile> take(std::size_t step);
+        std::size_t findResident(std::size_t step) const;
+        std::size_t chooseTarget(std::size_t due, std::size_t displayed) const;
+
+        VolumeHeader header; //!< contents of the dat file
+        bool compress;       //!< store BC4 compressed slices
+
+        std::vector<Resident> textures;         //!< ring of textures
+        std::unique_ptr<VolumeLoader> uploader; //!< upload in progress
+        std::size_t uploadStep;                 //!< time step of the upload in progress
+        std::size_t uploadTarget;               //!< index of the texture the upload goes to
+
+        mutable std::mutex mutex;               //!< guards the members below
+        std::condition_variable wakeUp;         //!< wakes the prefetch thread
+        std::vector<Slot> slots;                //!< staging slots
+        std::vector<std::size_t> residentSteps; //!< steps which need no prefetch
+        std::set<std::size_t> brokenSteps;      //!< steps which failed to load
+        std::size_t windowStart;                //!< first step of the prefetch window
+        double loadMsSum;                       //!< summed read time of the prefetched steps
+        std::size_t loadCount;                  //!< number of prefetched steps
+        bool stop;                              //!< ends the prefetch thread
+        std::thread prefetcher;                 //!< the prefetch thread
+    };
+} // namespace OGL4Core2::Plugins::PCVC::VolumeVis
+
+#endif // OGL4CORE2_PLUGINS_PCVC_VOLUMEVIS_VOLUMESERIES_H
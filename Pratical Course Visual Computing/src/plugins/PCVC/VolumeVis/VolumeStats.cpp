@@ -0,0 +1,322 @@
+#include "VolumeStats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+
+// The OGL4CORE2_AVX2 build option enables the AVX2 byte count.
+#if defined(__AVX2__)
+#define VOLUMEVIS_STATS_AVX2
+#include <immintrin.h>
+#endif
+
+using namespace OGL4Core2::Plugins::PCVC::VolumeVis;
+
+/**
+ * Number of voxels a worker takes at once. Small enough to balance the load and to react to a cancel request,
+ * large enough to keep the scheduling overhead negligible.
+ */
+static constexpr std::size_t blockSize = std::size_t(1) << 22u;
+
+/**
+ * Run func(worker, begin, end) for all blocks of [0, count) on numWorkers threads. The blocks are handed out
+ * dynamically, every worker has its own index for private accumulators.
+ * @param count        Number of elements
+ * @param numWorkers   Number of threads
+ * @param cancel       Stops handing out blocks once set, may be nullptr
+ * @param func         The kernel
+ */
+template<typename F>
+static void parallelBlocks(std::size_t count, unsigned int numWorkers, const std::atomic<bool>* cancel, F&& func) {
+    std::atomic<std::size_t> nextBlock(0);
+    auto worker = [&](unsigned int w) {
+        while (cancel == nullptr || !cancel->load(std::memory_order_relaxed)) {
+            std::size_t begin = nextBlock.fetch_add(blockSize, std::memory_order_relaxed);
+            if (begin >= count) {
+                break;
+            }
+            func(w, begin, std::min(begin + blockSize, count));
+        }
+    };
+    std::vector<std::thread> threads;
+    for (unsigned int w = 1; w < numWorkers; w++) {
+        threads.emplace_back(worker, w);
+    }
+    worker(0);
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+/**
+ * Count eight bytes read with one load into four interleaved sub-histograms.
+ */
+static inline void countEightBytes(const std::uint8_t* values, std::uint64_t* s0, std::uint64_t* s1,
+                                   std::uint64_t* s2, std::uint64_t* s3) {
+    std::uint64_t v;
+    std::memcpy(&v, values, sizeof(v));
+    s0[v & 0xffu]++;
+    s1[(v >> 8u) & 0xffu]++;
+    s2[(v >> 16u) & 0xffu]++;
+    s3[(v >> 24u) & 0xffu]++;
+    s0[(v >> 32u) & 0xffu]++;
+    s1[(v >> 40u) & 0xffu]++;
+    s2[(v >> 48u) & 0xffu]++;
+    s3[v >> 56u]++;
+}
+
+/**
+ * Count bytes. Four interleaved sub-histograms avoid that consecutive equal values wait for each other's
+ * increment, eight values are read with one load. With AVX2, blocks of 32 equal bytes, e.g. the empty space
+ * around the data, are detected with one compare and counted with a single add.
+ * @param values       The voxels
+ * @param count        Number of voxels
+ * @param bins         256 counters to add to
+ */
+static void countBytes(const std::uint8_t* values, std::size_t count, std::uint64_t* bins) {
+    std::vector<std::uint64_t> sub(4 * 256, 0);
+    std::uint64_t* s0 = sub.data();
+    std::uint64_t* s1 = s0 + 256;
+    std::uint64_t* s2 = s1 + 256;
+    std::uint64_t* s3 = s2 + 256;
+    std::size_t i = 0;
+#if defined(VOLUMEVIS_STATS_AVX2)
+    for (; i + 32 <= count; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i));
+        __m256i first = _mm256_set1_epi8(static_cast<char>(values[i]));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, first)) == -1) {
+            s0[values[i]] += 32;
+            continue;
+        }
+        for (std::size_t j = 0; j < 32; j += 8) {
+            countEightBytes(values + i + j, s0, s1, s2, s3);
+        }
+    }
+#endif
+    for (; i + 8 <= count; i += 8) {
+        countEightBytes(values + i, s0, s1, s2, s3);
+    }
+    for (; i < count; i++) {
+        s0[values[i]]++;
+    }
+    for (std::size_t b = 0; b < 256; b++) {
+        bins[b] += s0[b] + s1[b] + s2[b] + s3[b];
+    }
+}
+
+/**
+ * Count 16 bit values.
+ * @param values       The voxels
+ * @param count        Number of voxels
+ * @param bins         65536 counters to add to
+ */
+static void countShorts(const std::uint16_t* values, std::size_t count, std::uint64_t* bins) {
+    std::size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        std::uint64_t v;
+        std::memcpy(&v, values + i, sizeof(v));
+        bins[v & 0xffffu]++;
+        bins[(v >> 16u) & 0xffffu]++;
+        bins[(v >> 32u) & 0xffffu]++;
+        bins[v >> 48u]++;
+    }
+    for (; i < count; i++) {
+        bins[values[i]]++;
+    }
+}
+
+/**
+ * @brief VolumeStats constructor, statistics of an empty volume.
+ */
+VolumeStats::VolumeStats()
+    : minValue(0.0f),
+      maxValue(0.0f),
+      mean(0.0f),
+      numValues(0),
+      fineOffset(0.0f),
+      fineWidth(1.0f) {}
+
+/**
+ * @brief Compute the statistics of a volume. Blocks until done, run it on a worker thread for large volumes.
+ * @param file         The mapped raw file
+ * @param type         Type of the voxels
+ * @param numVoxels    Number of voxels
+ * @param cancel       Aborts the computation once set, may be nullptr. The result is incomplete then.
+ * @param numThreads   Number of threads, 0 uses all cores
+ * @return the statistics
+ */
+VolumeStats VolumeStats::compute(const MappedFile& file, VoxelType type, std::size_t numVoxels,
+                                 const std::atomic<bool>* cancel, unsigned int numThreads) {
+    if (numThreads == 0) {
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    numThreads = static_cast<unsigned int>(
+        std::min<std::size_t>(numThreads, std::max<std::size_t>(1, (numVoxels + blockSize - 1) / blockSize)));
+
+    VolumeStats stats;
+    if (type == VoxelType::Float32) {
+        const auto* values = reinterpret_cast<const float*>(file.data());
+
+        // First pass: range and sum. std::min/max keep the accumulator for NaN, so these loops vectorize.
+        struct Partial {
+            float lo = std::numeric_limits<float>::max();
+            float hi = std::numeric_limits<float>::lowest();
+            double sum = 0.0;
+            std::uint64_t count = 0;
+        };
+        std::vector<Partial> partials(numThreads);
+        parallelBlocks(numVoxels, numThreads, cancel, [&](unsigned int w, std::size_t begin, std::size_t end) {
+            float lo = partials[w].lo;
+            float hi = partials[w].hi;
+            double sum = 0.0;
+            std::uint64_t count = 0;
+            for (std::size_t i = begin; i < end; i++) {
+                float v = values[i];
+                lo = std::min(lo, v);
+                hi = std::max(hi, v);
+                bool valid = v == v;
+                sum += valid ? static_cast<double>(v) : 0.0;
+                count += valid ? 1 : 0;
+            }
+            partials[w].lo = lo;
+            partials[w].hi = hi;
+            partials[w].sum += sum;
+            partials[w].count += count;
+        });
+        Partial total;
+        for (const auto& p : partials) {
+            total.lo = std::min(total.lo, p.lo);
+            total.hi = std::max(total.hi, p.hi);
+            total.sum += p.sum;
+            total.count += p.count;
+        }
+        if (total.count == 0) {
+            return stats;
+        }
+        stats.minValue = total.lo;
+        stats.maxValue = total.hi;
+        stats.numValues = total.count;
+        stats.mean = static_cast<float>(total.sum / static_cast<double>(total.count));
+
+        // Second pass: fine histogram between min and max.
+        stats.fineOffset = total.lo;
+        float range = total.hi - total.lo;
+        stats.fineWidth = range > 0.0f ? range / static_cast<float>(numFloatBins) : 1.0f;
+        float binScale = 1.0f / stats.fineWidth;
+        std::vector<std::vector<std::uint64_t>> bins(numThreads, std::vector<std::uint64_t>(numFloatBins, 0));
+        parallelBlocks(numVoxels, numThreads, cancel, [&](unsigned int w, std::size_t begin, std::size_t end) {
+            std::uint64_t* b = bins[w].data();
+            for (std::size_t i = begin; i < end; i++) {
+                float v = values[i];
+                if (v == v) {
+                    auto bin = static_cast<std::size_t>((v - total.lo) * binScale);
+                    b[std::min(bin, numFloatBins - 1)]++;
+                }
+            }
+        });
+        stats.fineHisto.assign(numFloatBins, 0);
+        for (const auto& b : bins) {
+            for (std::size_t i = 0; i < numFloatBins; i++) {
+                stats.fineHisto[i] += b[i];
+            }
+        }
+        return stats;
+    }
+
+    // Integer voxels: one private histogram per thread, everything else follows from the merged one.
+    std::size_t numBins = type == VoxelType::UInt8 ? 256 : 65536;
+    std::vector<std::vector<std::uint64_t>> bins(numThreads, std::vector<std::uint64_t>(numBins, 0));
+    parallelBlocks(numVoxels, numThreads, cancel, [&](unsigned int w, std::size_t begin, std::size_t end) {
+        if (type == VoxelType::UInt8) {
+            countBytes(file.data() + begin, end - begin, bins[w].data());
+        } else {
+            countShorts(reinterpret_cast<const std::uint16_t*>(file.data()) + begin, end - begin, bins[w].data());
+        }
+    });
+    stats.fineHisto.assign(numBins, 0);
+    for (const auto& b : bins) {
+        for (std::size_t i = 0; i < numBins; i++) {
+            stats.fineHisto[i] += b[i];
+        }
+    }
+    stats.fineOffset = 0.0f;
+    stats.fineWidth = type == VoxelType::UInt8 ? VoxelFormat<std::uint8_t>::normalization
+                                               : VoxelFormat<std::uint16_t>::normalization;
+
+    double sum = 0.0;
+    std::size_t first = numBins;
+    std::size_t last = 0;
+    for (std::size_t i = 0; i < numBins; i++) {
+        if (stats.fineHisto[i] > 0) {
+            first = std::min(first, i);
+            last = i;
+            stats.numValues += stats.fineHisto[i];
+            sum += static_cast<double>(stats.fineHisto[i]) * static_cast<double>(i);
+        }
+    }
+    if (stats.numValues == 0) {
+        return stats;
+    }
+    stats.minValue = stats.binValue(first);
+    stats.maxValue = stats.binValue(last);
+    stats.mean = static_cast<float>(sum / static_cast<double>(stats.numValues)) * stats.fineWidth;
+    return stats;
+}
+
+/**
+ * @brief Value represented by a fine bin, the value itself for integer voxels.
+ * @param bin          Index of the fine bin
+ */
+float VolumeStats::binValue(std::size_t bin) const {
+    return fineOffset + static_cast<float>(bin) * fineWidth;
+}
+
+/**
+ * @brief Histogram between minimum and maximum value.
+ * @param bins         Number of bins
+ * @return number of voxels in each bin
+ */
+std::vector<std::uint32_t> VolumeStats::histogram(std::size_t bins) const {
+    std::vector<std::uint32_t> result(bins, 0);
+    if (bins == 0 || numValues == 0) {
+        return result;
+    }
+    float binScale = static_cast<float>(bins) / std::max(maxValue - minValue, std::numeric_limits<float>::min());
+    std::vector<std::uint64_t> counts(bins, 0);
+    for (std::size_t i = 0; i < fineHisto.size(); i++) {
+        if (fineHisto[i] > 0) {
+            auto bin = static_cast<std::size_t>(std::max(0.0f, (binValue(i) - minValue) * binScale));
+            counts[std::min(bin, bins - 1)] += fineHisto[i];
+        }
+    }
+    for (std::size_t i = 0; i < bins; i++) {
+        result[i] = static_cast<std::uint32_t>(
+            std::min<std::uint64_t>(counts[i], std::numeric_limits<std::uint32_t>::max()));
+    }
+    return result;
+}
+
+/**
+ * @brief Value below which the given fraction of the voxels lies. Exact for integer voxels, accurate to a fine bin
+ * for float voxels.
+ * @param fraction     Fraction in [0, 1]
+ */
+float VolumeStats::percentile(float fraction) const {
+    if (numValues == 0) {
+        return 0.0f;
+    }
+    auto target = static_cast<std::uint64_t>(std::ceil(static_cast<double>(std::clamp(fraction, 0.0f, 1.0f)) *
+                                                       static_cast<double>(numValues)));
+    target = std::max<std::uint64_t>(target, 1);
+    std::uint64_t sum = 0;
+    for (std::size_t i = 0; i < fineHisto.size(); i++) {
+        sum += fineHisto[i];
+        if (sum >= target) {
+            return std::clamp(binValue(i), minValue, maxValue);
+        }
+    }
+    return maxValue;
+}
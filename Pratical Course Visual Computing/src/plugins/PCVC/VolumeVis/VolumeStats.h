@@ -0,0 +1,46 @@
+#ifndef OGL4CORE2_PLUGINS_PCVC_VOLUMEVIS_VOLUMESTATS_H
+#define OGL4CORE2_PLUGINS_PCVC_VOLUMEVIS_VOLUMESTATS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "VolumeLoader.h"
+
+namespace OGL4Core2::Plugins::PCVC::VolumeVis {
+
+    /**
+     * Value statistics of a volume. All values are given in sampler units, i.e. integer voxels are normalized
+     * to [0, 1] like the texture returns them.
+     * compute() counts the voxels on all cores into a fine histogram, one bin per value for integer voxels and
+     * numFloatBins bins between minimum and maximum for float voxels. Histograms with an arbitrary number of bins
+     * and percentiles are derived from it without touching the voxels again.
+     */
+    class VolumeStats {
+    public:
+        static constexpr std::size_t numFloatBins = 65536;
+
+        VolumeStats();
+
+        static VolumeStats compute(const MappedFile& file, VoxelType type, std::size_t numVoxels,
+                                   const std::atomic<bool>* cancel = nullptr, unsigned int numThreads = 0);
+
+        [[nodiscard]] std::vector<std::uint32_t> histogram(std::size_t bins) const;
+        [[nodiscard]] float percentile(float fraction) const;
+
+        float minValue;          //!< smallest value
+        float maxValue;          //!< largest value
+        float mean;              //!< average value
+        std::uint64_t numValues; //!< number of counted voxels, NaNs are skipped
+
+    private:
+        [[nodiscard]] float binValue(std::size_t bin) const;
+
+        std::vector<std::uint64_t> fineHisto; //!< counts of the fine bins
+        float fineOffset;                     //!< value of the first fine bin
+        float fineWidth;                      //!< value distance between two fine bins
+    };
+} // namespace OGL4Core2::Plugins::PCVC::VolumeVis
+
+#endif // OGL4CORE2_PLUGINS_PCVC_VOLUMEVIS_VOLUMESTATS_H
@@ -1,20 +1,57 @@
 #include "VolumeVis.h"
 
 #include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <iterator>
+#include <tuple>
 
-#include <datraw.h>
 #include <glm/gtc/matrix_transform.hpp>
 #include <imgui.h>
 #include <imgui_stdlib.h>
+#include <lodepng.h>
 
 #include "core/core.h"
 #include "core/util/imguiutil.h"
+#include "VolumeLoader.h"
+#include "VolumeStats.h"
 
 using namespace OGL4Core2::Plugins::PCVC::VolumeVis;
 
+/**
+ * Radical inverse of the Halton sequence, used for sub-pixel jitter of the progressive passes.
+ * @param index    Index of the sample, starting at 1
+ * @param base     Prime base of the sequence
+ */
+static float halton(int index, int base) {
+    float f = 1.0f;
+    float result = 0.0f;
+    while (index > 0) {
+        f /= static_cast<float>(base);
+        result += f * static_cast<float>(index % base);
+        index /= base;
+    }
+    return result;
+}
+
+/**
+ * @brief Compare two render states.
+ * @param other    The render state to compare with
+ */
+bool VolumeVis::RenderState::operator==(const RenderState& other) const {
+    return std::tie(viewMx, viewport, fovY, volume, gradient, linearFilter, tfVersion, preIntegration, viewMode,
+                    showBox, backgroundColor, depthOpacity, shadows, light, maxSteps, stepSize, random, scale,
+                    isoValue, ambientColor, diffuseColor, specularColor, k) ==
+           std::tie(other.viewMx, other.viewport, other.fovY, other.volume, other.gradient, other.linearFilter,
+                    other.tfVersion, other.preIntegration, other.viewMode, other.showBox, other.backgroundColor,
+                    other.depthOpacity, other.shadows, other.light, other.maxSteps, other.stepSize, other.random,
+                    other.scale, other.isoValue, other.ambientColor, other.diffuseColor, other.specularColor,
+                    other.k);
+}
+
 /**
  * @brief VolumeVis constructor.
  */
@@ -26,10 +63,31 @@ VolumeVis::VolumeVis(const OGL4Core2::Core::Core& c)
       currentFileSelection(0),
       volumeRes(glm::uvec3(0)),
       volumeDim(glm::vec3(0.0)),
+      valueRange(glm::vec2(0.0f, 1.0f)),
+      volumeType(VoxelType::UInt8),
+      uploadBudget(4.0f),
+      volumeCache(512u << 20),
+      cacheBudget(512.0f),
+      useCompression(false),
+      volumeCompressed(false),
+      compressedRange(glm::vec2(0.0f, 1.0f)),
+      timeStep(0),
+      playing(false),
+      playbackFps(10.0f),
+      playbackPos(0.0),
+      playbackClock(std::chrono::steady_clock::now()),
+      shownStep(0),
+      shownStepDerived(true),
+      dueStep(0),
+      dueShown(true),
+      droppedFrames(0),
+      volumePercentiles(glm::vec3(0.0f)),
       fovY(45.0f),
       backgroundColor(glm::vec3(0.2f, 0.2f, 0.2f)),
       useLinearFilter(true),
+      useGradientTex(false),
       showBox(true),
+      depthOpacity(0.5f),
       viewMode(ViewMode::LineOfSight),
       // --------------------------------------------------------------------------------
       // TODO: Set maxSteps to reasonable default, explain here! Current value is just a placeholder.
@@ -51,16 +109,84 @@ VolumeVis::VolumeVis(const OGL4Core2::Core::Core& c)
       k_specular(0.1f),
       k_exp(120.0f),
       tfNumPoints(256),
+      tfDirtyBegin(0),
+      tfDirtyEnd(0),
+      tfEditing(false),
+      tfLastIdx(-1),
+      tfLastValue(0.0f),
+      mousePos(glm::dvec2(0.0)),
       editorHeight(200),
       colormapHeight(20),
       histoLogplot(false),
       useRandom(true),
       tfChannel(0),
       tfFilename("test.tf"),
+      usePreIntegration(true),
+      preIntDirty(true),
+      preIntStepRatio(0.0f),
+      tfVersion(0),
+      useShadows(false),
+      lightAzimuth(30.0f),
+      lightElevation(45.0f),
+      shadowAmbient(0.25f),
+      illumTex(0),
+      illumRes(0),
+      illumVolume(0),
+      illumTfVersion(-1),
+      illumLightDir(0.0f),
       histoNumBins(256),
       histoMaxBinValue(0),
+      useGpuHisto(true),
+      showHisto2D(false),
+      gpuHistoNumBins(0),
+      histo1DBuffer(0),
+      histo2DBuffer(0),
+      histo2DTex(0),
+      histoTimerQuery(0),
+      histoFence(nullptr),
+      histoGpuTime(0.0f),
+      useProgressive(true),
+      interactionScale(0.5f),
+      interactionStepFactor(2.0f),
+      progressiveMaxFrames(32),
+      progressiveFrame(0),
+      interacting(false),
+      lastRenderState(),
+      useIsoMesh(false),
+      pendingIsoValue(0.0f),
+      isoMeshValid(false),
+      isoMeshValue(0.0f),
+      isoMeshTriangles(0),
+      isoMeshActiveBricks(0),
+      isoMeshNumBricks(0),
+      isoMeshMs(0.0),
+      cpuRenderRequested(false),
+      cpuRenderFilename("cpu_reference.png"),
+      cpuRenderMs(0.0),
+      cpuRenderRmse(0.0f),
+      cpuRenderMaxDiff(0),
+      benchmarkFilename("benchmark.json"),
+      benchmarkCloseWhenDone(false),
+      benchmarkView(false),
+      benchmarkViewMx(1.0f),
+      sampleCounterBuffer(0),
+      countSamples(false),
       volumeTex(0),
-      tfTex(0) {
+      gradientTex(0),
+      gradientMaxBuffer(0),
+      tfTex(0),
+      preIntTex(0),
+      fboWidth(0),
+      fboHeight(0),
+      fboScene(0),
+      fboTexSceneColor(0),
+      fboTexSceneDepth(0),
+      fboAccum(0),
+      fboTexAccum(0),
+      fboTexAccumDepth(0),
+      fboInteract(0),
+      fboTexInteract(0),
+      fboTexInteractDepth(0) {
     // Init Camera
     camera = std::make_shared<Core::OrbitCamera>(2.0f);
     core_.registerCamera(camera);
@@ -76,9 +202,16 @@ VolumeVis::VolumeVis(const OGL4Core2::Core::Core& c)
     // Initialize shaders and vertex arrays
     initShaders();
     initVAs();
+    initGpuHisto();
+
+    glGenBuffers(1, &sampleCounterBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, sampleCounterBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), nullptr, GL_DYNAMIC_READ);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
     // Load the volume file and its transfer function
     loadVolumeFile(0);
+    initTransferFunc();
     loadTransferFunc("engine.tf");
 
     // Set OpenGL state.
@@ -87,6 +220,12 @@ VolumeVis::VolumeVis(const OGL4Core2::Core::Core& c)
     glEnable(GL_LINE_SMOOTH);
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    // Unattended runs, e.g. headless with llvmpipe, start the benchmark right away and quit afterwards.
+    if (const char* filename = std::getenv("VOLUMEVIS_BENCHMARK")) {
+        benchmarkFilename = filename;
+        startBenchmark(true);
+    }
 }
 
 /**
@@ -96,7 +235,28 @@ VolumeVis::~VolumeVis() {
     // --------------------------------------------------------------------------------
     //  TODO: Do not forget to clear all allocated sources.
     // --------------------------------------------------------------------------------
-    glDeleteTextures(1, &volumeTex);
+    cancelVolumeStats();
+    cancelIsoMesh();
+    if (pendingCpuRender.valid()) {
+        pendingCpuRender.wait();
+    }
+    // The textures of a time series are owned by the series, volumeTex is one of them.
+    if (volumeSeries != nullptr) {
+        volumeSeries.reset();
+    } else {
+        glDeleteTextures(1, &volumeTex);
+    }
+    volumeTex = 0;
+    glDeleteTextures(1, &gradientTex);
+    glDeleteTextures(1, &illumTex);
+    volumeCache.clear();
+    glDeleteBuffers(1, &gradientMaxBuffer);
+    glDeleteBuffers(1, &sampleCounterBuffer);
+    glDeleteQueries(static_cast<GLsizei>(benchmarkQueries.size()), benchmarkQueries.data());
+    glDeleteTextures(1, &tfTex);
+    glDeleteTextures(1, &preIntTex);
+    deleteFBOs();
+    deleteGpuHisto();
     // Reset OpenGL state.
     glDisable(GL_DEPTH_TEST);
     glDisable(GL_CULL_FACE);
@@ -114,12 +274,54 @@ void VolumeVis::renderGUI() {
         ImGui::SliderFloat("FoVy", &fovY, 5.0f, 90.0f);
         ImGui::ColorEdit3("Background Color", reinterpret_cast<float*>(&backgroundColor), ImGuiColorEditFlags_Float);
         ImGui::Combo("Volume", &currentFileSelection, datFilesGuiString.c_str());
+        if (volumeLoader != nullptr) {
+            ImGui::ProgressBar(volumeLoader->progress());
+            if (pendingStats.valid() && pendingStats.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                ImGui::Text("Computing statistics...");
+            }
+        }
+        ImGui::SliderFloat("Upload budget (ms)", &uploadBudget, 0.5f, 50.0f);
+        if (ImGui::SliderFloat("Cache budget (MB)", &cacheBudget, 0.0f, 4096.0f)) {
+            volumeCache.setBudget(static_cast<std::size_t>(cacheBudget) << 20);
+        }
+        ImGui::Text("Cached: %zu volumes, %.1f MB", volumeCache.size(),
+                    static_cast<double>(volumeCache.usedBytes()) / (1024.0 * 1024.0));
+        if (ImGui::Checkbox("Compress (BC4)", &useCompression)) {
+            loadVolumeFile(currentFileLoaded);
+        }
+        if (volumeCompressed) {
+            ImGui::Text("GPU: %.1f MB instead of %.1f MB (%.1fx)",
+                        static_cast<double>(compressionStats.compressedBytes) / (1024.0 * 1024.0),
+                        static_cast<double>(compressionStats.rawBytes) / (1024.0 * 1024.0), compressionStats.ratio());
+            ImGui::Text("RMSE: %.4f  Max: %.4f  PSNR: %.1f dB  Encode: %.0f ms", compressionStats.rmse,
+                        compressionStats.maxError, compressionStats.psnr, compressionStats.encodeMs);
+        }
+        if (volumeSeries != nullptr) {
+            if (ImGui::SliderInt("Time step", &timeStep, 0, static_cast<int>(volumeSeries->numSteps()) - 1)) {
+                playbackPos = static_cast<double>(timeStep);
+            }
+            ImGui::Checkbox("Play", &playing);
+            ImGui::SliderFloat("Steps/s", &playbackFps, 1.0f, 60.0f);
+            ImGui::Text("Dropped frames: %zu  Staged: %zu  Read: %.1f ms/step", droppedFrames,
+                        volumeSeries->numStaged(), volumeSeries->prefetchMs());
+        }
         // Show the resolution of the volume
         ImGui::Text("ResX: %i", volumeRes.x);
         ImGui::Text("ResY: %i", volumeRes.y);
         ImGui::Text("ResZ: %i", volumeRes.z);
+        if (volumeStats != nullptr) {
+            ImGui::Text("Min: %g  Max: %g  Mean: %g", volumeStats->minValue, volumeStats->maxValue, volumeStats->mean);
+            ImGui::Text("P1: %g  P50: %g  P99: %g", volumePercentiles.x, volumePercentiles.y, volumePercentiles.z);
+        }
         // Whether or not to use linear filtering
         ImGui::Checkbox("Lin. Filter", &useLinearFilter);
+        if (ImGui::Checkbox("Gradient texture", &useGradientTex)) {
+            computeGradientTex();
+            // The 2D histogram reads the gradients from the texture if there is one.
+            if (useGpuHisto) {
+                computeGpuHisto(histoNumBins);
+            }
+        }
         ImGui::Checkbox("ShowBox", &showBox);
         OGL4Core2::Core::ImGuiUtil::EnumCombo("Mode", viewMode,
                                               {{ViewMode::LineOfSight, "LineOfSight"},
@@ -143,20 +345,94 @@ void VolumeVis::renderGUI() {
             ImGui::SliderFloat("k_diff", &k_diffuse, 0.0f, 1.0f);
             ImGui::SliderFloat("k_spec", &k_specular, 0.0f, 1.0f);
             ImGui::SliderFloat("k_exp", &k_exp, 0.0f, 5000.0f);
+            ImGui::Checkbox("Extract mesh", &useIsoMesh);
+            if (useIsoMesh) {
+                if (pendingIsoMesh.valid()) {
+                    ImGui::Text("Extracting isosurface...");
+                }
+                if (isoMeshValid) {
+                    ImGui::Text("Triangles: %zu  Bricks: %zu / %zu  Time: %.1f ms", isoMeshTriangles,
+                                isoMeshActiveBricks, isoMeshNumBricks, isoMeshMs);
+                }
+            }
         }
         if (viewMode == ViewMode::Volume) {
             ImGui::SliderInt("editor height", &editorHeight, 0, 500);
             ImGui::Checkbox("LogPlot", &histoLogplot);
+            int bins = static_cast<int>(histoNumBins);
+            if (ImGui::InputInt("Histogram bins", &bins) && volumeStats != nullptr) {
+                int maxBins = useGpuHisto ? histo1DMaxBins : histoMaxBins;
+                auto numBins = static_cast<std::size_t>(std::clamp(bins, 1, maxBins));
+                if (useGpuHisto) {
+                    computeGpuHisto(numBins);
+                } else {
+                    genHistogram(volumeStats->histogram(numBins));
+                }
+            }
+            if (ImGui::Checkbox("GPU histogram", &useGpuHisto) && useGpuHisto) {
+                computeGpuHisto(histoNumBins);
+            }
+            if (useGpuHisto) {
+                ImGui::Checkbox("Value/gradient histogram", &showHisto2D);
+                ImGui::Text("Histogram GPU time: %.3f ms", histoGpuTime);
+            }
             ImGui::Checkbox("random offset", &useRandom);
+            ImGui::Checkbox("Pre-integration", &usePreIntegration);
+            ImGui::SliderFloat("Depth opacity", &depthOpacity, 0.01f, 1.0f);
+            ImGui::Checkbox("Shadows", &useShadows);
+            if (useShadows) {
+                ImGui::SliderFloat("Light azimuth", &lightAzimuth, -180.0f, 180.0f);
+                ImGui::SliderFloat("Light elevation", &lightElevation, -90.0f, 90.0f);
+                ImGui::SliderFloat("Shadow ambient", &shadowAmbient, 0.0f, 1.0f);
+            }
             ImGui::Combo("TF channel", &tfChannel, "red\0green\0blue\0alpha\0");
             ImGui::InputText("TF filename", &tfFilename);
         }
+        ImGui::Separator();
+        ImGui::Checkbox("Progressive", &useProgressive);
+        if (useProgressive) {
+            ImGui::SliderFloat("Interact. scale", &interactionScale, 0.1f, 1.0f);
+            ImGui::SliderFloat("Interact. step factor", &interactionStepFactor, 1.0f, 8.0f);
+            ImGui::InputInt("Refine passes", &progressiveMaxFrames);
+            progressiveMaxFrames = std::clamp(progressiveMaxFrames, 1, 1024);
+            ImGui::Text("Passes: %i / %i", progressiveFrame, progressiveMaxFrames);
+        }
+        ImGui::Separator();
+        ImGui::InputText("CPU image", &cpuRenderFilename);
+        if (pendingCpuRender.valid()) {
+            ImGui::Text("Rendering on CPU...");
+        } else if (ImGui::Button("CPU reference render") && volumeData != nullptr) {
+            cpuRenderRequested = true;
+        }
+        if (cpuRenderMs > 0.0) {
+            ImGui::Text("CPU time: %.1f ms  RMSE: %.4f  Max diff: %i", cpuRenderMs, cpuRenderRmse, cpuRenderMaxDiff);
+        }
+        ImGui::Separator();
+        ImGui::InputText("Benchmark file", &benchmarkFilename);
+        if (benchmark != nullptr) {
+            ImGui::ProgressBar(static_cast<float>(benchmark->numDone()) / static_cast<float>(benchmark->numCases()));
+            if (ImGui::Button("Stop benchmark")) {
+                finishBenchmark();
+            }
+        } else if (ImGui::Button("Run benchmark")) {
+            startBenchmark(false);
+        }
     }
     // ImGui::Combo also returns true if the same entry is selected again.
     // Only load data if value really changed.
     if (currentFileSelection != currentFileLoaded) {
         loadVolumeFile(currentFileSelection);
     }
+    // Continue a pending upload within the time budget of this frame. The volume is swapped in once the
+    // statistics, which are computed in parallel on worker threads, are also available.
+    if (volumeLoader != nullptr && volumeLoader->upload(uploadBudget) &&
+        pendingStats.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        finishVolumeLoad();
+    }
+    updateTimeSeries();
+    fetchGpuHisto();
+    updateIsoMesh();
+    finishCpuRender();
 }
 
 /**
@@ -164,49 +440,207 @@ void VolumeVis::renderGUI() {
  */
 void VolumeVis::render() {
     renderGUI();
+    uploadTransferFunc();
+    updateIllumination();
+    if (benchmark != nullptr) {
+        runBenchmarkCase();
+    }
 
     glClearColor(backgroundColor.r, backgroundColor.g, backgroundColor.b, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     float viewAspect = 1.0f;
+    glm::ivec4 viewport; // x, y, width, height
     if (viewMode == ViewMode::Volume) {
         // --------------------------------------------------------------------------------
         //  TODO: Set the viewport and viewAspect.
         // --------------------------------------------------------------------------------
-        float volumeWHeight = wHeight - editorHeight;
-        glViewport((wWidth - volumeWHeight) / 2, editorHeight, volumeWHeight, volumeWHeight);
+        int volumeWHeight = wHeight - editorHeight;
+        viewport = glm::ivec4((wWidth - volumeWHeight) / 2, editorHeight, volumeWHeight, volumeWHeight);
         viewAspect = static_cast<float>(volumeWHeight) / static_cast<float>(volumeWHeight);
     } else {
-        glViewport(0, 0, wWidth, wHeight);
+        viewport = glm::ivec4(0, 0, wWidth, wHeight);
         viewAspect = static_cast<float>(wWidth) / static_cast<float>(wHeight);
     }
+    glViewport(viewport.x, viewport.y, viewport.z, viewport.w);
     glm::mat4 orthoProjMx = glm::ortho(0.0f, 1.0f, 0.0f, 1.0f);
 
     // --------------------------------------------------------------------------------
     //  TODO: Draw (only) the volume.
     // --------------------------------------------------------------------------------
+    if (viewMode == ViewMode::Isosurface && useIsoMesh && vaIsoMesh != nullptr && isoMeshValue == isoValue) {
+        drawIsoMesh(viewAspect);
+        if (showBox) {
+            drawBox(viewAspect);
+        }
+    } else {
+        // The opaque geometry comes first, the rays end at its depth and the volume is composited over it.
+        resizeFBOs(viewport);
+        drawScene(viewport, viewAspect);
+        if (useProgressive) {
+            renderProgressive(viewport, viewAspect);
+        } else {
+            drawVolume(viewAspect, stepSize, maxSteps, useRandom && viewMode == ViewMode::Volume, 0, glm::vec2(0.0f));
+        }
+    }
+    if (cpuRenderRequested) {
+        startCpuRender(viewport, viewAspect);
+        cpuRenderRequested = false;
+    }
+
+    if (viewMode == ViewMode::Volume) {
+        // --------------------------------------------------------------------------------
+        //  TODO: Draw the transfer-function editor and histogram.
+        // --------------------------------------------------------------------------------
+        glDisable(GL_DEPTH_TEST);
+        // The histogram and the transfer function lines are drawn above the colormap preview.
+        glViewport(0, colormapHeight, wWidth, std::max(1, editorHeight - colormapHeight));
+        viewAspect = static_cast<float>(wWidth) / static_cast<float>(wHeight / 4);
+
+        if (useGpuHisto && showHisto2D) {
+            // Draw value x gradient magnitude histogram
+            shaderHisto2DView->use();
+            shaderHisto2DView->setUniform("orthoProjMx", orthoProjMx);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, histo2DTex);
+            shaderHisto2DView->setUniform("histoTex", 0);
+
+            vaQuad->draw();
+            glUseProgram(0);
+            glBindTexture(GL_TEXTURE_2D, 0);
+        } else {
+            // Draw checkerbroad background
+            shaderBackground->use();
+            shaderBackground->setUniform("orthoProjMx", orthoProjMx);
+            shaderBackground->setUniform("aspect", viewAspect);
+
+            vaQuad->draw();
+            glUseProgram(0);
+
+            // Draw histogram
+            shaderHisto->use();
+            shaderHisto->setUniform("maxBinValue", (float)histoMaxBinValue);
+            shaderHisto->setUniform("logPlot", histoLogplot);
+            shaderHisto->setUniform("orthoProjMx", orthoProjMx);
+            float binStepHalf = 1.0f / histoNumBins;
+            shaderHisto->setUniform("binStepHalf", binStepHalf);
+
+            if (vaHisto != nullptr) {
+                vaHisto->draw();
+            }
+            glUseProgram(0);
+        }
+
+        // Draw transfer function lines, the selected channel on top
+        if (vaTransferFunc != nullptr) {
+            shaderTfLines->use();
+            shaderTfLines->setUniform("orthoProjMx", orthoProjMx);
+            for (int i = 1; i <= 4; i++) {
+                int channel = (tfChannel + i) % 4;
+                shaderTfLines->setUniform("channel", channel);
+                shaderTfLines->setUniform("selected", channel == tfChannel);
+                vaTransferFunc->draw();
+            }
+            glUseProgram(0);
+        }
+
+        // Draw colormap preview
+        glViewport(0, 0, wWidth, colormapHeight);
+        shaderTfView->use();
+        shaderTfView->setUniform("orthoProjMx", orthoProjMx);
+        shaderTfView->setUniform("aspect", static_cast<float>(wWidth) / static_cast<float>(std::max(1, colormapHeight)));
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_1D, tfTex);
+        shaderTfView->setUniform("tex", 0);
+        vaQuad->draw();
+        glUseProgram(0);
+        glBindTexture(GL_TEXTURE_1D, 0);
+        glEnable(GL_DEPTH_TEST);
+    }
+}
+
+/**
+ * @brief VolumeVis resize callback.
+ * @param width  The current width of the window
+ * @param height The current height of the window
+ */
+void VolumeVis::resize(int width, int height) {
+    if (width > 0 && height > 0) {
+        wWidth = width;
+        wHeight = height;
+    }
+}
+
+/**
+ * @brief Draw the volume into the currently bound framebuffer and viewport. The volume is composited over the
+ * scene drawn by drawScene(), and the depth of the first opaque hit is written, so later geometry intersects it.
+ * @param viewAspect    Aspect ratio of the viewport
+ * @param rayStepSize   Step size along the rays
+ * @param rayMaxSteps   Maximum number of steps along the rays
+ * @param jitter        Randomly offset the ray start within one step
+ * @param seed          Seed for the random ray offset
+ * @param pixelJitter   Sub-pixel offset of the rays in texture coordinates
+ */
+void VolumeVis::drawVolume(float viewAspect, float rayStepSize, int rayMaxSteps, bool jitter, unsigned int seed,
+                           const glm::vec2& pixelJitter) {
+    glm::mat4 orthoProjMx = glm::ortho(0.0f, 1.0f, 0.0f, 1.0f);
+
+    float refStep = referenceStep();
+    if (viewMode == ViewMode::Volume && usePreIntegration) {
+        updatePreIntegration(rayStepSize / refStep);
+    }
+
     shaderVolume->use();
 
     shaderVolume->setUniform("orthoProjMx", orthoProjMx);
 
+    bindVolumeTex(*shaderVolume);
+
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_3D, gradientTex);
+    shaderVolume->setUniform("gradientTex", 2);
+    shaderVolume->setUniform("useGradientTex", gradientTex != 0);
+
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_1D, tfTex);
+    shaderVolume->setUniform("transferTex", 1);
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D, preIntTex);
+    shaderVolume->setUniform("preIntTex", 3);
+    shaderVolume->setUniform("usePreIntegration", usePreIntegration);
+    shaderVolume->setUniform("refStep", refStep);
+    glActiveTexture(GL_TEXTURE0 + sceneColorTexUnit);
+    glBindTexture(GL_TEXTURE_2D, fboTexSceneColor);
+    shaderVolume->setUniform("sceneColorTex", sceneColorTexUnit);
+    glActiveTexture(GL_TEXTURE0 + sceneDepthTexUnit);
+    glBindTexture(GL_TEXTURE_2D, fboTexSceneDepth);
+    shaderVolume->setUniform("sceneDepthTex", sceneDepthTexUnit);
+    shaderVolume->setUniform("depthOpacity", depthOpacity);
+    bool shadows = useShadows && illumTex != 0 && illumVolume == volumeTex;
+    glActiveTexture(GL_TEXTURE0 + illumTexUnit);
+    glBindTexture(GL_TEXTURE_3D, shadows ? illumTex : 0);
+    shaderVolume->setUniform("illumTex", illumTexUnit);
+    shaderVolume->setUniform("useShadows", shadows);
+    shaderVolume->setUniform("shadowAmbient", shadowAmbient);
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_3D, volumeTex);
-    shaderVolume->setUniform("volumeTex", 0);
 
     glm::mat4 projMx = glm::perspective(glm::radians(fovY), viewAspect, 1.0f, 50.0f);
-    shaderVolume->setUniform("invViewMx", inverse(camera->viewMx()));
-    shaderVolume->setUniform("invViewProjMx", inverse(camera->viewMx()) * inverse(projMx));
+    shaderVolume->setUniform("invViewMx", inverse(viewMx()));
+    shaderVolume->setUniform("invViewProjMx", inverse(viewMx()) * inverse(projMx));
+    shaderVolume->setUniform("viewProjMx", projMx * viewMx());
 
     shaderVolume->setUniform("volumeRes", (glm::vec3)volumeRes);
     shaderVolume->setUniform("volumeDim", volumeDim);
-    
+
     shaderVolume->setUniform("viewMode", (int)viewMode);
-    shaderVolume->setUniform("showBox", showBox);
-    shaderVolume->setUniform("useRandom", useRandom);
+    shaderVolume->setUniform("useRandom", jitter);
+    shaderVolume->setUniform("seed", seed);
+    shaderVolume->setUniform("pixelJitter", pixelJitter);
 
-    shaderVolume->setUniform("maxSteps", maxSteps);
-    shaderVolume->setUniform("stepSize", stepSize);
+    shaderVolume->setUniform("maxSteps", rayMaxSteps);
+    shaderVolume->setUniform("stepSize", rayStepSize);
     shaderVolume->setUniform("scale", scale);
+    shaderVolume->setUniform("valueRange", valueRange);
 
     shaderVolume->setUniform("isovalue", isoValue);
 
@@ -219,50 +653,586 @@ void VolumeVis::render() {
     shaderVolume->setUniform("k_spec", k_specular);
     shaderVolume->setUniform("k_exp", k_exp);
 
+    shaderVolume->setUniform("countSamples", countSamples);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, sampleCounterBuffer);
+
+    // Every fragment writes its depth, the one of the volume or the one of the scene behind it.
+    glDepthFunc(GL_ALWAYS);
     vaQuad->draw();
+    glDepthFunc(GL_LESS);
     glUseProgram(0);
+    glActiveTexture(GL_TEXTURE0 + illumTexUnit);
+    glBindTexture(GL_TEXTURE_3D, 0);
+    glActiveTexture(GL_TEXTURE0 + sceneDepthTexUnit);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0 + sceneColorTexUnit);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_3D, 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_1D, 0);
+    glActiveTexture(GL_TEXTURE0 + compressedTexUnit);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_3D, 0);
+}
 
-    if (viewMode == ViewMode::Volume) {
-        // --------------------------------------------------------------------------------
-        //  TODO: Draw the transfer-function editor and histogram.
-        // --------------------------------------------------------------------------------
-        glDisable(GL_DEPTH_TEST);
-        glViewport(0, 0, wWidth, editorHeight);
-        viewAspect = static_cast<float>(wWidth) / static_cast<float>(wHeight / 4);
+/**
+ * @brief Progressive refinement of the volume image.
+ * While the render state changes, a cheap image with reduced resolution and step count is drawn. Once the state
+ * is stable, full quality passes with sub-pixel jitter are averaged in a float target until progressiveMaxFrames is
+ * reached. Like the direct rendering they offset the ray starts randomly only if useRandom is set.
+ * Afterwards the converged image is only shown again.
+ * @param viewport      The viewport of the volume: x, y, width, height
+ * @param viewAspect    Aspect ratio of the viewport
+ */
+void VolumeVis::renderProgressive(const glm::ivec4& viewport, float viewAspect) {
+    if (fboAccum == 0) {
+        return;
+    }
 
-        // Draw checkerbroad background
-        shaderBackground->use();
-        shaderBackground->setUniform("orthoProjMx", orthoProjMx);
-        shaderBackground->setUniform("aspect", viewAspect);
+    RenderState state = currentRenderState(viewport);
+    interacting = state != lastRenderState || core_.isMouseButtonPressed(Core::MouseButton::Left);
+    if (state != lastRenderState) {
+        lastRenderState = state;
+        progressiveFrame = 0;
+    }
 
-        vaQuad->draw();
-        glUseProgram(0);
+    glm::vec2 texScale(1.0f);
+    GLuint resultTex = fboTexAccum;
+    GLuint resultDepthTex = fboTexAccumDepth;
+    if (interacting) {
+        int width = std::max(1, static_cast<int>(static_cast<float>(fboWidth) * interactionScale));
+        int height = std::max(1, static_cast<int>(static_cast<float>(fboHeight) * interactionScale));
+        texScale = glm::vec2(static_cast<float>(width) / static_cast<float>(fboWidth),
+                             static_cast<float>(height) / static_cast<float>(fboHeight));
+        resultTex = fboTexInteract;
+        resultDepthTex = fboTexInteractDepth;
 
-        // Draw histogram
-        shaderHisto->use();
-        shaderHisto->setUniform("maxBinValue", (float)histoMaxBinValue);
-        shaderHisto->setUniform("logPlot", histoLogplot);
-        shaderHisto->setUniform("orthoProjMx", orthoProjMx);
-        float binStepHalf = 1.0f / histoNumBins;
-        shaderHisto->setUniform("binStepHalf", binStepHalf);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fboInteract);
+        glViewport(0, 0, width, height);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        int steps = std::max(1, static_cast<int>(static_cast<float>(maxSteps) / interactionStepFactor));
+        drawVolume(viewAspect, stepSize * interactionStepFactor, steps, false, 0, glm::vec2(0.0f));
+        // The accumulated image is outdated now.
+        progressiveFrame = 0;
+    } else if (progressiveFrame < progressiveMaxFrames) {
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fboAccum);
+        glViewport(0, 0, fboWidth, fboHeight);
+        if (progressiveFrame == 0) {
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        }
+        // Depth is not averaged, the unjittered first pass provides it.
+        glDepthMask(progressiveFrame == 0 ? GL_TRUE : GL_FALSE);
+        // Running average: new = old + (pass - old) / (n + 1)
+        glBlendColor(0.0f, 0.0f, 0.0f, 1.0f / static_cast<float>(progressiveFrame + 1));
+        glBlendFunc(GL_CONSTANT_ALPHA, GL_ONE_MINUS_CONSTANT_ALPHA);
+        glm::vec2 pixelJitter((halton(progressiveFrame + 1, 2) - 0.5f) / static_cast<float>(fboWidth),
+                              (halton(progressiveFrame + 1, 3) - 0.5f) / static_cast<float>(fboHeight));
+        if (progressiveFrame == 0) {
+            pixelJitter = glm::vec2(0.0f);
+        }
+        drawVolume(viewAspect, stepSize, maxSteps, useRandom && viewMode == ViewMode::Volume,
+                   static_cast<unsigned int>(progressiveFrame), pixelJitter);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glDepthMask(GL_TRUE);
+        progressiveFrame++;
+    }
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
 
-        vaHisto->draw();
-        glUseProgram(0);
-        glEnable(GL_DEPTH_TEST);
+    // Show result
+    glViewport(viewport.x, viewport.y, viewport.z, viewport.w);
+    shaderBlit->use();
+    shaderBlit->setUniform("orthoProjMx", glm::ortho(0.0f, 1.0f, 0.0f, 1.0f));
+    shaderBlit->setUniform("texScale", texScale);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, resultTex);
+    shaderBlit->setUniform("tex", 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, resultDepthTex);
+    shaderBlit->setUniform("depthTex", 1);
+    glDepthFunc(GL_ALWAYS);
+    vaQuad->draw();
+    glDepthFunc(GL_LESS);
+    glUseProgram(0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+/**
+ * @brief Draw the opaque geometry in front of and behind the volume into the scene target: the box lines for now.
+ * @param viewport      The viewport of the volume: x, y, width, height
+ * @param viewAspect    Aspect ratio of the viewport
+ */
+void VolumeVis::drawScene(const glm::ivec4& viewport, float viewAspect) {
+    if (fboScene == 0) {
+        return;
     }
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fboScene);
+    glViewport(0, 0, fboWidth, fboHeight);
+    glClearColor(backgroundColor.r, backgroundColor.g, backgroundColor.b, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    if (showBox) {
+        drawBox(viewAspect);
+    }
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glViewport(viewport.x, viewport.y, viewport.z, viewport.w);
 }
 
 /**
- * @brief VolumeVis resize callback.
- * @param width  The current width of the window
- * @param height The current height of the window
+ * @brief Draw the edges of the volume box as lines.
+ * @param viewAspect    Aspect ratio of the viewport
  */
-void VolumeVis::resize(int width, int height) {
-    if (width > 0 && height > 0) {
-        wWidth = width;
-        wHeight = height;
+void VolumeVis::drawBox(float viewAspect) {
+    glm::mat4 projMx = glm::perspective(glm::radians(fovY), viewAspect, 1.0f, 50.0f);
+    shaderBox->use();
+    shaderBox->setUniform("projMx", projMx);
+    shaderBox->setUniform("viewMx", viewMx());
+    shaderBox->setUniform("volumeDim", volumeDim);
+    shaderBox->setUniform("color", glm::vec3(1.0f, 1.0f, 0.0f));
+    vaBox->draw();
+    glUseProgram(0);
+}
+
+/**
+ * @brief Collect the current render state.
+ * @param viewport      The viewport of the volume
+ */
+VolumeVis::RenderState VolumeVis::currentRenderState(const glm::ivec4& viewport) const {
+    RenderState state;
+    state.viewMx = viewMx();
+    state.viewport = viewport;
+    state.fovY = fovY;
+    state.volume = volumeTex;
+    state.gradient = gradientTex;
+    state.linearFilter = useLinearFilter;
+    state.tfVersion = tfVersion;
+    state.preIntegration = usePreIntegration;
+    state.viewMode = viewMode;
+    state.showBox = showBox;
+    state.backgroundColor = backgroundColor;
+    state.depthOpacity = depthOpacity;
+    state.shadows = useShadows;
+    state.light = glm::vec4(lightDirection(), shadowAmbient);
+    state.maxSteps = maxSteps;
+    state.stepSize = stepSize;
+    state.random = useRandom;
+    state.scale = scale;
+    state.isoValue = isoValue;
+    state.ambientColor = ambientColor;
+    state.diffuseColor = diffuseColor;
+    state.specularColor = specularColor;
+    state.k = glm::vec4(k_ambient, k_diffuse, k_specular, k_exp);
+    return state;
+}
+
+/**
+ * @brief Draw the extracted isosurface with the Blinn-Phong parameters of the raycaster.
+ * @param viewAspect    Aspect ratio of the viewport
+ */
+void VolumeVis::drawIsoMesh(float viewAspect) {
+    glm::mat4 projMx = glm::perspective(glm::radians(fovY), viewAspect, 1.0f, 50.0f);
+    // The surface is open at the volume border, the raycaster shades both sides as well.
+    glDisable(GL_CULL_FACE);
+    shaderIsoSurface->use();
+    shaderIsoSurface->setUniform("projMx", projMx);
+    shaderIsoSurface->setUniform("viewMx", viewMx());
+    shaderIsoSurface->setUniform("cameraPos", glm::vec3(inverse(viewMx()) * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)));
+
+    shaderIsoSurface->setUniform("ambient", ambientColor);
+    shaderIsoSurface->setUniform("diffuse", diffuseColor);
+    shaderIsoSurface->setUniform("specular", specularColor);
+
+    shaderIsoSurface->setUniform("k_amb", k_ambient);
+    shaderIsoSurface->setUniform("k_diff", k_diffuse);
+    shaderIsoSurface->setUniform("k_spec", k_specular);
+    shaderIsoSurface->setUniform("k_exp", k_exp);
+
+    vaIsoMesh->draw();
+    glUseProgram(0);
+    glEnable(GL_CULL_FACE);
+}
+
+/**
+ * @brief Take over a finished isosurface extraction and start a new one if the isovalue changed.
+ * While an extraction is running, the raycaster shows the surface. An extraction for an outdated isovalue is
+ * stopped, so dragging the isovalue does not queue up work.
+ */
+void VolumeVis::updateIsoMesh() {
+    if (pendingIsoMesh.valid() && pendingIsoMesh.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        IsoMesh mesh = pendingIsoMesh.get();
+        isoMeshCancel.reset();
+        if (!mesh.cancelled && shownStepDerived) {
+            vaIsoMesh.reset();
+            if (!mesh.indices.empty()) {
+                glowl::VertexLayout layout{{0}, {{3, GL_FLOAT, GL_FALSE, 0}, {3, GL_FLOAT, GL_FALSE, 0}}};
+                vaIsoMesh = std::make_unique<glowl::Mesh>(std::vector<std::vector<float>>{mesh.positions, mesh.normals},
+                                                          mesh.indices, layout, GL_UNSIGNED_INT, GL_STATIC_DRAW,
+                                                          GL_TRIANGLES);
+            }
+            isoMeshValid = true;
+            isoMeshValue = mesh.isoValue;
+            isoMeshTriangles = mesh.indices.size() / 3;
+            isoMeshActiveBricks = mesh.activeBricks;
+            isoMeshNumBricks = mesh.numBricks;
+            isoMeshMs = mesh.extractMs;
+        }
+    }
+
+    if (!useIsoMesh || viewMode != ViewMode::Isosurface || isoExtractor == nullptr || !shownStepDerived) {
+        return;
+    }
+    if (pendingIsoMesh.valid()) {
+        if (pendingIsoValue != isoValue) {
+            *isoMeshCancel = true;
+        }
+        return;
+    }
+    if (!isoMeshValid || isoMeshValue != isoValue) {
+        pendingIsoValue = isoValue;
+        isoMeshCancel = std::make_shared<std::atomic<bool>>(false);
+        pendingIsoMesh = std::async(std::launch::async,
+                                    [extractor = isoExtractor, iso = isoValue, cancel = isoMeshCancel]() {
+                                        return extractor->extract(iso, cancel.get());
+                                    });
+    }
+}
+
+/**
+ * @brief Stop a pending isosurface extraction and wait for the workers.
+ */
+void VolumeVis::cancelIsoMesh() {
+    if (isoMeshCancel != nullptr) {
+        *isoMeshCancel = true;
+    }
+    if (pendingIsoMesh.valid()) {
+        pendingIsoMesh.wait();
+        pendingIsoMesh = {};
+    }
+    isoMeshCancel.reset();
+}
+
+/**
+ * @brief Length of the reference step, transfer function opacities refer to a step of one voxel.
+ */
+float VolumeVis::referenceStep() const {
+    return 1.0f / static_cast<float>(std::max(std::max(volumeRes.x, volumeRes.y), std::max(volumeRes.z, 1u)));
+}
+
+/**
+ * @brief Start a CPU reference render of the current view on a worker thread.
+ * The GPU image is drawn again without random offset and jitter for the comparison, as the CPU raycaster
+ * traces the rays through the pixel centers.
+ * @param viewport      The viewport of the volume: x, y, width, height
+ * @param viewAspect    Aspect ratio of the viewport
+ */
+void VolumeVis::startCpuRender(const glm::ivec4& viewport, float viewAspect) {
+    if (volumeData == nullptr || pendingCpuRender.valid() || viewport.z <= 0 || viewport.w <= 0) {
+        return;
+    }
+
+    // The volume is composited over the scene with the background and box lines, like in the CPU image.
+    resizeFBOs(viewport);
+    drawScene(viewport, viewAspect);
+    drawVolume(viewAspect, stepSize, maxSteps, false, 0, glm::vec2(0.0f));
+    cpuRenderGpuImage.resize(static_cast<std::size_t>(viewport.z) * viewport.w * 4);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(viewport.x, viewport.y, viewport.z, viewport.w, GL_RGBA, GL_UNSIGNED_BYTE, cpuRenderGpuImage.data());
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+    glm::mat4 projMx = glm::perspective(glm::radians(fovY), viewAspect, 1.0f, 50.0f);
+    CpuRaycaster::Params params;
+    params.invViewMx = inverse(viewMx());
+    params.invViewProjMx = inverse(viewMx()) * inverse(projMx);
+    params.volumeDim = volumeDim;
+    params.valueRange = valueRange;
+    params.viewMode = static_cast<int>(viewMode);
+    params.showBox = showBox;
+    params.maxSteps = maxSteps;
+    params.stepSize = stepSize;
+    params.scale = scale;
+    params.isoValue = isoValue;
+    params.ambient = ambientColor;
+    params.diffuse = diffuseColor;
+    params.specular = specularColor;
+    params.k = glm::vec4(k_ambient, k_diffuse, k_specular, k_exp);
+    params.background = backgroundColor;
+    params.tf = tfData;
+    params.preIntegration = usePreIntegration;
+    params.refStep = referenceStep();
+    params.preIntMaxSize = preIntMaxSize;
+
+    pendingCpuRender = std::async(std::launch::async, [raycaster = CpuRaycaster(volumeData, volumeType, volumeRes),
+                                                       params = std::move(params), width = viewport.z,
+                                                       height = viewport.w]() {
+        return raycaster.render(params, width, height);
+    });
+}
+
+/**
+ * @brief Compare a finished CPU reference render with the GPU image and save it as PNG.
+ */
+void VolumeVis::finishCpuRender() {
+    if (!pendingCpuRender.valid() || pendingCpuRender.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        return;
+    }
+    CpuRaycaster::Image image = pendingCpuRender.get();
+    cpuRenderMs = image.renderMs;
+
+    double sumSq = 0.0;
+    std::size_t numValues = 0;
+    cpuRenderMaxDiff = 0;
+    if (cpuRenderGpuImage.size() == image.rgba.size()) {
+        for (std::size_t i = 0; i < image.rgba.size(); i++) {
+            if (i % 4 == 3) {
+                continue;
+            }
+            int diff = std::abs(static_cast<int>(image.rgba[i]) - static_cast<int>(cpuRenderGpuImage[i]));
+            cpuRenderMaxDiff = std::max(cpuRenderMaxDiff, diff);
+            sumSq += static_cast<double>(diff) * diff;
+            numValues++;
+        }
     }
+    cpuRenderRmse = numValues > 0 ? static_cast<float>(std::sqrt(sumSq / static_cast<double>(numValues)) / 255.0)
+                                  : 0.0f;
+
+    // PNG rows go from top to bottom.
+    std::size_t rowBytes = static_cast<std::size_t>(image.width) * 4;
+    std::vector<unsigned char> png(image.rgba.size());
+    for (int y = 0; y < image.height; y++) {
+        std::copy_n(&image.rgba[static_cast<std::size_t>(y) * rowBytes], rowBytes,
+                    &png[static_cast<std::size_t>(image.height - 1 - y) * rowBytes]);
+    }
+    unsigned int error = lodepng::encode(cpuRenderFilename, png, static_cast<unsigned int>(image.width),
+                                         static_cast<unsigned int>(image.height));
+    if (error != 0) {
+        std::cerr << "Cannot save CPU image: " << lodepng_error_text(error) << std::endl;
+        return;
+    }
+    std::cout << "Save CPU image: " << cpuRenderFilename << " (" << cpuRenderMs << " ms, RMSE " << cpuRenderRmse
+              << ")" << std::endl;
+}
+
+/**
+ * @brief View matrix of the rendered image: the camera, or the orbit position of a running benchmark.
+ */
+glm::mat4 VolumeVis::viewMx() const {
+    return benchmarkView ? benchmarkViewMx : camera->viewMx();
+}
+
+/**
+ * @brief Start the default benchmark sweep over all volume files. The transfer function, isovalue and the
+ * toggles of the GUI are kept, so runs with different features can be compared.
+ * @param closeWhenDone    Close the window once the results are written
+ */
+void VolumeVis::startBenchmark(bool closeWhenDone) {
+    std::vector<std::string> names;
+    for (const auto& file : datFiles) {
+        names.push_back(file.stem().string());
+    }
+    benchmark = std::make_unique<RaycastBenchmark>(RaycastBenchmark::defaultSweep(std::move(names)));
+    benchmarkCloseWhenDone = closeWhenDone;
+    if (benchmarkQueries.size() < static_cast<std::size_t>(benchmark->numOrbitSteps())) {
+        glDeleteQueries(static_cast<GLsizei>(benchmarkQueries.size()), benchmarkQueries.data());
+        benchmarkQueries.assign(benchmark->numOrbitSteps(), 0);
+        glGenQueries(static_cast<GLsizei>(benchmarkQueries.size()), benchmarkQueries.data());
+    }
+}
+
+/**
+ * @brief Run the current benchmark case from all orbit positions, called once per frame.
+ * The volume of the case is loaded first. For each position the scene is drawn, then an untimed volume pass
+ * counts the samples and warms up the caches, and a second pass is timed. Only the volume pass is timed. The
+ * progressive render targets serve as render targets, they are resized to the resolution of the case.
+ */
+void VolumeVis::runBenchmarkCase() {
+    const RaycastBenchmark::Case& c = benchmark->current();
+    if (static_cast<int>(c.volume) != currentFileLoaded) {
+        currentFileSelection = static_cast<int>(c.volume);
+        return;
+    }
+    if (volumeLoader != nullptr || volumeTex == 0) {
+        return;
+    }
+
+    ViewMode userViewMode = viewMode;
+    viewMode = static_cast<ViewMode>(c.viewMode);
+    glm::ivec4 viewport(0, 0, c.resolution.x, c.resolution.y);
+    float viewAspect = static_cast<float>(c.resolution.x) / static_cast<float>(c.resolution.y);
+    resizeFBOs(viewport);
+
+    RaycastBenchmark::Result result{{}, 0, 0};
+    benchmarkView = true;
+    for (int i = 0; i < benchmark->numOrbitSteps(); i++) {
+        benchmarkViewMx = benchmark->orbitViewMx(i, 2.0f);
+        drawScene(viewport, viewAspect);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fboInteract);
+        glViewport(0, 0, c.resolution.x, c.resolution.y);
+
+        GLuint numSamples = 0;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, sampleCounterBuffer);
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &numSamples);
+        countSamples = true;
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        drawVolume(viewAspect, c.stepSize, c.maxSteps, false, 0, glm::vec2(0.0f));
+        countSamples = false;
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, sampleCounterBuffer);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &numSamples);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        result.numSamples += numSamples;
+        result.numPixels += static_cast<std::uint64_t>(c.resolution.x) * c.resolution.y;
+
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glBeginQuery(GL_TIME_ELAPSED, benchmarkQueries[i]);
+        drawVolume(viewAspect, c.stepSize, c.maxSteps, false, 0, glm::vec2(0.0f));
+        glEndQuery(GL_TIME_ELAPSED);
+    }
+    benchmarkView = false;
+    viewMode = userViewMode;
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+
+    for (int i = 0; i < benchmark->numOrbitSteps(); i++) {
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(benchmarkQueries[i], GL_QUERY_RESULT, &elapsed);
+        result.gpuMs.push_back(static_cast<double>(elapsed) * 1.0e-6);
+    }
+    benchmark->record(std::move(result));
+    if (benchmark->done()) {
+        finishBenchmark();
+    }
+}
+
+/**
+ * @brief Write the results of the finished cases and end the benchmark.
+ */
+void VolumeVis::finishBenchmark() {
+    const auto* renderer = reinterpret_cast<const char*>(glGetString(GL_RENDERER));
+    std::vector<std::pair<std::string, bool>> features{{"linearFilter", useLinearFilter},
+                                                       {"gradientTex", gradientTex != 0},
+                                                       {"preIntegration", usePreIntegration},
+                                                       {"shadows", useShadows},
+                                                       {"compression", volumeCompressed},
+                                                       {"showBox", showBox}};
+    try {
+        benchmark->write(benchmarkFilename, renderer != nullptr ? renderer : "", features);
+        std::cout << "Save benchmark: " << benchmarkFilename << " (" << benchmark->numDone() << " cases)" << std::endl;
+    } catch (std::exception& e) {
+        std::cerr << "Cannot save benchmark: " << e.what() << std::endl;
+    }
+    benchmark.reset();
+    if (benchmarkCloseWhenDone) {
+        core_.requestClose();
+    }
+}
+
+/**
+ * @brief Recreate the render targets if the size of the volume viewport changed.
+ * @param viewport      The viewport of the volume: x, y, width, height
+ */
+void VolumeVis::resizeFBOs(const glm::ivec4& viewport) {
+    if (viewport.z != fboWidth || viewport.w != fboHeight) {
+        deleteFBOs();
+        fboWidth = viewport.z;
+        fboHeight = viewport.w;
+        initFBOs();
+    }
+}
+
+/**
+ * @brief Initialize the scene target and the render targets for progressive refinement.
+ */
+void VolumeVis::initFBOs() {
+    if (fboWidth <= 0 || fboHeight <= 0) {
+        return;
+    }
+
+    glGenFramebuffers(1, &fboScene);
+    glBindFramebuffer(GL_FRAMEBUFFER, fboScene);
+    fboTexSceneColor = createFBOTexture(fboWidth, fboHeight, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, GL_NEAREST);
+    fboTexSceneDepth =
+        createFBOTexture(fboWidth, fboHeight, GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT, GL_NEAREST);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, fboTexSceneColor, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, fboTexSceneDepth, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "Scene FBO is incomplete." << std::endl;
+    }
+
+    glGenFramebuffers(1, &fboAccum);
+    glBindFramebuffer(GL_FRAMEBUFFER, fboAccum);
+    fboTexAccum = createFBOTexture(fboWidth, fboHeight, GL_RGBA32F, GL_RGBA, GL_FLOAT, GL_NEAREST);
+    fboTexAccumDepth =
+        createFBOTexture(fboWidth, fboHeight, GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT, GL_NEAREST);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, fboTexAccum, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, fboTexAccumDepth, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "Accumulation FBO is incomplete." << std::endl;
+    }
+
+    glGenFramebuffers(1, &fboInteract);
+    glBindFramebuffer(GL_FRAMEBUFFER, fboInteract);
+    fboTexInteract = createFBOTexture(fboWidth, fboHeight, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, GL_LINEAR);
+    fboTexInteractDepth =
+        createFBOTexture(fboWidth, fboHeight, GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT, GL_NEAREST);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, fboTexInteract, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, fboTexInteractDepth, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "Interaction FBO is incomplete." << std::endl;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    progressiveFrame = 0;
+}
+
+/**
+ * @brief Delete the scene target and the render targets for progressive refinement.
+ */
+void VolumeVis::deleteFBOs() {
+    glDeleteFramebuffers(1, &fboScene);
+    glDeleteFramebuffers(1, &fboAccum);
+    glDeleteFramebuffers(1, &fboInteract);
+    glDeleteTextures(1, &fboTexSceneColor);
+    glDeleteTextures(1, &fboTexSceneDepth);
+    glDeleteTextures(1, &fboTexAccum);
+    glDeleteTextures(1, &fboTexAccumDepth);
+    glDeleteTextures(1, &fboTexInteract);
+    glDeleteTextures(1, &fboTexInteractDepth);
+    fboScene = 0;
+    fboAccum = 0;
+    fboInteract = 0;
+    fboTexSceneColor = 0;
+    fboTexSceneDepth = 0;
+    fboTexAccum = 0;
+    fboTexAccumDepth = 0;
+    fboTexInteract = 0;
+    fboTexInteractDepth = 0;
+}
+
+/**
+ * @brief Create a texture for use in the framebuffer object.
+ * @param width            Texture width
+ * @param height           Texture height
+ * @param internalFormat   Internal format of the texture
+ * @param format           Format of the data: GL_RGB,...
+ * @param type             Data type: GL_UNSIGNED_BYTE, GL_FLOAT,...
+ * @param filter           Texture filter: GL_LINEAR or GL_NEAREST
+ * @return texture handle
+ */
+GLuint VolumeVis::createFBOTexture(int width, int height, GLenum internalFormat, GLenum format, GLenum type,
+                                   GLint filter) {
+    GLuint texId = 0;
+    glGenTextures(1, &texId);
+    glBindTexture(GL_TEXTURE_2D, texId);
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return texId;
 }
 
 /**
@@ -280,6 +1250,7 @@ void VolumeVis::keyboard(Core::Key key, Core::KeyAction action, [[maybe_unused]]
         case Core::Key::F5: {
             // reload shaders
             initShaders();
+            progressiveFrame = 0;
             break;
         }
         case Core::Key::Key1: {
@@ -337,6 +1308,46 @@ void VolumeVis::keyboard(Core::Key key, Core::KeyAction action, [[maybe_unused]]
     // --------------------------------------------------------------------------------
     //  TODO: Add keyboard functionality for transfer function editor.
     // --------------------------------------------------------------------------------
+    // 0 clears the selected channel, Shift+0 fills it.
+    if (key == Core::Key::Key0 && viewMode == ViewMode::Volume) {
+        updateTransferFunc(tfChannel, mods.shift() ? 1.0f : 0.0f);
+    }
+}
+
+/**
+ * @brief VolumeVis mouse button callback.
+ * Ctrl + left button in the histogram panel starts editing the selected transfer function channel, without
+ * modifiers the camera would be moved.
+ * @param button   The mouse button
+ * @param action   Press or release
+ * @param mods     The modifier keys
+ */
+void VolumeVis::mouseButton(Core::MouseButton button, Core::MouseButtonAction action, Core::Mods mods) {
+    if (button != Core::MouseButton::Left) {
+        return;
+    }
+    if (action == Core::MouseButtonAction::Release) {
+        tfEditing = false;
+        return;
+    }
+    glm::vec2 pos = editorCoords(mousePos.x, mousePos.y);
+    if (viewMode == ViewMode::Volume && mods.onlyControl() && pos.x >= 0.0f && pos.x <= 1.0f && pos.y >= 0.0f &&
+        pos.y <= 1.0f) {
+        tfEditing = true;
+        tfLastIdx = -1;
+        mouseMove(mousePos.x, mousePos.y);
+    }
+}
+
+/**
+ * @brief Position in the histogram panel, [0, 1] inside.
+ * @param xpos     The x position of the mouse cursor, relative to the left window border
+ * @param ypos     The y position of the mouse cursor, relative to the top window border
+ */
+glm::vec2 VolumeVis::editorCoords(double xpos, double ypos) const {
+    double panelHeight = std::max(1, editorHeight - colormapHeight);
+    return glm::vec2(xpos / static_cast<double>(wWidth),
+                     (static_cast<double>(wHeight - colormapHeight) - ypos) / panelHeight);
 }
 
 /**
@@ -350,6 +1361,25 @@ void VolumeVis::mouseMove(double xpos, double ypos) {
     // --------------------------------------------------------------------------------
     //  TODO: Implement editing of transfer function.
     // --------------------------------------------------------------------------------
+    mousePos = glm::dvec2(xpos, ypos);
+    if (!tfEditing || viewMode != ViewMode::Volume) {
+        return;
+    }
+    glm::vec2 pos = glm::clamp(editorCoords(xpos, ypos), glm::vec2(0.0f), glm::vec2(1.0f));
+    int idx = static_cast<int>(std::round(pos.x * static_cast<float>(tfNumPoints - 1)));
+    if (tfLastIdx < 0) {
+        tfLastIdx = idx;
+        tfLastValue = pos.y;
+    }
+    // Fill all entries between the last and the current position, fast drags would leave gaps otherwise.
+    int steps = std::abs(idx - tfLastIdx);
+    for (int i = 0; i <= steps; i++) {
+        float t = steps == 0 ? 1.0f : static_cast<float>(i) / static_cast<float>(steps);
+        int j = tfLastIdx + (idx > tfLastIdx ? i : -i);
+        updateTransferFunc(j, tfChannel, tfLastValue + t * (pos.y - tfLastValue));
+    }
+    tfLastIdx = idx;
+    tfLastValue = pos.y;
 }
 
 /**
@@ -363,6 +1393,13 @@ void VolumeVis::initShaders() {
             {glowl::GLSLProgram::ShaderType::Fragment, getStringResource("shaders/volume.frag")}});
     } catch (glowl::GLSLProgramException& e) { std::cerr << e.what() << std::endl; }
 
+    // Initialize shader for the isosurface mesh
+    try {
+        shaderIsoSurface = std::make_unique<glowl::GLSLProgram>(glowl::GLSLProgram::ShaderSourceList{
+            {glowl::GLSLProgram::ShaderType::Vertex, getStringResource("shaders/isosurface.vert")},
+            {glowl::GLSLProgram::ShaderType::Fragment, getStringResource("shaders/isosurface.frag")}});
+    } catch (glowl::GLSLProgramException& e) { std::cerr << e.what() << std::endl; }
+
     // Initialize shader for background
     try {
         shaderBackground = std::make_unique<glowl::GLSLProgram>(glowl::GLSLProgram::ShaderSourceList{
@@ -391,6 +1428,56 @@ void VolumeVis::initShaders() {
             {glowl::GLSLProgram::ShaderType::Vertex, getStringResource("shaders/tf-view.vert")},
             {glowl::GLSLProgram::ShaderType::Fragment, getStringResource("shaders/tf-view.frag")}});
     } catch (glowl::GLSLProgramException& e) { std::cerr << e.what() << std::endl; }
+
+    // Initialize shader for showing the progressive render targets
+    try {
+        shaderBlit = std::make_unique<glowl::GLSLProgram>(glowl::GLSLProgram::ShaderSourceList{
+            {glowl::GLSLProgram::ShaderType::Vertex, getStringResource("shaders/blit.vert")},
+            {glowl::GLSLProgram::ShaderType::Fragment, getStringResource("shaders/blit.frag")}});
+    } catch (glowl::GLSLProgramException& e) { std::cerr << e.what() << std::endl; }
+
+    // Initialize shader for the box lines
+    try {
+        shaderBox = std::make_unique<glowl::GLSLProgram>(glowl::GLSLProgram::ShaderSourceList{
+            {glowl::GLSLProgram::ShaderType::Vertex, getStringResource("shaders/box.vert")},
+            {glowl::GLSLProgram::ShaderType::Fragment, getStringResource("shaders/box.frag")}});
+    } catch (glowl::GLSLProgramException& e) { std::cerr << e.what() << std::endl; }
+
+    // Initialize compute shaders for the histograms
+    try {
+        shaderHisto1D = std::make_unique<glowl::GLSLProgram>(glowl::GLSLProgram::ShaderSourceList{
+            {glowl::GLSLProgram::ShaderType::Compute, getStringResource("shaders/histo1d.comp")}});
+    } catch (glowl::GLSLProgramException& e) { std::cerr << e.what() << std::endl; }
+    try {
+        shaderHisto2D = std::make_unique<glowl::GLSLProgram>(glowl::GLSLProgram::ShaderSourceList{
+            {glowl::GLSLProgram::ShaderType::Compute, getStringResource("shaders/histo2d.comp")}});
+    } catch (glowl::GLSLProgramException& e) { std::cerr << e.what() << std::endl; }
+
+    // Initialize compute shader for the gradient texture
+    try {
+        shaderGradient = std::make_unique<glowl::GLSLProgram>(glowl::GLSLProgram::ShaderSourceList{
+            {glowl::GLSLProgram::ShaderType::Compute, getStringResource("shaders/gradient.comp")}});
+    } catch (glowl::GLSLProgramException& e) { std::cerr << e.what() << std::endl; }
+
+    // Initialize compute shader for the pre-integration table
+    try {
+        shaderPreIntegrate = std::make_unique<glowl::GLSLProgram>(glowl::GLSLProgram::ShaderSourceList{
+            {glowl::GLSLProgram::ShaderType::Compute, getStringResource("shaders/preintegrate.comp")}});
+    } catch (glowl::GLSLProgramException& e) { std::cerr << e.what() << std::endl; }
+    preIntDirty = true;
+
+    // Initialize compute shader for the light attenuation volume
+    try {
+        shaderIllumination = std::make_unique<glowl::GLSLProgram>(glowl::GLSLProgram::ShaderSourceList{
+            {glowl::GLSLProgram::ShaderType::Compute, getStringResource("shaders/illumination.comp")}});
+    } catch (glowl::GLSLProgramException& e) { std::cerr << e.what() << std::endl; }
+
+    // Initialize shader for the 2D histogram
+    try {
+        shaderHisto2DView = std::make_unique<glowl::GLSLProgram>(glowl::GLSLProgram::ShaderSourceList{
+            {glowl::GLSLProgram::ShaderType::Vertex, getStringResource("shaders/histo2d.vert")},
+            {glowl::GLSLProgram::ShaderType::Fragment, getStringResource("shaders/histo2d.frag")}});
+    } catch (glowl::GLSLProgramException& e) { std::cerr << e.what() << std::endl; }
 }
 
 /**
@@ -411,6 +1498,25 @@ void VolumeVis::initVAs() {
     glowl::VertexLayout quadLayout{{0}, {{2, GL_FLOAT, GL_FALSE, 0}}};
     vaQuad = std::make_unique<glowl::Mesh>(std::vector<std::vector<float>>{quadVertices}, quadIndices, quadLayout,
                                            GL_UNSIGNED_INT, GL_STATIC_DRAW, GL_TRIANGLE_STRIP);
+
+    const std::vector<float> boxVertices{
+        // clang-format off
+        -0.5f, -0.5f, -0.5f,
+         0.5f, -0.5f, -0.5f,
+        -0.5f,  0.5f, -0.5f,
+         0.5f,  0.5f, -0.5f,
+        -0.5f, -0.5f,  0.5f,
+         0.5f, -0.5f,  0.5f,
+        -0.5f,  0.5f,  0.5f,
+         0.5f,  0.5f,  0.5f,
+        // clang-format on
+    };
+
+    const std::vector<GLuint> boxIndices{0, 1, 2, 3, 4, 5, 6, 7, 0, 2, 1, 3, 4, 6, 5, 7, 0, 4, 1, 5, 2, 6, 3, 7};
+
+    glowl::VertexLayout boxLayout{{0}, {{3, GL_FLOAT, GL_FALSE, 0}}};
+    vaBox = std::make_unique<glowl::Mesh>(std::vector<std::vector<float>>{boxVertices}, boxIndices, boxLayout,
+                                          GL_UNSIGNED_INT, GL_STATIC_DRAW, GL_LINES);
 }
 
 /**
@@ -423,45 +1529,247 @@ void VolumeVis::loadVolumeFile(int idx) {
     }
     currentFileLoaded = idx;
 
-    std::string volumeFile = datFiles[idx].string();
-
     // --------------------------------------------------------------------------------
     //  TODO: Read data from 'volumeFile' using datraw::raw_reader<char>. Use slice
     //        thickness to determine correct volume dimensions. Normalize dimensions
     //        such that the maximum dimension is 1.0.
     //        Calculate the histogram. Upload the volume as a 3D texture.
     // --------------------------------------------------------------------------------
-    // Load volume dataset
-    datraw::raw_reader<char> rd = datraw::raw_reader<char>::open(volumeFile);
-    std::vector<datraw::uint8> raw = rd.read_current();
+    // The raw file is memory mapped and uploaded in the following frames, see finishVolumeLoad().
+    // Until then the current volume stays visible. Replacing the loader cancels a pending upload.
+    // The statistics only read the mapping, they are computed on worker threads meanwhile.
+    cancelVolumeStats();
+    // A recently shown volume is still on the GPU and is shown right away.
+    if (auto cached = volumeCache.take(datFiles[idx], useCompression)) {
+        volumeLoader.reset();
+        showVolume(std::move(*cached));
+        return;
+    }
+    try {
+        volumeLoader = std::make_unique<VolumeLoader>(datFiles[idx], 0, useCompression);
+        statsCancel = std::make_shared<std::atomic<bool>>(false);
+        pendingStats = std::async(std::launch::async, [file = volumeLoader->data(), type = volumeLoader->type(),
+                                                          numVoxels = volumeLoader->numVoxels(), cancel = statsCancel]() {
+            return std::make_shared<const VolumeStats>(VolumeStats::compute(*file, type, numVoxels, cancel.get()));
+        });
+    } catch (std::exception& e) {
+        std::cerr << "Cannot load volume: " << e.what() << std::endl;
+        volumeLoader.reset();
+    }
+}
+
+/**
+ * @brief Stop the statistics computation of a pending volume load and wait for the workers.
+ */
+void VolumeVis::cancelVolumeStats() {
+    if (statsCancel != nullptr) {
+        *statsCancel = true;
+    }
+    if (pendingStats.valid()) {
+        pendingStats.wait();
+        pendingStats = {};
+    }
+    statsCancel.reset();
+}
+
+/**
+ * @brief Swap in the completely uploaded volume.
+ */
+void VolumeVis::finishVolumeLoad() {
+    CachedVolume volume;
+    volume.file = datFiles[currentFileLoaded];
+    volume.compressed = volumeLoader->compressed() != nullptr;
+    if (volume.compressed) {
+        volume.compressedRange = volumeLoader->compressed()->range;
+        volume.compressionStats = volumeLoader->compressed()->stats;
+    }
+    volume.volumeTex = volumeLoader->releaseTexture();
+    volume.data = volumeLoader->data();
+    volume.type = volumeLoader->type();
+    volume.res = volumeLoader->resolution();
+
+    // Take over the statistics
+    try {
+        volume.stats = pendingStats.get();
+    } catch (std::exception& e) {
+        std::cerr << "Cannot compute volume statistics: " << e.what() << std::endl;
+        volume.stats = std::make_shared<const VolumeStats>();
+    }
+    statsCancel.reset();
+
+    showVolume(std::move(volume));
+
+    // Of a time series the first step is loaded, the series prefetches and uploads the others during playback.
+    if (volumeLoader->numTimeSteps() > 1) {
+        try {
+            volumeSeries = std::make_unique<VolumeSeries>(volumeLoader->header(), volumeTex, volumeData,
+                                                          compressedRange, volumeCompressed);
+        } catch (std::exception& e) {
+            std::cerr << "Cannot play time series: " << e.what() << std::endl;
+        }
+    }
+
+    volumeLoader.reset();
+}
+
+/**
+ * @brief Show a volume and derive what is missing from its voxels. The previously shown volume is moved into
+ * the cache, except for a time series, whose textures are owned by the series.
+ * @param volume       The volume, its textures are owned by the plugin afterwards
+ */
+void VolumeVis::showVolume(CachedVolume volume) {
+    if (volumeSeries != nullptr) {
+        // volumeTex is deleted with the series.
+        volumeSeries.reset();
+        volumeTex = 0;
+        glDeleteTextures(1, &gradientTex);
+        gradientTex = 0;
+    } else if (volumeTex != 0) {
+        volumeCache.put({volumeFile, volumeCompressed, volumeTex, gradientTex, volumeData, volumeType, volumeRes,
+                         compressedRange, compressionStats, volumeStats, isoExtractor});
+    }
 
     // Initialize volumeRes and volumeDim
-    volumeRes = glm::uvec3(rd.info().resolution()[0], rd.info().resolution()[1], rd.info().resolution()[2]);
+    volumeFile = std::move(volume.file);
+    volumeRes = volume.res;
     float volumeResMaz = std::max(std::max(volumeRes.x, volumeRes.y), volumeRes.z);
     volumeDim = glm::vec3((float)volumeRes.x / volumeResMaz, (float)volumeRes.y / volumeResMaz, (float)volumeRes.z / volumeResMaz);
 
-    // Create texture
-    glGenTextures(1, &volumeTex);
-    glBindTexture(GL_TEXTURE_3D, volumeTex);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexImage3D(GL_TEXTURE_3D, 0, GL_RED, rd.info().resolution()[0], rd.info().resolution()[1], rd.info().resolution()[2], 0, GL_RED, GL_UNSIGNED_BYTE, &raw[0]);
-    glBindTexture(GL_TEXTURE_3D, 0);
+    volumeTex = volume.volumeTex;
+    gradientTex = volume.gradientTex;
+    volumeData = std::move(volume.data);
+    volumeType = volume.type;
+    volumeCompressed = volume.compressed;
+    compressedRange = volume.compressedRange;
+    compressionStats = volume.compressionStats;
+
+    timeStep = 0;
+    playbackPos = 0.0;
+    shownStep = 0;
+    shownStepDerived = true;
+    dueStep = 0;
+    dueShown = true;
+    droppedFrames = 0;
 
-    // Generate histogram data
-    genHistogram(histoNumBins, raw);
+    volumeStats = std::move(volume.stats);
+    // Integer volumes are normalized by the texture unit and keep [0, 1], so isoValue, scale and the transfer
+    // function mean the same as before. Float volumes have no fixed range, their data range is mapped to [0, 1].
+    // A constant volume still needs a non-empty range for the normalization in the shader.
+    if (volumeType == VoxelType::Float32) {
+        valueRange = glm::vec2(volumeStats->minValue, volumeStats->maxValue > volumeStats->minValue
+                                                          ? volumeStats->maxValue
+                                                          : volumeStats->minValue + 1.0f);
+    } else {
+        valueRange = glm::vec2(0.0f, 1.0f);
+    }
+    volumePercentiles = glm::vec3(volumeStats->percentile(0.01f), volumeStats->percentile(0.5f),
+                                  volumeStats->percentile(0.99f));
+
+    // The light attenuation volume is recomputed on demand.
+    illumVolume = 0;
+
+    // The mesh of the previous volume is outdated, the new one is extracted on demand.
+    cancelIsoMesh();
+    vaIsoMesh.reset();
+    isoMeshValid = false;
+    isoExtractor = volume.isoExtractor != nullptr
+                       ? std::move(volume.isoExtractor)
+                       : std::make_shared<IsoSurfaceExtractor>(volumeData, volumeType, volumeRes, volumeDim, valueRange);
+
+    // The gradients are also used by the 2D histogram. Cached ones are kept if precomputed gradients are on.
+    if (gradientTex == 0 || !useGradientTex) {
+        computeGradientTex();
+    }
+
+    // Generate histogram data, the GPU version replaces it as soon as it is read back.
+    genHistogram(volumeStats->histogram(histoNumBins));
+    if (useGpuHisto) {
+        computeGpuHisto(histoNumBins);
+    }
 }
 
 /**
- * @brief Create the histogram.
- * @param bins     The number of bins
- * @param values   The vector with the histogram values
+ * @brief Advance the playback of a time series and show the due time step once it is uploaded.
+ * A played step which is never shown because I/O or upload could not keep up counts as dropped frame.
  */
-void VolumeVis::genHistogram(std::size_t bins, const std::vector<std::uint8_t>& values) {
-    if (bins == 0 || values.empty()) {
+void VolumeVis::updateTimeSeries() {
+    auto now = std::chrono::steady_clock::now();
+    double dt = std::chrono::duration<double>(now - playbackClock).count();
+    playbackClock = now;
+    if (volumeSeries == nullptr) {
+        return;
+    }
+
+    std::size_t n = volumeSeries->numSteps();
+    if (playing) {
+        playbackPos = std::fmod(playbackPos + dt * static_cast<double>(playbackFps), static_cast<double>(n));
+    }
+    auto due = static_cast<std::size_t>(std::max(0.0, playbackPos)) % n;
+    if (due != dueStep) {
+        if (playing) {
+            // Steps passed within one frame were not shown either.
+            std::size_t passed = (due + n - dueStep) % n;
+            droppedFrames += passed - 1 + (dueShown ? 0 : 1);
+        }
+        dueStep = due;
+        dueShown = false;
+    }
+
+    volumeSeries->update(due, shownStep, static_cast<double>(uploadBudget));
+    if (shownStep != due && volumeSeries->isResident(due)) {
+        showTimeStep(due);
+    }
+    if (!playing && !shownStepDerived) {
+        deriveTimeStep();
+    }
+    dueShown = dueShown || shownStep == due;
+    if (playing) {
+        timeStep = static_cast<int>(shownStep);
+    }
+}
+
+/**
+ * @brief Swap in a resident time step of the series. Statistics, value range and histograms remain those of the
+ * first time step, so the transfer function keeps its meaning during playback.
+ * Gradients and isosurface are rebuilt once the playback stops, as building them for every played step would
+ * stall the frame. Until then the shader computes the normals from the voxels and the mesh is hidden.
+ * @param step     The time step
+ */
+void VolumeVis::showTimeStep(std::size_t step) {
+    volumeTex = volumeSeries->texture(step);
+    volumeData = volumeSeries->data(step);
+    compressedRange = volumeSeries->compressedRange(step);
+    shownStep = step;
+    shownStepDerived = false;
+    illumVolume = 0;
+
+    glDeleteTextures(1, &gradientTex);
+    gradientTex = 0;
+    if (isoMeshCancel != nullptr) {
+        *isoMeshCancel = true;
+    }
+    vaIsoMesh.reset();
+    isoMeshValid = false;
+}
+
+/**
+ * @brief Rebuild gradients and isosurface extractor for the shown time step.
+ */
+void VolumeVis::deriveTimeStep() {
+    computeGradientTex();
+    cancelIsoMesh();
+    vaIsoMesh.reset();
+    isoMeshValid = false;
+    isoExtractor = std::make_shared<IsoSurfaceExtractor>(volumeData, volumeType, volumeRes, volumeDim, valueRange);
+    shownStepDerived = true;
+}
+
+/**
+ * @brief Create the histogram vertex array.
+ * @param binValues    The number of values in each bin
+ */
+void VolumeVis::genHistogram(const std::vector<std::uint32_t>& binValues) {
+    if (binValues.empty()) {
         return;
     }
     // --------------------------------------------------------------------------------
@@ -469,26 +1777,321 @@ void VolumeVis::genHistogram(std::size_t bins, const std::vector<std::uint8_t>&
     //        therefore the value range is [0, 255].
     //        Divide this value range into "bins" number of bins.
     // --------------------------------------------------------------------------------
-    // Calculate histogram value
-    float* histogramValueArray = new float[bins]{0};
-    for (float i = 0; i < values.size(); i++) histogramValueArray[values[i]]++;
+    // The bin values are derived from the VolumeStats computed while uploading.
+    histoNumBins = binValues.size();
+    histoMaxBinValue = 0;
 
     // Create vertex array and indices
     std::vector<float> histogramVertices;
     std::vector<GLuint> histogramIndices;
-    for (int i = 0; i < bins; i++) {
-        histogramVertices.push_back((float)i / (float)bins);
-        histogramVertices.push_back(histogramValueArray[i]);
-        histogramIndices.push_back(i);
-        if (histoMaxBinValue < histogramValueArray[i]) histoMaxBinValue = histogramValueArray[i];
+    for (std::size_t i = 0; i < histoNumBins; i++) {
+        histogramVertices.push_back((float)i / (float)histoNumBins);
+        histogramVertices.push_back((float)binValues[i]);
+        histogramIndices.push_back(static_cast<GLuint>(i));
+        if (histoMaxBinValue < binValues[i]) histoMaxBinValue = binValues[i];
     }
 
     glowl::VertexLayout histogramLayout{
         {0}, {{2, GL_FLOAT, GL_FALSE, 0}} };
     vaHisto = std::make_unique<glowl::Mesh>(std::vector<std::vector<float>>{histogramVertices},
         histogramIndices, histogramLayout, GL_UNSIGNED_INT, GL_STATIC_DRAW, GL_POINTS);
+}
+
+/**
+ * @brief Create the buffers and the texture of the GPU histograms.
+ */
+void VolumeVis::initGpuHisto() {
+    glGenBuffers(1, &histo1DBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, histo1DBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, histo1DMaxBins * sizeof(GLuint), nullptr, GL_DYNAMIC_READ);
+
+    glGenBuffers(1, &histo2DBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, histo2DBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, (2 + histo2DValueBins * histo2DGradientBins) * sizeof(GLuint), nullptr,
+                 GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    histo2DTex = createFBOTexture(histo2DValueBins, histo2DGradientBins, GL_R32F, GL_RED, GL_FLOAT, GL_LINEAR);
+    glGenQueries(1, &histoTimerQuery);
+}
 
-    delete[] histogramValueArray;
+/**
+ * @brief Delete the buffers and the texture of the GPU histograms.
+ */
+void VolumeVis::deleteGpuHisto() {
+    if (histoFence != nullptr) {
+        glDeleteSync(histoFence);
+        histoFence = nullptr;
+    }
+    glDeleteQueries(1, &histoTimerQuery);
+    glDeleteTextures(1, &histo2DTex);
+    glDeleteBuffers(1, &histo2DBuffer);
+    glDeleteBuffers(1, &histo1DBuffer);
+    histoTimerQuery = 0;
+    histo2DTex = 0;
+    histo2DBuffer = 0;
+    histo1DBuffer = 0;
+}
+
+/**
+ * @brief Compute the 1D and the value x gradient magnitude histogram of the current volume texture.
+ * Every work group counts a brick into shared memory and adds the non-empty bins to the global histogram.
+ * The result is read back by fetchGpuHisto() once the GPU is done, nothing waits here.
+ * @param bins         Number of bins of the 1D histogram
+ */
+void VolumeVis::computeGpuHisto(std::size_t bins) {
+    if (volumeTex == 0 || shaderHisto1D == nullptr || shaderHisto2D == nullptr || volumeRes.x == 0) {
+        return;
+    }
+    gpuHistoNumBins = std::clamp<std::size_t>(bins, 1, histo1DMaxBins);
+    if (histoFence != nullptr) {
+        glDeleteSync(histoFence);
+        histoFence = nullptr;
+    }
+    // Work groups process bricks of 32^3 voxels.
+    glm::uvec3 groups = (volumeRes + glm::uvec3(31)) / glm::uvec3(32);
+
+    glBeginQuery(GL_TIME_ELAPSED, histoTimerQuery);
+    GLuint zero = 0;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, histo1DBuffer);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, histo2DBuffer);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, histo2DBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, histo1DBuffer);
+
+    shaderHisto1D->use();
+    bindVolumeTex(*shaderHisto1D);
+    shaderHisto1D->setUniform("valueRange", valueRange);
+    shaderHisto1D->setUniform("numBins", static_cast<int>(gpuHistoNumBins));
+    glDispatchCompute(groups.x, groups.y, groups.z);
+
+    shaderHisto2D->use();
+    bindVolumeTex(*shaderHisto2D);
+    shaderHisto2D->setUniform("valueRange", valueRange);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_3D, gradientTex);
+    shaderHisto2D->setUniform("gradientTex", 1);
+    shaderHisto2D->setUniform("useGradientTex", gradientTex != 0);
+    if (gradientTex == 0) {
+        // Pass 0 finds the maximum gradient magnitude, which scales the gradient axis of pass 1.
+        // The precomputed magnitudes are already relative to the maximum.
+        shaderHisto2D->setUniform("pass", 0);
+        glDispatchCompute(groups.x, groups.y, groups.z);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+    shaderHisto2D->setUniform("pass", 1);
+    glDispatchCompute(groups.x, groups.y, groups.z);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    shaderHisto2D->setUniform("pass", 2);
+    glBindImageTexture(0, histo2DTex, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+    glDispatchCompute((histo2DValueBins + 7) / 8, (histo2DGradientBins + 7) / 8, 1);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+    glEndQuery(GL_TIME_ELAPSED);
+
+    glUseProgram(0);
+    glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+    glBindTexture(GL_TEXTURE_3D, 0);
+    glActiveTexture(GL_TEXTURE0 + compressedTexUnit);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_3D, 0);
+    histoFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+/**
+ * @brief Read back the GPU 1D histogram if its computation has finished.
+ */
+void VolumeVis::fetchGpuHisto() {
+    if (histoFence == nullptr) {
+        return;
+    }
+    GLenum status = glClientWaitSync(histoFence, 0, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+        return;
+    }
+    glDeleteSync(histoFence);
+    histoFence = nullptr;
+
+    GLuint64 elapsed = 0;
+    glGetQueryObjectui64v(histoTimerQuery, GL_QUERY_RESULT, &elapsed);
+    histoGpuTime = static_cast<float>(static_cast<double>(elapsed) * 1.0e-6);
+
+    if (useGpuHisto) {
+        std::vector<std::uint32_t> binValues(gpuHistoNumBins);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, histo1DBuffer);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, static_cast<GLsizeiptr>(binValues.size() * sizeof(GLuint)),
+                           binValues.data());
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        genHistogram(binValues);
+    }
+}
+
+/**
+ * @brief (Re)build the gradient texture of the current volume, or delete it if precomputed gradients are off.
+ * A first compute pass finds the largest gradient magnitude, the second one writes the normalized gradients and
+ * the magnitudes relative to the largest one. Shading then needs one fetch instead of six.
+ */
+void VolumeVis::computeGradientTex() {
+    glDeleteTextures(1, &gradientTex);
+    gradientTex = 0;
+    if (!useGradientTex || volumeTex == 0 || shaderGradient == nullptr || volumeRes.x == 0) {
+        return;
+    }
+
+    glGenTextures(1, &gradientTex);
+    glBindTexture(GL_TEXTURE_3D, gradientTex);
+    // Same wrap mode as the volume texture, the normals at the border do not change with the option.
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexStorage3D(GL_TEXTURE_3D, 1, GL_RGBA8, static_cast<GLsizei>(volumeRes.x), static_cast<GLsizei>(volumeRes.y),
+                   static_cast<GLsizei>(volumeRes.z));
+    glBindTexture(GL_TEXTURE_3D, 0);
+
+    if (gradientMaxBuffer == 0) {
+        glGenBuffers(1, &gradientMaxBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, gradientMaxBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+    }
+    GLuint zero = 0;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gradientMaxBuffer);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, gradientMaxBuffer);
+
+    glBindImageTexture(1, gradientTex, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA8);
+
+    glm::uvec3 groups = (volumeRes + glm::uvec3(7)) / glm::uvec3(8);
+    shaderGradient->use();
+    bindVolumeTex(*shaderGradient);
+    shaderGradient->setUniform("valueRange", valueRange);
+    shaderGradient->setUniform("pass", 0);
+    glDispatchCompute(groups.x, groups.y, groups.z);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    shaderGradient->setUniform("pass", 1);
+    glDispatchCompute(groups.x, groups.y, groups.z);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+    glUseProgram(0);
+    glBindImageTexture(1, 0, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA8);
+    glActiveTexture(GL_TEXTURE0 + compressedTexUnit);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_3D, 0);
+}
+
+/**
+ * @brief Direction towards the light in world coordinates. The light is fixed to the volume, so the attenuation
+ * volume stays valid while the camera moves.
+ */
+glm::vec3 VolumeVis::lightDirection() const {
+    float azimuth = glm::radians(lightAzimuth);
+    float elevation = glm::radians(lightElevation);
+    return glm::vec3(std::cos(elevation) * std::sin(azimuth), std::sin(elevation),
+                     std::cos(elevation) * std::cos(azimuth));
+}
+
+/**
+ * @brief Recompute the light attenuation volume if the volume, the transfer function or the light changed.
+ * The light is propagated slice by slice along the major axis of the light direction, one dispatch per slice,
+ * each voxel attenuates the light of the previous slice by the opacity of the transfer function. The raycaster
+ * then needs a single fetch per sample for the shadows instead of a ray towards the light.
+ */
+void VolumeVis::updateIllumination() {
+    if (!useShadows || viewMode != ViewMode::Volume || volumeTex == 0 || shaderIllumination == nullptr) {
+        return;
+    }
+    glm::vec3 dir = -lightDirection();
+    if (illumTex != 0 && illumVolume == volumeTex && illumTfVersion == tfVersion && illumLightDir == dir) {
+        return;
+    }
+
+    if (illumTex == 0 || illumRes != volumeRes) {
+        glDeleteTextures(1, &illumTex);
+        glGenTextures(1, &illumTex);
+        glBindTexture(GL_TEXTURE_3D, illumTex);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexStorage3D(GL_TEXTURE_3D, 1, GL_R16F, static_cast<GLsizei>(volumeRes.x), static_cast<GLsizei>(volumeRes.y),
+                       static_cast<GLsizei>(volumeRes.z));
+        glBindTexture(GL_TEXTURE_3D, 0);
+        illumRes = volumeRes;
+    }
+
+    int axis = 0;
+    glm::vec3 absDir = glm::abs(dir);
+    if (absDir.y > absDir[axis]) {
+        axis = 1;
+    }
+    if (absDir.z > absDir[axis]) {
+        axis = 2;
+    }
+    glm::ivec3 res(volumeRes);
+    int u = (axis + 1) % 3;
+    int v = (axis + 2) % 3;
+
+    glBindImageTexture(3, illumTex, 0, GL_TRUE, 0, GL_READ_WRITE, GL_R16F);
+    shaderIllumination->use();
+    bindVolumeTex(*shaderIllumination);
+    shaderIllumination->setUniform("valueRange", valueRange);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_1D, tfTex);
+    shaderIllumination->setUniform("transferTex", 1);
+    shaderIllumination->setUniform("lightDir", dir);
+    shaderIllumination->setUniform("axis", axis);
+    for (int slice = 0; slice < res[axis]; slice++) {
+        shaderIllumination->setUniform("slice", slice);
+        glDispatchCompute(static_cast<GLuint>((res[u] + 7) / 8), static_cast<GLuint>((res[v] + 7) / 8), 1);
+        // The next slice reads this one.
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    }
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+    glUseProgram(0);
+    glBindImageTexture(3, 0, 0, GL_TRUE, 0, GL_READ_WRITE, GL_R16F);
+    glBindTexture(GL_TEXTURE_1D, 0);
+    glActiveTexture(GL_TEXTURE0 + compressedTexUnit);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_3D, 0);
+
+    illumVolume = volumeTex;
+    illumTfVersion = tfVersion;
+    illumLightDir = dir;
+}
+
+/**
+ * @brief Bind the current volume to a program in use. A compressed volume is bound as array of slices to its own
+ * texture unit, the samplers of both kinds must not share a unit. The volume is filtered as useLinearFilter
+ * selects, the textures of the cache and of a time series are shared, so the filter is set on every bind.
+ * @param program      The program, declaring volumeTex, compressedTex, useCompressed and compressedRange
+ */
+void VolumeVis::bindVolumeTex(glowl::GLSLProgram& program) {
+    const GLint filter = useLinearFilter ? GL_LINEAR : GL_NEAREST;
+
+    glActiveTexture(GL_TEXTURE0 + compressedTexUnit);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, volumeCompressed ? volumeTex : 0);
+    if (volumeCompressed && volumeTex != 0) {
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, filter);
+    }
+    program.setUniform("compressedTex", compressedTexUnit);
+    program.setUniform("useCompressed", volumeCompressed);
+    program.setUniform("compressedRange", compressedRange);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_3D, volumeCompressed ? 0 : volumeTex);
+    if (!volumeCompressed && volumeTex != 0) {
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, filter);
+    }
+    program.setUniform("volumeTex", 0);
 }
 
 /**
@@ -499,6 +2102,79 @@ void VolumeVis::initTransferFunc() {
     //  TODO: Initialize the transfer function vertex array and load the transfer
     //        function data into a 1D texture.
     // --------------------------------------------------------------------------------
+    // Linear gray ramp until a transfer function is loaded
+    if (tfData.size() != 4 * tfNumPoints) {
+        tfData.resize(4 * tfNumPoints);
+        for (std::size_t i = 0; i < tfNumPoints; i++) {
+            float value = static_cast<float>(i) / static_cast<float>(tfNumPoints - 1);
+            tfData[4 * i + 0] = value;
+            tfData[4 * i + 1] = value;
+            tfData[4 * i + 2] = value;
+            tfData[4 * i + 3] = value;
+        }
+    }
+    tfDirtyBegin = 0;
+    tfDirtyEnd = 0;
+
+    // Line strips for the editor, one vertex per entry. The values are updated in place while editing.
+    std::vector<float> positions(tfNumPoints);
+    std::vector<GLuint> indices(tfNumPoints);
+    for (std::size_t i = 0; i < tfNumPoints; i++) {
+        positions[i] = static_cast<float>(i) / static_cast<float>(tfNumPoints - 1);
+        indices[i] = static_cast<GLuint>(i);
+    }
+    glowl::VertexLayout tfLayout{{0}, {{1, GL_FLOAT, GL_FALSE, 0}, {4, GL_FLOAT, GL_FALSE, 0}}};
+    vaTransferFunc = std::make_unique<glowl::Mesh>(std::vector<std::vector<float>>{positions, tfData}, indices,
+                                                   tfLayout, GL_UNSIGNED_INT, GL_DYNAMIC_DRAW, GL_LINE_STRIP);
+
+    glDeleteTextures(1, &tfTex);
+    glGenTextures(1, &tfTex);
+    glBindTexture(GL_TEXTURE_1D, tfTex);
+    glTexImage1D(GL_TEXTURE_1D, 0, GL_RGBA32F, static_cast<GLsizei>(tfNumPoints), 0, GL_RGBA, GL_FLOAT, tfData.data());
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_1D, 0);
+
+    // One entry per pair of front and back sample. Large transfer functions get a coarser table, the
+    // integration still resolves every entry.
+    auto preIntSize = static_cast<int>(std::min(tfNumPoints, preIntMaxSize));
+    glDeleteTextures(1, &preIntTex);
+    preIntTex = createFBOTexture(preIntSize, preIntSize, GL_RGBA16F, GL_RGBA, GL_FLOAT, GL_LINEAR);
+    preIntDirty = true;
+    tfVersion++;
+}
+
+/**
+ * @brief Recompute the pre-integration table if the transfer function or the step size changed.
+ * Entry (f, b) is the composited color and opacity of a ray segment whose values run linearly from f to b. As the
+ * table resolves the transfer function between two samples, the raycaster can use far larger steps. One compute
+ * invocation per entry, a 256x256 table takes well below a millisecond, so editing stays interactive.
+ * @param stepRatio    Step size in reference steps, see drawVolume()
+ */
+void VolumeVis::updatePreIntegration(float stepRatio) {
+    if (tfTex == 0 || preIntTex == 0 || shaderPreIntegrate == nullptr) {
+        return;
+    }
+    if (!preIntDirty && stepRatio == preIntStepRatio) {
+        return;
+    }
+
+    shaderPreIntegrate->use();
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_1D, tfTex);
+    shaderPreIntegrate->setUniform("transferTex", 0);
+    shaderPreIntegrate->setUniform("stepRatio", stepRatio);
+    glBindImageTexture(0, preIntTex, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+    auto groups = static_cast<GLuint>((std::min(tfNumPoints, preIntMaxSize) + 15) / 16);
+    glDispatchCompute(groups, groups, 1);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+    glUseProgram(0);
+    glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+    glBindTexture(GL_TEXTURE_1D, 0);
+    preIntDirty = false;
+    preIntStepRatio = stepRatio;
 }
 
 /**
@@ -510,6 +2186,9 @@ void VolumeVis::updateTransferFunc(int channel, float value) {
     // --------------------------------------------------------------------------------
     //  TODO: Update the transfer function. Don't forget to update the texture and VA.
     // --------------------------------------------------------------------------------
+    for (std::size_t i = 0; i < tfNumPoints; i++) {
+        updateTransferFunc(static_cast<int>(i), channel, value);
+    }
 }
 
 /**
@@ -522,6 +2201,45 @@ void VolumeVis::updateTransferFunc(int idx, int channel, float value) {
     // --------------------------------------------------------------------------------
     //  TODO: Update the transfer function. Don't forget to update the texture and VA.
     // --------------------------------------------------------------------------------
+    if (idx < 0 || idx >= static_cast<int>(tfNumPoints) || channel < 0 || channel > 3) {
+        return;
+    }
+    tfData[4 * idx + channel] = std::clamp(value, 0.0f, 1.0f);
+    // Texture and VA are updated once per frame, see uploadTransferFunc().
+    auto i = static_cast<std::size_t>(idx);
+    if (tfDirtyBegin >= tfDirtyEnd) {
+        tfDirtyBegin = i;
+        tfDirtyEnd = i + 1;
+    } else {
+        tfDirtyBegin = std::min(tfDirtyBegin, i);
+        tfDirtyEnd = std::max(tfDirtyEnd, i + 1);
+    }
+}
+
+/**
+ * @brief Upload the entries modified since the last call to the texture and the VA.
+ * Only the dirty span is transferred, so editing large transfer functions stays cheap.
+ */
+void VolumeVis::uploadTransferFunc() {
+    if (tfDirtyBegin >= tfDirtyEnd || tfTex == 0) {
+        return;
+    }
+    const float* span = tfData.data() + 4 * tfDirtyBegin;
+    auto count = static_cast<GLsizei>(tfDirtyEnd - tfDirtyBegin);
+
+    glBindTexture(GL_TEXTURE_1D, tfTex);
+    glTexSubImage1D(GL_TEXTURE_1D, 0, static_cast<GLint>(tfDirtyBegin), count, GL_RGBA, GL_FLOAT, span);
+    glBindTexture(GL_TEXTURE_1D, 0);
+
+    if (vaTransferFunc != nullptr) {
+        std::vector<float> values(span, span + 4 * count);
+        vaTransferFunc->bufferVertexSubData(1, values, static_cast<GLsizeiptr>(4 * tfDirtyBegin * sizeof(float)));
+    }
+
+    tfDirtyBegin = 0;
+    tfDirtyEnd = 0;
+    preIntDirty = true;
+    tfVersion++;
 }
 
 /**
@@ -534,6 +2252,30 @@ void VolumeVis::loadTransferFunc(const std::string& filename) {
     // --------------------------------------------------------------------------------
     //  TODO: Load the transfer function from file "path".
     // --------------------------------------------------------------------------------
+    // Format: number of entries, followed by one line "r g b a" per entry.
+    std::ifstream file(path);
+    std::size_t numPoints = 0;
+    if (!(file >> numPoints) || numPoints < 2) {
+        std::cerr << "Cannot load transfer function: " << path.string() << std::endl;
+        return;
+    }
+    std::vector<float> data(4 * numPoints);
+    for (float& v : data) {
+        if (!(file >> v)) {
+            std::cerr << "Transfer function is truncated: " << path.string() << std::endl;
+            return;
+        }
+    }
+
+    tfData = std::move(data);
+    if (numPoints == tfNumPoints && tfTex != 0) {
+        tfDirtyBegin = 0;
+        tfDirtyEnd = tfNumPoints;
+    } else {
+        // Texture, VA and pre-integration table depend on the size.
+        tfNumPoints = numPoints;
+        initTransferFunc();
+    }
 }
 
 /**
@@ -546,4 +2288,14 @@ void VolumeVis::saveTransferFunc(const std::string& filename) {
     // --------------------------------------------------------------------------------
     //  TODO: Save transfer function to file "path".
     // --------------------------------------------------------------------------------
+    std::ofstream file(path);
+    if (!file) {
+        std::cerr << "Cannot save transfer function: " << path.string() << std::endl;
+        return;
+    }
+    file << tfNumPoints << '\n';
+    for (std::size_t i = 0; i < tfNumPoints; i++) {
+        file << tfData[4 * i + 0] << ' ' << tfData[4 * i + 1] << ' ' << tfData[4 * i + 2] << ' ' << tfData[4 * i + 3]
+             << '\n';
+    }
 }
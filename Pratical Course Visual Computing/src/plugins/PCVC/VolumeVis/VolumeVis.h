@@ -1,6 +1,9 @@
 #ifndef OGL4CORE2_PLUGINS_PCVC_VOLUMEVIS_VOLUMEVIS_H
 #define OGL4CORE2_PLUGINS_PCVC_VOLUMEVIS_VOLUMEVIS_H
 
+#include <atomic>
+#include <chrono>
+#include <future>
 #include <memory>
 #include <string>
 #include <vector>
@@ -12,8 +15,15 @@
 #include "core/camera/orbitcamera.h"
 #include "core/pluginregister.h"
 #include "core/renderplugin.h"
+#include "BlockCompression.h"
+#include "CpuRaycaster.h"
+#include "IsoSurfaceExtractor.h"
+#include "RaycastBenchmark.h"
+#include "VolumeCache.h"
+#include "VolumeSeries.h"
 
 namespace OGL4Core2::Plugins::PCVC::VolumeVis {
+    class VolumeStats;
 
     class VolumeVis : public Core::RenderPlugin {
         REGISTERPLUGIN(VolumeVis, 103) // NOLINT
@@ -27,23 +37,110 @@ namespace OGL4Core2::Plugins::PCVC::VolumeVis {
         void render() override;
         void resize(int width, int height) override;
         void keyboard(Core::Key key, Core::KeyAction action, Core::Mods mods) override;
+        void mouseButton(Core::MouseButton button, Core::MouseButtonAction action, Core::Mods mods) override;
         void mouseMove(double xpos, double ypos) override;
 
     private:
+        static constexpr int histoMaxBins = 4096;      //!< bins of the CPU histogram
+        static constexpr int histo1DMaxBins = 1024;    //!< bins of the GPU 1D histogram, see histo1d.comp
+        static constexpr int histo2DValueBins = 128;   //!< value bins of the 2D histogram, see histo2d.comp
+        static constexpr int histo2DGradientBins = 64; //!< gradient bins of the 2D histogram, see histo2d.comp
+        static constexpr int compressedTexUnit = 4;    //!< texture unit of the compressed volume slices
+        static constexpr int sceneColorTexUnit = 5;    //!< texture unit of the scene color for the volume pass
+        static constexpr int sceneDepthTexUnit = 6;    //!< texture unit of the scene depth for the volume pass
+        static constexpr int illumTexUnit = 7;         //!< texture unit of the light attenuation volume
+
         enum class ViewMode { LineOfSight = 0, Mip = 1, Isosurface = 2, Volume = 3 };
 
+        /**
+         * Everything that influences the raycasted image. If it differs from the last
+         * frame, the progressive accumulation has to restart.
+         */
+        struct RenderState {
+            glm::mat4 viewMx;
+            glm::ivec4 viewport;
+            float fovY;
+            GLuint volume;
+            GLuint gradient;
+            bool linearFilter;
+            int tfVersion;
+            bool preIntegration;
+            ViewMode viewMode;
+            bool showBox;
+            glm::vec3 backgroundColor;
+            float depthOpacity;
+            bool shadows;
+            glm::vec4 light;
+            int maxSteps;
+            float stepSize;
+            bool random;
+            float scale;
+            float isoValue;
+            glm::vec3 ambientColor;
+            glm::vec3 diffuseColor;
+            glm::vec3 specularColor;
+            glm::vec4 k;
+
+            bool operator==(const RenderState& other) const;
+            bool operator!=(const RenderState& other) const { return !(*this == other); }
+        };
+
         void renderGUI();
 
+        void drawVolume(float viewAspect, float rayStepSize, int rayMaxSteps, bool jitter, unsigned int seed,
+                        const glm::vec2& pixelJitter);
+        void renderProgressive(const glm::ivec4& viewport, float viewAspect);
+        void drawScene(const glm::ivec4& viewport, float viewAspect);
+        void drawBox(float viewAspect);
+        RenderState currentRenderState(const glm::ivec4& viewport) const;
+        float referenceStep() const;
+
+        void drawIsoMesh(float viewAspect);
+        void updateIsoMesh();
+        void cancelIsoMesh();
+
+        void startCpuRender(const glm::ivec4& viewport, float viewAspect);
+        void finishCpuRender();
+
+        glm::mat4 viewMx() const;
+        void startBenchmark(bool closeWhenDone);
+        void runBenchmarkCase();
+        void finishBenchmark();
+
+        void resizeFBOs(const glm::ivec4& viewport);
+        void initFBOs();
+        void deleteFBOs();
+        GLuint createFBOTexture(int width, int height, GLenum internalFormat, GLenum format, GLenum type, GLint filter);
+
         void initShaders();
 
         void initVAs();
 
         void loadVolumeFile(int idx);
-        void genHistogram(std::size_t bins, const std::vector<std::uint8_t>& values);
+        void finishVolumeLoad();
+        void showVolume(CachedVolume volume);
+        void cancelVolumeStats();
+        void updateTimeSeries();
+        void showTimeStep(std::size_t step);
+        void deriveTimeStep();
+        void genHistogram(const std::vector<std::uint32_t>& binValues);
+
+        void initGpuHisto();
+        void deleteGpuHisto();
+        void computeGpuHisto(std::size_t bins);
+        void fetchGpuHisto();
+
+        void computeGradientTex();
+        glm::vec3 lightDirection() const;
+        void updateIllumination();
+        void bindVolumeTex(glowl::GLSLProgram& program);
 
         void initTransferFunc();
+        void updatePreIntegration(float stepRatio);
         void updateTransferFunc(int channel, float value);
         void updateTransferFunc(int idx, int channel, float value);
+        void uploadTransferFunc();
+        glm::vec2 editorCoords(double xpos, double ypos) const;
         void loadTransferFunc(const std::string& filename);
         void saveTransferFunc(const std::string& filename);
 
@@ -57,13 +154,46 @@ namespace OGL4Core2::Plugins::PCVC::VolumeVis {
 
         glm::uvec3 volumeRes;
         glm::vec3 volumeDim;
+        glm::vec2 valueRange; //!< sampler values mapped to 0 and 1, the data range of float volumes
+        VoxelType volumeType; //!< type of the stored voxels
+
+        std::unique_ptr<VolumeLoader> volumeLoader; //!< pending volume upload
+        std::shared_ptr<MappedFile> volumeData;     //!< memory mapped voxels of the current volume
+        std::filesystem::path volumeFile;           //!< dat file of the current volume
+        float uploadBudget;                         //!< time per frame for volume uploads in ms
+        VolumeCache volumeCache;                    //!< recently shown volumes, ready to be shown again
+        float cacheBudget;                          //!< texture memory of the cached volumes in MB
+
+        bool useCompression;               //!< load volumes as BC4 compressed slices
+        bool volumeCompressed;             //!< volumeTex is a 2D array texture of compressed slices
+        glm::vec2 compressedRange;         //!< value range the compressed slices are normalized to
+        CompressionStats compressionStats; //!< size and error of the compressed volume
+
+        std::unique_ptr<VolumeSeries> volumeSeries;          //!< time steps of a time-varying volume
+        int timeStep;                                        //!< time step selected with the timeline slider
+        bool playing;                                        //!< toggle playback
+        float playbackFps;                                   //!< played time steps per second
+        double playbackPos;                                  //!< playback position in time steps
+        std::chrono::steady_clock::time_point playbackClock; //!< time of the last playback update
+        std::size_t shownStep;                               //!< time step in volumeTex
+        bool shownStepDerived;                               //!< gradients and iso extractor belong to shownStep
+        std::size_t dueStep;                                 //!< time step which should be shown now
+        bool dueShown;                                       //!< dueStep was shown in at least one frame
+        std::size_t droppedFrames;                           //!< played time steps which were never shown
+
+        std::shared_ptr<const VolumeStats> volumeStats;                //!< statistics of the current volume
+        std::future<std::shared_ptr<const VolumeStats>> pendingStats; //!< statistics of the loading volume
+        std::shared_ptr<std::atomic<bool>> statsCancel;                //!< stops the pending statistics
+        glm::vec3 volumePercentiles;                                   //!< 1st, 50th and 99th percentile
 
         std::shared_ptr<Core::OrbitCamera> camera; //!< camera
         float fovY;                                //!< camera's vertical field of view
         glm::vec3 backgroundColor;
 
         bool useLinearFilter; //!< toggle linear texture filtering
+        bool useGradientTex;  //!< toggle precomputed gradients for shading
         bool showBox;         //!< toggle box drawing
+        float depthOpacity;   //!< accumulated opacity at which the volume writes its depth
         ViewMode viewMode;
 
         int maxSteps;   //!< Maximum number of integration steps
@@ -81,6 +211,12 @@ namespace OGL4Core2::Plugins::PCVC::VolumeVis {
 
         std::size_t tfNumPoints;   //!< number of point for transfer functions
         std::vector<float> tfData; //!< transfer function values (r,g,b,a)
+        std::size_t tfDirtyBegin;  //!< first entry modified since the last upload
+        std::size_t tfDirtyEnd;    //!< one past the last entry modified since the last upload
+        bool tfEditing;            //!< a drag in the transfer function editor is in progress
+        int tfLastIdx;             //!< entry at the last drag position
+        float tfLastValue;         //!< value at the last drag position
+        glm::dvec2 mousePos;       //!< last mouse position
 
         int editorHeight;       //!< Height of the colormap editor/histogram panel
         int colormapHeight;     //!< Height of the colormap preview panel
@@ -89,21 +225,111 @@ namespace OGL4Core2::Plugins::PCVC::VolumeVis {
         int tfChannel;          //!< TF channel enumeration: r,g,b,a
         std::string tfFilename; //!< TF filename for loading and saving
 
+        static constexpr std::size_t preIntMaxSize = 256; //!< maximum resolution of the pre-integration table
+
+        bool usePreIntegration; //!< toggle pre-integrated transfer function
+        bool preIntDirty;       //!< the transfer function changed since the table was computed
+        float preIntStepRatio;  //!< step size in reference steps the table was computed for
+        int tfVersion;          //!< incremented on every change of the transfer function
+
+        bool useShadows;         //!< attenuate the DVR samples by the light attenuation volume
+        float lightAzimuth;      //!< direction towards the light around the y axis in degrees
+        float lightElevation;    //!< direction towards the light above the xz plane in degrees
+        float shadowAmbient;     //!< light left in full shadow
+        GLuint illumTex;         //!< light reaching each voxel, R16F with the volume resolution
+        glm::uvec3 illumRes;     //!< resolution of illumTex
+        GLuint illumVolume;      //!< volume texture illumTex was computed for
+        int illumTfVersion;      //!< transfer function version illumTex was computed for
+        glm::vec3 illumLightDir; //!< light direction illumTex was computed for
+
         std::size_t histoNumBins;  //!< number of bins for histogram
         uint32_t histoMaxBinValue; //!< maximum bin value
 
-        std::unique_ptr<glowl::GLSLProgram> shaderVolume;     //!< shader program for volume rendering
-        std::unique_ptr<glowl::GLSLProgram> shaderBackground; //!< shader program for box rendering
-        std::unique_ptr<glowl::GLSLProgram> shaderHisto;      //!< shader program for histogram rendering
-        std::unique_ptr<glowl::GLSLProgram> shaderTfLines;    //!< shader program for histogram background
-        std::unique_ptr<glowl::GLSLProgram> shaderTfView;     //!< shader program for transfer functions
+        bool useGpuHisto;            //!< compute the histograms with compute shaders
+        bool showHisto2D;            //!< show the value x gradient magnitude histogram in the editor
+        std::size_t gpuHistoNumBins; //!< number of bins of the pending GPU 1D histogram
+        GLuint histo1DBuffer;        //!< SSBO of the GPU 1D histogram
+        GLuint histo2DBuffer;        //!< SSBO of the 2D histogram, led by maximum gradient and maximum count
+        GLuint histo2DTex;           //!< log-scaled 2D histogram
+        GLuint histoTimerQuery;      //!< GPU time of the histogram passes
+        GLsync histoFence;           //!< signaled once the pending GPU histograms are done
+        float histoGpuTime;          //!< GPU time of the last histogram computation in ms
+
+        bool useProgressive;         //!< toggle progressive refinement
+        float interactionScale;      //!< resolution scale of the raycaster while interacting
+        float interactionStepFactor; //!< step size multiplier while interacting
+        int progressiveMaxFrames;    //!< number of jittered passes until the image is converged
+        int progressiveFrame;        //!< number of passes accumulated so far
+        bool interacting;            //!< true if the render state changed this frame
+        RenderState lastRenderState; //!< render state of the last progressive frame
+
+        bool useIsoMesh;                                   //!< show the extracted isosurface mesh in isosurface mode
+        std::shared_ptr<IsoSurfaceExtractor> isoExtractor; //!< marching cubes on the current volume
+        std::future<IsoMesh> pendingIsoMesh;               //!< extraction in progress
+        std::shared_ptr<std::atomic<bool>> isoMeshCancel;  //!< stops the pending extraction
+        float pendingIsoValue;                             //!< isovalue of the pending extraction
+        bool isoMeshValid;                                 //!< a mesh was extracted from the current volume
+        float isoMeshValue;                                //!< isovalue of the current mesh
+        std::size_t isoMeshTriangles;                      //!< number of triangles of the current mesh
+        std::size_t isoMeshActiveBricks;                   //!< bricks visited for the current mesh
+        std::size_t isoMeshNumBricks;                      //!< number of bricks of the current volume
+        double isoMeshMs;                                  //!< extraction time of the current mesh
+
+        bool cpuRenderRequested;                           //!< start a CPU reference render in the next frame
+        std::future<CpuRaycaster::Image> pendingCpuRender; //!< CPU reference render in progress
+        std::vector<std::uint8_t> cpuRenderGpuImage;       //!< GPU image with the parameters of the pending render
+        std::string cpuRenderFilename;                     //!< PNG file the CPU image is saved to
+        double cpuRenderMs;                                //!< time of the last CPU render in ms
+        float cpuRenderRmse;                               //!< RMS error between the last CPU and GPU image
+        int cpuRenderMaxDiff;                              //!< largest channel difference between the images
+
+        std::unique_ptr<RaycastBenchmark> benchmark; //!< running benchmark, one case per frame
+        std::string benchmarkFilename;               //!< JSON file the results are written to
+        bool benchmarkCloseWhenDone;                 //!< close the window after writing, for unattended runs
+        bool benchmarkView;                          //!< render from benchmarkViewMx instead of the camera
+        glm::mat4 benchmarkViewMx;                   //!< view matrix of the current orbit position
+        std::vector<GLuint> benchmarkQueries;        //!< timer queries, one per orbit position
+        GLuint sampleCounterBuffer;                  //!< SSBO counting the volume samples
+        bool countSamples;                           //!< the volume pass adds its samples to sampleCounterBuffer
+
+        std::unique_ptr<glowl::GLSLProgram> shaderVolume;       //!< shader program for volume rendering
+        std::unique_ptr<glowl::GLSLProgram> shaderBackground;   //!< shader program for box rendering
+        std::unique_ptr<glowl::GLSLProgram> shaderHisto;        //!< shader program for histogram rendering
+        std::unique_ptr<glowl::GLSLProgram> shaderTfLines;      //!< shader program for histogram background
+        std::unique_ptr<glowl::GLSLProgram> shaderTfView;       //!< shader program for transfer functions
+        std::unique_ptr<glowl::GLSLProgram> shaderBlit;         //!< shader program for showing the progressive result
+        std::unique_ptr<glowl::GLSLProgram> shaderHisto1D;      //!< compute shader for the 1D histogram
+        std::unique_ptr<glowl::GLSLProgram> shaderHisto2D;      //!< compute shader for the 2D histogram
+        std::unique_ptr<glowl::GLSLProgram> shaderHisto2DView;  //!< shader program for the 2D histogram
+        std::unique_ptr<glowl::GLSLProgram> shaderGradient;     //!< compute shader for the gradient texture
+        std::unique_ptr<glowl::GLSLProgram> shaderPreIntegrate; //!< compute shader for the pre-integration table
+        std::unique_ptr<glowl::GLSLProgram> shaderIllumination; //!< compute shader for the light attenuation volume
+        std::unique_ptr<glowl::GLSLProgram> shaderIsoSurface;   //!< shader program for the isosurface mesh
+        std::unique_ptr<glowl::GLSLProgram> shaderBox;          //!< shader program for the box lines
 
         std::unique_ptr<glowl::Mesh> vaQuad;         //!< vertex array for histogram data
         std::unique_ptr<glowl::Mesh> vaHisto;        //!< vertex array for histogram data
         std::unique_ptr<glowl::Mesh> vaTransferFunc; //!< vertex array for transfer functions
+        std::unique_ptr<glowl::Mesh> vaIsoMesh;      //!< extracted isosurface
+        std::unique_ptr<glowl::Mesh> vaBox;          //!< edges of the unit cube
+
+        GLuint volumeTex;         //!< texture handle for volume data
+        GLuint gradientTex;       //!< precomputed normals (rgb) and relative gradient magnitude (a)
+        GLuint gradientMaxBuffer; //!< SSBO for the maximum gradient magnitude
+        GLuint tfTex;             //!< transfer function texture handle
+        GLuint preIntTex;         //!< pre-integrated transfer function, front x back sample
 
-        GLuint volumeTex; //!< texture handle for volume data
-        GLuint tfTex;     //!< transfer function texture handle
+        int fboWidth;               //!< width of the render targets, the size of the volume viewport
+        int fboHeight;              //!< height of the render targets
+        GLuint fboScene;            //!< FBO for the opaque geometry the volume is composited over
+        GLuint fboTexSceneColor;    //!< color attachment of fboScene
+        GLuint fboTexSceneDepth;    //!< depth attachment of fboScene, the rays end there
+        GLuint fboAccum;            //!< FBO accumulating the jittered passes while idle
+        GLuint fboTexAccum;         //!< float color attachment of fboAccum
+        GLuint fboTexAccumDepth;    //!< depth attachment of fboAccum, written by the first pass
+        GLuint fboInteract;         //!< FBO for the reduced resolution image while interacting
+        GLuint fboTexInteract;      //!< color attachment of fboInteract
+        GLuint fboTexInteractDepth; //!< depth attachment of fboInteract
     };
 } // namespace OGL4Core2::Plugins::PCVC::VolumeVis
 
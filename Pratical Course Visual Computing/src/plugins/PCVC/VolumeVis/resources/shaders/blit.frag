@@ -0,0 +1,14 @@
+#version 430
+
+uniform sampler2D tex;
+uniform sampler2D depthTex;            //!< depth written by the volume pass
+uniform vec2 texScale;                 //!< part of the texture which contains the image
+
+in vec2 texCoords;
+
+layout(location = 0) out vec4 fragColor;
+
+void main() {
+    fragColor = vec4(texture(tex, texCoords * texScale).rgb, 1.0);
+    gl_FragDepth = texture(depthTex, texCoords * texScale).r;
+}
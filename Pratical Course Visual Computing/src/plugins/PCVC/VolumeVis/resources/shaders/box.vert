@@ -0,0 +1,11 @@
+#version 430
+
+uniform mat4 projMx;
+uniform mat4 viewMx;
+uniform vec3 volumeDim;                //!< volume dimensions
+
+layout(location = 0) in vec3 in_position;
+
+void main() {
+    gl_Position = projMx * viewMx * vec4(in_position * volumeDim, 1.0);
+}
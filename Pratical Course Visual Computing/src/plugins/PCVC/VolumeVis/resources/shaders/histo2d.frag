@@ -0,0 +1,12 @@
+#version 430
+
+uniform sampler2D histoTex;            //!< log-scaled value x gradient magnitude histogram
+
+in vec2 texCoords;
+
+layout(location = 0) out vec4 fragColor;
+
+void main() {
+    float density = texture(histoTex, texCoords).r;
+    fragColor = vec4(vec3(density), 1.0);
+}
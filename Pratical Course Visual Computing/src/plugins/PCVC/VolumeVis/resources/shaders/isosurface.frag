@@ -0,0 +1,37 @@
+#version 430
+
+#define M_PI 3.14159265358979323846
+
+uniform vec3 cameraPos;                //!< camera position, also the light direction like in volume.frag
+
+uniform vec3 ambient;                  //!< ambient color
+uniform vec3 diffuse;                  //!< diffuse color
+uniform vec3 specular;                 //!< specular color
+
+uniform float k_amb;                   //!< ambient factor
+uniform float k_diff;                  //!< diffuse factor
+uniform float k_spec;                  //!< specular factor
+uniform float k_exp;                   //!< specular exponent
+
+in vec3 worldPos;
+in vec3 normal;
+
+layout(location = 0) out vec4 fragColor;
+
+/**
+ * Blinn-Phong shading, the same as in volume.frag.
+ * @param n             The normal at this pixel
+ * @param l             The direction vector towards the light
+ * @param v             The direction vector towards the viewer
+ */
+vec3 blinnPhong(vec3 n, vec3 l, vec3 v) {
+    vec3 h = normalize(v + l);
+    vec3 color = k_amb * ambient;
+    color += k_diff * diffuse * max(0.0, dot(n, normalize(l)));
+    color += k_spec * specular * pow(max(0.0, dot(n, h)), k_exp) * (k_exp + 2) / (2 * M_PI);
+    return color;
+}
+
+void main() {
+    fragColor = vec4(blinnPhong(normalize(normal), cameraPos, normalize(cameraPos - worldPos)), 1.0);
+}
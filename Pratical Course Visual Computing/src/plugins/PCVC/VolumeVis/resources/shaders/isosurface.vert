@@ -0,0 +1,16 @@
+#version 430
+
+uniform mat4 projMx;
+uniform mat4 viewMx;
+
+layout(location = 0) in vec3 in_position;
+layout(location = 1) in vec3 in_normal;
+
+out vec3 worldPos;
+out vec3 normal;
+
+void main() {
+    worldPos = in_position;
+    normal = in_normal;
+    gl_Position = projMx * viewMx * vec4(in_position, 1.0);
+}
@@ -1,6 +1,7 @@
 #version 430
 
 uniform int channel;                   //!< which color channel to draw (R,G,B or A)
+uniform bool selected;                 //!< whether the channel is the one being edited
 
 layout(location = 0) out vec4 fragColor;
 
@@ -9,5 +10,13 @@ void main() {
     // --------------------------------------------------------------------------------
     //  TODO: Set color of lines.
     // --------------------------------------------------------------------------------
+    if (channel == 3) {
+        color.rgb = vec3(1.0);
+    } else {
+        color[channel] = 1.0;
+    }
+    if (!selected) {
+        color.rgb *= 0.5;
+    }
     fragColor = color;
 }
@@ -10,4 +10,5 @@ void main() {
     // --------------------------------------------------------------------------------
     //  TODO: Set the position of the line vertices.
     // --------------------------------------------------------------------------------
+    gl_Position = orthoProjMx * vec4(in_position, in_values[channel], 0.0, 1.0);
 }
@@ -14,4 +14,10 @@ void main() {
     //  TODO: Draw the color of the transfer function preview (below the historgram).
     //        Mix with the background pattern to show transparency.
     // --------------------------------------------------------------------------------
+    float numPoints = float(textureSize(tex, 0));
+    vec4 tf = texture(tex, (texCoords.x * (numPoints - 1.0) + 0.5) / numPoints);
+
+    float checker = mod(floor(texCoords.x * 64.0) + floor(texCoords.y * 64.0 / aspect), 2.0);
+    vec3 background = checker == 0.0 ? vec3(0.5) : vec3(0.45);
+    fragColor = vec4(mix(background, tf.rgb, clamp(tf.a, 0.0, 1.0)), 1.0);
 }
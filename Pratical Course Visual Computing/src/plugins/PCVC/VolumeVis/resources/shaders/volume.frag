@@ -6,17 +6,35 @@
 #define FLT_MIN 1.175494351e-38
 
 uniform sampler3D volumeTex;           //!< 3D texture handle
-uniform sampler1D transferTex;
+uniform sampler2DArray compressedTex; //!< BC4 compressed slices, used instead of volumeTex if useCompressed
+uniform bool useCompressed;            //!< the volume is stored in compressedTex
+uniform vec2 compressedRange;          //!< value range the compressed slices are normalized to
+uniform sampler1D transferTex;         //!< transfer function, opacities refer to one reference step
+uniform sampler2D preIntTex;           //!< pre-integrated transfer function, front x back sample
+uniform bool usePreIntegration;        //!< classify ray segments instead of single samples
+uniform float refStep;                 //!< length of the reference step
+uniform sampler3D gradientTex;         //!< precomputed normalized gradients
+uniform bool useGradientTex;           //!< shade with gradientTex instead of central differences
+uniform sampler3D illumTex;            //!< light reaching each voxel, see illumination.comp
+uniform bool useShadows;               //!< attenuate the DVR samples by the light of illumTex
+uniform float shadowAmbient;           //!< light left in full shadow
 
 uniform mat4 invViewMx;                //!< inverse view matrix
 uniform mat4 invViewProjMx;            //!< inverse view-projection matrix
+uniform mat4 viewProjMx;               //!< view-projection matrix, for the depth output
+
+uniform sampler2D sceneColorTex;       //!< opaque geometry rendered before the volume
+uniform sampler2D sceneDepthTex;       //!< depth of the opaque geometry, the rays end there
+uniform float depthOpacity;            //!< accumulated opacity at which the volume writes its depth
 
 uniform vec3 volumeRes;                //!< volume resolution
 uniform vec3 volumeDim;                //!< volume dimensions
+uniform vec2 valueRange;               //!< voxel values mapped to 0 and 1
 
 uniform int viewMode; //<! rendering method: 0: line-of-sight, 1: mip, 2: isosurface, 3: volume
-uniform bool showBox;
 uniform bool useRandom;
+uniform uint seed;                     //!< seed for the random ray offset
+uniform vec2 pixelJitter;              //!< sub-pixel offset of the ray in texture coordinates
 
 uniform int maxSteps;                  //!< maximum number of steps
 uniform float stepSize;                //!< step size
@@ -33,6 +51,11 @@ uniform float k_diff;                  //!< diffuse factor
 uniform float k_spec;                  //!< specular factor
 uniform float k_exp;                   //!< specular exponent
 
+uniform bool countSamples;             //!< add the samples of each ray to numSamples, for the benchmark
+layout(std430, binding = 0) buffer SampleCounter {
+    uint numSamples;                   //!< volume samples of all fragments
+};
+
 in vec2 texCoords;
 
 layout(location = 0) out vec4 fragColor;
@@ -87,27 +110,27 @@ bool intersectBox(Ray r, vec3 boxmin, vec3 boxmax, out float tnear, out float tf
 }
 
 /**
- * Test if the given position is near a box edge.
- * @param pos           The position to test against
+ * Window depth of a world position for the default depth range.
+ * @param pos           The world coordinates
  */
-bool isBoxEdge(vec3 pos) {
-    // --------------------------------------------------------------------------------
-    //  TODO: Check if the position is near an edge of the volume cube.
-    // --------------------------------------------------------------------------------
-    // Calculate the difference between the point and min/max value of the volume
-    vec3 diffNear = abs(pos - 0.5 * volumeDim);
-    vec3 diffFar = abs(pos + 0.5 * volumeDim);
-
-    // Check the number of the difference which is less than the threshold
-    int count = 0;
-    for (int i = 0; i < 3; i++) {
-        if (diffNear[i] < 0.01) count ++;
-        if (diffFar[i] < 0.01) count ++;
-    }
+float windowDepth(vec3 pos) {
+    vec4 clip = viewProjMx * vec4(pos, 1.0);
+    return 0.5 * clip.z / clip.w + 0.5;
+}
 
-    // More than 2 differences < threshold represents it closes to the edge
-    if (count >=2) return true;
-    else return false;
+/**
+ * Distance along a ray to the opaque geometry of the scene.
+ * @param r             The ray
+ * @param ndc           Normalized device coordinates of the ray
+ * @param depth         Window depth of the geometry, 1 if there is none
+ * @return the distance, FLT_MAX if there is no geometry
+ */
+float sceneDistance(Ray r, vec2 ndc, float depth) {
+    if (depth >= 1.0) {
+        return FLT_MAX;
+    }
+    vec4 pos = invViewProjMx * vec4(ndc, 2.0 * depth - 1.0, 1.0);
+    return dot(pos.xyz / pos.w - r.o, r.d);
 }
 
 /**
@@ -122,6 +145,44 @@ vec3 mapTexCoords(vec3 pos) {
     return pos / volumeDim + vec3(0.5);
 }
 
+/**
+ * Filtered voxel value as the sampler of the uncompressed texture returns it.
+ * @param coords        Texture coordinates
+ */
+float volumeValue(vec3 coords) {
+    if (!useCompressed) {
+        return texture(volumeTex, coords).x;
+    }
+    // The slices are decoded and filtered by the texture unit, only the interpolation between them is left.
+    // Layers wrap around like the repeat mode of volumeTex.
+    float z = coords.z * volumeRes.z - 0.5;
+    float z0 = floor(z);
+    float layer0 = mod(z0, volumeRes.z);
+    float layer1 = mod(z0 + 1.0, volumeRes.z);
+    float value = mix(texture(compressedTex, vec3(coords.xy, layer0)).x,
+                      texture(compressedTex, vec3(coords.xy, layer1)).x, z - z0);
+    return compressedRange.x + value * (compressedRange.y - compressedRange.x);
+}
+
+/**
+ * Sample the volume, valueRange is mapped to [0, 1]. It is [0, 1] for the normalized integer textures and only
+ * stretches float volumes. The gradient in calcNormal() only differs from this by a positive factor, so the
+ * normalized normals do not depend on it.
+ * @param pos           The world coordinates of the sample
+ */
+float sampleVolume(vec3 pos) {
+    return (volumeValue(mapTexCoords(pos)) - valueRange.x) / (valueRange.y - valueRange.x);
+}
+
+/**
+ * Lookup table texture coordinate of a normalized value. 0 and 1 map to the first and last texel center.
+ * @param value         The normalized value
+ * @param numEntries    The size of the table
+ */
+float lutCoord(float value, int numEntries) {
+    return (clamp(value, 0.0, 1.0) * float(numEntries - 1) + 0.5) / float(numEntries);
+}
+
 /**
  * Calculate normals based on the volume gradient.
  */
@@ -130,7 +191,18 @@ vec3 calcNormal(vec3 pos) {
     //  TODO: Calculate normals based on volume gradient.
     // --------------------------------------------------------------------------------
     vec3 volumeCoord = mapTexCoords(pos);
+    if (useGradientTex) {
+        // One fetch, the gradient directions are stored mapped to [0, 1].
+        return normalize(texture(gradientTex, volumeCoord).xyz * 2.0 - 1.0);
+    }
     vec3 gradient;
+    if (useCompressed) {
+        vec3 d = 1.0 / volumeRes;
+        gradient.x = volumeValue(volumeCoord + vec3(d.x, 0, 0)) - volumeValue(volumeCoord - vec3(d.x, 0, 0));
+        gradient.y = volumeValue(volumeCoord + vec3(0, d.y, 0)) - volumeValue(volumeCoord - vec3(0, d.y, 0));
+        gradient.z = volumeValue(volumeCoord + vec3(0, 0, d.z)) - volumeValue(volumeCoord - vec3(0, 0, d.z));
+        return normalize(gradient);
+    }
     gradient.x = textureOffset(volumeTex, volumeCoord, ivec3(1, 0, 0)).x - textureOffset(volumeTex, volumeCoord, ivec3(-1, 0, 0)).x;
     gradient.y = textureOffset(volumeTex, volumeCoord, ivec3(0, 1, 0)).x - textureOffset(volumeTex, volumeCoord, ivec3(0, -1, 0)).x;
     gradient.z = textureOffset(volumeTex, volumeCoord, ivec3(0, 0, 1)).x - textureOffset(volumeTex, volumeCoord, ivec3(0, 0, -1)).x;
@@ -175,13 +247,18 @@ float random(uint seed) {
  * The main function of the shader.
  */
 void main() {
-    vec4 color = vec4(0.0, 0.0, 0.0, 1.0);
+    // Opaque geometry rendered before the volume, it is shown where the rays miss the volume.
+    vec4 sceneColor = texture(sceneColorTex, texCoords);
+    float sceneDepth = texture(sceneDepthTex, texCoords).r;
+    gl_FragDepth = sceneDepth;
+
     // --------------------------------------------------------------------------------
     //  TODO: Set up the ray and box. Do the intersection test and draw the box.
     // --------------------------------------------------------------------------------
     // Coordinate Transform
-    float NDCPosX = 2.0f * texCoords.x - 1.0f;
-    float NDCPosY = 2.0f * texCoords.y - 1.0f;
+    vec2 uv = texCoords + pixelJitter;
+    float NDCPosX = 2.0f * uv.x - 1.0f;
+    float NDCPosY = 2.0f * uv.y - 1.0f;
     vec4 clipPos = vec4(NDCPosX, NDCPosY, -1.0, 1.0);
 
     // Construct ray 
@@ -192,34 +269,46 @@ void main() {
     // Check the interscetion
     float tNear, tFar;
     bool isIntersect = intersectBox(ray, -0.5 * volumeDim, 0.5 * volumeDim, tNear, tFar);
-    if(!isIntersect) discard;
+    if (!isIntersect) {
+        fragColor = vec4(sceneColor.rgb, 1.0);
+        return;
+    }
+    // The rays end at the geometry, the box lines behind the volume included.
+    tFar = min(tFar, sceneDistance(ray, vec2(NDCPosX, NDCPosY), sceneDepth));
     vec3 posNear = tNear * ray.d + ray.o; // Position of intersection on the closest plane
-    vec3 posFar = tFar * ray.d + ray.o; // Position of intersection on the farthest plane
 
-    // Check whether the intersections are on the bounding box edge
-    bool isFrontFaceEdge = false;
-    bool isBackFaceEdge = false;
-    if (isBoxEdge(posNear)) isFrontFaceEdge = true;
-    if (isBoxEdge(posFar)) isBackFaceEdge = true;
+    // Random offset of the first sample within one step, hides slicing artifacts
+    float rayOffset = 0.0;
+    if (useRandom) {
+        rayOffset = random(uint(gl_FragCoord.x) * 1973u + uint(gl_FragCoord.y) * 9277u + seed * 26699u);
+    }
 
     // --------------------------------------------------------------------------------
     //  TODO: Draw the volume based on the current view mode.
     // --------------------------------------------------------------------------------
+    vec4 volume = vec4(0.0); // premultiplied, composited over the scene
+    int samples = 0;
     switch (viewMode) {
         case 0: { // line-of-sight
             // --------------------------------------------------------------------------------
             //  TODO: Implement line of sight (LoS) rendering.
             // --------------------------------------------------------------------------------
             float value = 0.0f;
+            bool sampled = false;
 
             for (int i = 1; i <= maxSteps; i++) {
-                float tStep = stepSize * i + tNear;
+                float tStep = stepSize * (float(i) - rayOffset) + tNear;
                 if (tStep >= tFar) break;
 
                 vec3 samplePos = tStep * ray.d + ray.o;
-                value += texture(volumeTex, mapTexCoords(samplePos)).x * scale;
+                value += sampleVolume(samplePos) * scale;
+                sampled = true;
+                samples++;
+            }
+            if (sampled) {
+                volume = vec4(value, value, value, 1.0);
+                gl_FragDepth = windowDepth(posNear);
             }
-            color = vec4(value, value, value, 1.0);
             break;
         }
         case 1: { // maximum-intesity projection
@@ -227,16 +316,22 @@ void main() {
             //  TODO: Implement maximum intensity projection (MIP) rendering.
             // --------------------------------------------------------------------------------
             float value = 0.0f;
+            bool sampled = false;
 
             for (int i = 1; i <= maxSteps; i++) {
-                float tStep = stepSize * i + tNear;
+                float tStep = stepSize * (float(i) - rayOffset) + tNear;
                 if (tStep >= tFar) break;
 
                 vec3 samplePos = tStep * ray.d + ray.o;
-                float sampleValue = texture(volumeTex, mapTexCoords(samplePos)).x;
+                float sampleValue = sampleVolume(samplePos);
                 if (sampleValue > value) value = sampleValue;
+                sampled = true;
+                samples++;
+            }
+            if (sampled) {
+                volume = vec4(value, value, value, 1.0);
+                gl_FragDepth = windowDepth(posNear);
             }
-            color = vec4(value, value, value, 1.0);
             break;
         }
         case 2: { // isosurface
@@ -247,45 +342,86 @@ void main() {
             vec3 sampleLastPos = ray.o;
 
             for (int i = 1; i <= maxSteps; i++) {
-                float tStep = stepSize * i + tNear;
+                float tStep = stepSize * (float(i) - rayOffset) + tNear;
                 if (tStep >= tFar) break;
 
                 vec3 samplePos = tStep * ray.d + ray.o;
-                float sampleValue = texture(volumeTex, mapTexCoords(samplePos)).x;
+                float sampleValue = sampleVolume(samplePos);
+                samples++;
                 if (sampleLastValue > isovalue) {
                     // Calculate the position and the normal of isovalue, and use Blinn-Phong shading
                     vec3 iosvaluePos = mix(sampleLastPos, samplePos, (isovalue - sampleLastValue) / (sampleValue - sampleLastValue));
                     vec3 normal = calcNormal(iosvaluePos);
-                    if(color != vec4(1.0, 1.0, 0.0, 1.0)) color = vec4(blinnPhong(-normal, ray.o, -ray.d), 1.0);
+                    volume = vec4(blinnPhong(-normal, ray.o, -ray.d), 1.0);
+                    gl_FragDepth = windowDepth(iosvaluePos);
                     break;
                 }
                 sampleLastValue = sampleValue;
                 sampleLastPos = samplePos;
             }
-            // Discard the fragment if it's not on the edge and not an isovalue (volume is transparent)
-            if(!isFrontFaceEdge && !isBackFaceEdge && (color == vec4(0.0, 0.0, 0.0, 1.0))) discard;
+            // Without a hit the volume is transparent and the scene shows through.
             break;
         }
         case 3: { // volume visualization with transfer function
             // --------------------------------------------------------------------------------
             //  TODO: Implement volume rendering.
             // --------------------------------------------------------------------------------
+            vec4 acc = vec4(0.0); // premultiplied, front to back
+            int tfSize = textureSize(transferTex, 0);
+            int preIntSize = textureSize(preIntTex, 0).x;
+            float tFront = tNear;
+            float sampleFront = sampleVolume(tNear * ray.d + ray.o);
+            bool depthWritten = false;
+            samples++;
+
+            for (int i = 1; i <= maxSteps; i++) {
+                if (tFront >= tFar) break;
+                // The random offset shortens the first segment, the last one ends at tFar. Opacities are
+                // corrected for the actual length of every segment.
+                float tStep = min(stepSize * (float(i) - rayOffset) + tNear, tFar);
+                float segmentLength = tStep - tFront;
+
+                vec3 samplePos = tStep * ray.d + ray.o;
+                float sampleBack = sampleVolume(samplePos);
+                samples++;
+                vec4 segment;
+                if (usePreIntegration) {
+                    segment = texture(preIntTex, vec2(lutCoord(sampleFront, preIntSize), lutCoord(sampleBack, preIntSize)));
+                    // The table holds full steps, shorter segments keep the color and get less opacity.
+                    if (segmentLength < stepSize && segment.a > 0.0) {
+                        float alpha = 1.0 - pow(1.0 - min(segment.a, 0.9999), segmentLength / stepSize);
+                        segment *= alpha / segment.a;
+                    }
+                } else {
+                    vec4 tf = texture(transferTex, lutCoord(sampleBack, tfSize));
+                    float alpha = 1.0 - pow(1.0 - clamp(tf.a, 0.0, 1.0), segmentLength / refStep);
+                    segment = vec4(tf.rgb * alpha, alpha);
+                }
+                if (useShadows) {
+                    float light = texture(illumTex, mapTexCoords(samplePos)).r;
+                    segment.rgb *= shadowAmbient + (1.0 - shadowAmbient) * light;
+                }
+                acc += (1.0 - acc.a) * segment;
+                // The volume counts as a surface where it becomes opaque enough.
+                if (!depthWritten && acc.a >= depthOpacity) {
+                    gl_FragDepth = windowDepth(tStep * ray.d + ray.o);
+                    depthWritten = true;
+                }
+                if (acc.a > 0.99) break;
+                sampleFront = sampleBack;
+                tFront = tStep;
+            }
+            volume = acc;
             break;
         }
         default: {
-            color = vec4(1.0, 0.0, 0.0, 1.0);
+            volume = vec4(1.0, 0.0, 0.0, 1.0);
             break;
         }
     }
 
-    // --------------------------------------------------------------------------------
-    //  TODO: Draw the box lines behind the volume, if the volume is transparent.
-    // --------------------------------------------------------------------------------
-    // Draw bounding box edge
-    if (showBox) {
-        if (isFrontFaceEdge) color = vec4(1.0, 1.0, 0.0, 1.0);
-        if (isBackFaceEdge && (viewMode == 2) && color == vec4(0.0, 0.0, 0.0, 1.0)) color = vec4(1.0, 1.0, 0.0, 1.0);
+    if (countSamples) {
+        atomicAdd(numSamples, uint(samples));
     }
-
-    fragColor = color;
+    fragColor = vec4(volume.rgb + (1.0 - volume.a) * sceneColor.rgb, 1.0);
 }